@@ -3,19 +3,39 @@ CONFIG += console
 CONFIG -= app_bundle
 CONFIG -= qt
 
-LIBS += -lftdi
+# libftdi 0.x by default, libftdi1 (libusb-1.0) where pkg-config finds it
+unix:packagesExist(libftdi1) {
+    DEFINES += LIBFTDI1
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libftdi1
+} else {
+    LIBS += -lftdi
+}
+# pthreads: the gang mode and the drain thread of -async, which also needs C11 atomics
+unix {
+    DEFINES += USB_QUEUE_THREAD
+    LIBS += -lpthread
+}
 
 
 SOURCES += \
+    adapter.c \
     flash.c \
     flash_over_jtag.c \
     jtag.c \
-    srec.c
+    mpsse.c \
+    srec.c \
+    target_sim.c \
+    usb_queue.c
 
 HEADERS += \
+    adapter.h \
     exit_codes.h \
     flash.h \
     flash_over_jtag.h \
     hw_access.h \
     jtag.h \
-    srec.h
+    mpsse.h \
+    srec.h \
+    target_sim.h \
+    usb_queue.h
@@ -0,0 +1,395 @@
+/*****************************************************************************
+*
+* File Name:         adapter.c
+*
+* Description:       Discovery and selection of the FTDI adapters
+*
+* Modules Included:
+*	int set_adapter(jtag_session *s, char *spec);
+*	int adapter_scan(adapter_info list[], int max);
+*	int adapter_cache_read(adapter_info list[], int max);
+*	int adapter_cache_write(adapter_info list[], int count);
+*	int adapter_list(void);
+*	int adapter_open(jtag_session *s, unsigned char bitmode);
+*	int adapter_tck_read(jtag_session *s);
+*	int adapter_tck_write(jtag_session *s, unsigned int divisor);
+*
+* Comments: Every channel of the FT232H, FT2232H and FT4232H devices on the bus is listed
+*           with its serial number and bus path. The list of the last scan is kept in
+*           ADAPTER_CACHE_FILE, a selected adapter is looked up there first and the bus is
+*           only scanned again when it is not listed or cannot be opened. The TCK divisors
+*           found by jtag_calibrate_tck are kept per adapter in ADAPTER_TCK_FILE.
+*           libftdi 0.x (libusb-0.1) is used unless LIBFTDI1 is defined, it only knows the bus
+*           and the address of a device, the port path is then looked up in ADAPTER_SYSFS_USB.
+*
+****************************************************************************/
+
+#include <ftdi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <dirent.h>
+#endif
+
+#include "adapter.h"
+
+#ifdef LIBFTDI1
+typedef struct libusb_device adapter_device;
+#else
+typedef struct usb_device adapter_device;
+#endif
+
+/* channels of the device, 0 for the devices without JTAG support */
+static int adapter_channels(unsigned int pid) {
+    switch (pid) {
+    case PID_FT232H: return(1);
+    case PID_FT2232H: return(2);
+    case PID_FT4232H: return(4);
+    }
+    return(0);
+}
+
+static char *adapter_type(unsigned int pid) {
+    switch (pid) {
+    case PID_FT232H: return("FT232H");
+    case PID_FT2232H: return("FT2232H");
+    case PID_FT4232H: return("FT4232H");
+    }
+    return("?");
+}
+
+#ifdef LIBFTDI1
+/* <bus>-<port>[.<port>...] of the device */
+static void adapter_path(adapter_device *dev, char *path) {
+    uint8_t ports[7];
+    int i,n,len;
+    n=libusb_get_port_numbers(dev,ports,sizeof(ports));
+    len=sprintf(path,"%d",libusb_get_bus_number(dev));
+    for (i=0;i<n;i++) len+=sprintf(path+len,"%c%d",i?'.':'-',ports[i]);
+}
+#else
+#ifdef __linux__
+/* number in a sysfs attribute file, -1 if it cannot be read */
+static int adapter_sysfs_value(char *dir, char *attribute) {
+    char name[512];
+    FILE *file;
+    int value=-1;
+    snprintf(name,sizeof(name),"%s/%s/%s",ADAPTER_SYSFS_USB,dir,attribute);
+    if ((file=fopen(name,"r"))==NULL) return(-1);
+    if (fscanf(file,"%d",&value)!=1) value=-1;
+    fclose(file);
+    return(value);
+}
+#endif
+
+/* <bus>-<port>[.<port>...] of the device, found in sysfs by the bus number and the address */
+/* <bus>-<address> where there is no sysfs, the address changes when the device is plugged again */
+static void adapter_path(adapter_device *dev, char *path) {
+    char *digits=dev->bus->dirname;
+    int bus;
+#ifdef __linux__
+    DIR *dir;
+    struct dirent *entry;
+#endif
+    while ((*digits)&&((*digits<'0')||(*digits>'9'))) digits++;	/* "001" on Linux, "bus-0" on Windows */
+    bus=atoi(digits);
+    sprintf(path,"%d-%d",bus,dev->devnum);
+#ifdef __linux__
+    if ((dir=opendir(ADAPTER_SYSFS_USB))==NULL) return;
+    while ((entry=readdir(dir))!=NULL) {
+        if ((entry->d_name[0]<'0')||(entry->d_name[0]>'9')||(strchr(entry->d_name,':')!=NULL)) continue;	/* root hubs and interfaces */
+        if (strlen(entry->d_name)>ADAPTER_PATH_MAX) continue;
+        if ((adapter_sysfs_value(entry->d_name,"busnum")==bus)&&(adapter_sysfs_value(entry->d_name,"devnum")==dev->devnum)) {
+            strcpy(path,entry->d_name);
+            break;
+        }
+    }
+    closedir(dir);
+#endif
+}
+#endif
+
+/* lists sorted by bus path and channel */
+static int adapter_compare(const void *a, const void *b) {
+    const adapter_info *x=(const adapter_info*)a, *y=(const adapter_info*)b;
+    int c=strcmp(x->path,y->path);
+    if (c) return(c);
+    return(x->channel-y->channel);
+}
+
+/* <serial>, <bus path> or 0x<PID>, optionally followed by :A..:D for the channel */
+/* returns 0 on success, -1 on a bad spec */
+int set_adapter(jtag_session *s, char *spec) {
+    char name[ADAPTER_SERIAL_MAX+ADAPTER_PATH_MAX+1];
+    char *colon;
+    int i;
+    strncpy(name,spec,sizeof(name)-1);
+    name[sizeof(name)-1]=0;
+    s->adapter_serial[0]=0;
+    s->adapter_path[0]=0;
+    s->adapter_pid=0;
+    s->adapter_channel=-1;
+    if ((colon=strrchr(name,':'))!=NULL) {
+        if ((colon[1]<'A')||(colon[1]>'D')||(colon[2])) return(-1);
+        s->adapter_channel=colon[1]-'A';
+        *colon=0;
+    }
+    if ((name[0]=='0')&&((name[1]=='x')||(name[1]=='X'))) {
+        s->adapter_pid=strtoul(name,NULL,16);
+        if (!adapter_channels(s->adapter_pid)) return(-1);
+        return(0);
+    }
+    for (i=0;name[i];i++) if (((name[i]<'0')||(name[i]>'9'))&&(name[i]!='-')&&(name[i]!='.')) break;
+    if ((!name[i])&&(strchr(name,'-')!=NULL)) {		/* only digits, '-' and '.': bus path */
+        if (strlen(name)>ADAPTER_PATH_MAX) return(-1);
+        strcpy(s->adapter_path,name);
+        return(0);
+    }
+    if ((!name[0])||(strlen(name)>ADAPTER_SERIAL_MAX)) return(-1);
+    set_adapter_serial(s,name);
+    return(0);
+}
+
+/* finds the channels of all FT232H, FT2232H and FT4232H devices, returns -1 on USB error */
+/* the strings of a device opened by another program may not be readable, they are taken from the cache then */
+int adapter_scan(adapter_info list[], int max) {
+    static const unsigned int pids[3]={PID_FT232H,PID_FT2232H,PID_FT4232H};
+    struct ftdi_context *ftdic;
+    struct ftdi_device_list *devlist, *d;
+    adapter_info cached[ADAPTERS_MAX], found;
+    int i,k,p,channels,cached_count,count=0;
+    if ((ftdic=ftdi_new())==NULL) return(-1);
+    cached_count=adapter_cache_read(cached,ADAPTERS_MAX);
+    for (p=0;p<3;p++) {								/* one PID at a time, libftdi 0.x has no list of all FTDI PIDs */
+        if (ftdi_usb_find_all(ftdic,&devlist,FTDI_VID,pids[p])<0) {
+            printf("USB scan failed: %s\n",ftdi_get_error_string(ftdic));
+            ftdi_free(ftdic);
+            return(-1);
+        }
+        channels=adapter_channels(pids[p]);
+        for (d=devlist;d!=NULL;d=d->next) {
+            memset(&found,0,sizeof(found));
+            found.pid=pids[p];
+            adapter_path(d->dev,found.path);
+            if (ftdi_usb_get_strings(ftdic,d->dev,NULL,0,found.description,sizeof(found.description),found.serial,sizeof(found.serial))<0) {
+                found.serial[0]=0;
+                strcpy(found.description,"(in use)");
+                for (i=0;i<cached_count;i++) if ((cached[i].pid==found.pid)&&(!strcmp(cached[i].path,found.path))) {
+                    strcpy(found.serial,cached[i].serial);
+                    strcpy(found.description,cached[i].description);
+                    break;
+                }
+            }
+            for (k=0;(k<channels)&&(count<max);k++) {
+                list[count]=found;
+                list[count].channel=k;
+                count++;
+            }
+        }
+        ftdi_list_free(&devlist);
+    }
+    ftdi_free(ftdic);
+    qsort(list,count,sizeof(adapter_info),adapter_compare);
+    return(count);
+}
+
+/* file name of a cache in the home directory, the current directory without $HOME */
+static void adapter_cache_name(char *name, int size, char *file) {
+    char *home=getenv("HOME");
+    if ((home!=NULL)&&(home[0])) snprintf(name,size,"%s/%s",home,file);
+    else snprintf(name,size,"%s",file);
+}
+
+/* temporary file next to the cache, the address of a local variable makes the name unique for */
+/* every thread (gang mode) and, with address space randomization, for every process */
+static void adapter_temp_name(char *temp, int size, char *name) {
+    char local;
+    snprintf(temp,size,"%s.%lx.%lx",name,(unsigned long)time(NULL),(unsigned long)(size_t)&local);
+}
+
+/* replaces the cache by the temporary file, rename does not overwrite on Windows */
+static int adapter_temp_rename(char *temp, char *name) {
+#ifdef _WIN32
+    remove(name);
+#endif
+    if (rename(temp,name)!=0) {
+        remove(temp);
+        return(-1);
+    }
+    return(0);
+}
+
+/* returns the number of channels of the last scan, -1 when there is no cache */
+int adapter_cache_read(adapter_info list[], int max) {
+    char name[1024], line[256], channel;
+    FILE *cache;
+    int count=0;
+    adapter_cache_name(name,sizeof(name),ADAPTER_CACHE_FILE);
+    if ((cache=fopen(name,"r"))==NULL) return(-1);
+    while ((count<max)&&(fgets(line,sizeof(line),cache)!=NULL)) {
+        adapter_info *a=&(list[count]);
+        if (line[0]=='#') continue;
+        memset(a,0,sizeof(adapter_info));
+        if (sscanf(line,"%x %c %32s %32s %64[^\r\n]",&(a->pid),&channel,a->path,a->serial,a->description)<4) continue;
+        if ((!adapter_channels(a->pid))||(channel<'A')||(channel>'D')) continue;
+        a->channel=channel-'A';
+        if (!strcmp(a->serial,"-")) a->serial[0]=0;
+        count++;
+    }
+    fclose(cache);
+    return(count);
+}
+
+/* writes the list to a temporary file first, sessions started at the same time never read half a list */
+int adapter_cache_write(adapter_info list[], int count) {
+    char name[1024], temp[1100];
+    FILE *cache;
+    int i;
+    adapter_cache_name(name,sizeof(name),ADAPTER_CACHE_FILE);
+    adapter_temp_name(temp,sizeof(temp),name);
+    if ((cache=fopen(temp,"w"))==NULL) return(-1);
+    fprintf(cache,"# PID channel bus-path serial description, written by Flash_over_JTAG -adapters\n");
+    for (i=0;i<count;i++)
+        fprintf(cache,"%04x %c %s %s %s\n",list[i].pid,'A'+list[i].channel,list[i].path,list[i].serial[0]?list[i].serial:"-",list[i].description);
+    fclose(cache);
+    return(adapter_temp_rename(temp,name));
+}
+
+/* scans the bus, prints the channels and caches the list, returns the number of channels */
+int adapter_list(void) {
+    adapter_info list[ADAPTERS_MAX];
+    char name[1024];
+    int i,count;
+    if ((count=adapter_scan(list,ADAPTERS_MAX))<0) return(-1);
+    adapter_cache_write(list,count);
+    adapter_cache_name(name,sizeof(name),ADAPTER_CACHE_FILE);
+    printf("%d FTDI channels found, the list is cached in %s\n\n",count,name);
+    if (!count) return(0);
+    printf("%-8s %-4s %-6s %-12s %-*s %s\n","type","ch","MPSSE","bus path",ADAPTER_SERIAL_MAX/2,"serial","description");
+    for (i=0;i<count;i++)
+        printf("%-8s %-4c %-6s %-12s %-*s %s\n",adapter_type(list[i].pid),'A'+list[i].channel,(list[i].channel<2)?"yes":"no",
+               list[i].path,ADAPTER_SERIAL_MAX/2,list[i].serial[0]?list[i].serial:"-",list[i].description);
+    printf("\nSelect one with -adapter<serial>, -adapter<bus path> or -adapter0x<PID>, :B..:D for the other channels\n");
+    return(count);
+}
+
+/* name of the adapter in the TCK cache: the selection, "sim" for the target simulator */
+static void adapter_key(jtag_session *s, char *key) {
+    if (s->sim!=NULL) strcpy(key,"sim");
+    else if (s->adapter_serial[0]) strcpy(key,s->adapter_serial);
+    else if (s->adapter_path[0]) strcpy(key,s->adapter_path);
+    else if (s->adapter_pid) sprintf(key,"0x%04x",s->adapter_pid);
+    else strcpy(key,"default");						/* the first FT232H */
+    if (s->adapter_channel>=0) sprintf(key+strlen(key),":%c",'A'+s->adapter_channel);
+}
+
+/* TCK divisor calibrated for the adapter before, -1 if there is none */
+int adapter_tck_read(jtag_session *s) {
+    char name[1024], line[256], key[ADAPTER_SERIAL_MAX+ADAPTER_PATH_MAX+4], entry[sizeof(key)];
+    unsigned int divisor;
+    FILE *cache;
+    int result=-1;
+    adapter_cache_name(name,sizeof(name),ADAPTER_TCK_FILE);
+    adapter_key(s,key);
+    if ((cache=fopen(name,"r"))==NULL) return(-1);
+    while (fgets(line,sizeof(line),cache)!=NULL) {
+        if (sscanf(line,"%67s %u",entry,&divisor)!=2) continue;
+        if ((!strcmp(entry,key))&&(divisor<=MPSSE_DIVISOR_MAX)) result=divisor;
+    }
+    fclose(cache);
+    return(result);
+}
+
+/* replaces the divisor of the adapter in the cache, the other adapters are kept */
+int adapter_tck_write(jtag_session *s, unsigned int divisor) {
+    char name[1024], temp[1100], line[256], key[ADAPTER_SERIAL_MAX+ADAPTER_PATH_MAX+4], entry[sizeof(key)];
+    unsigned int value;
+    FILE *cache, *out;
+    adapter_cache_name(name,sizeof(name),ADAPTER_TCK_FILE);
+    adapter_key(s,key);
+    adapter_temp_name(temp,sizeof(temp),name);
+    if ((out=fopen(temp,"w"))==NULL) return(-1);
+    if ((cache=fopen(name,"r"))!=NULL) {
+        while (fgets(line,sizeof(line),cache)!=NULL)
+            if ((sscanf(line,"%67s %u",entry,&value)==2)&&(strcmp(entry,key))) fputs(line,out);
+        fclose(cache);
+    }
+    fprintf(out,"%s %u\n",key,divisor);
+    fclose(out);
+    return(adapter_temp_rename(temp,name));
+}
+
+/* the first channel of the list which matches the selection */
+static adapter_info *adapter_match(jtag_session *s, adapter_info list[], int count) {
+    int i;
+    for (i=0;i<count;i++) {
+        if ((s->adapter_serial[0])&&(strcmp(list[i].serial,s->adapter_serial))) continue;
+        if ((s->adapter_path[0])&&(strcmp(list[i].path,s->adapter_path))) continue;
+        if ((s->adapter_pid)&&(list[i].pid!=s->adapter_pid)) continue;
+        if ((s->adapter_channel>=0)&&(list[i].channel!=s->adapter_channel)) continue;
+        return(&(list[i]));
+    }
+    return(NULL);
+}
+
+/* opens the device at the bus path of the list entry, only the devices with its PID are listed and */
+/* only the one at the path is asked for its serial number, which must still be the listed one */
+static int adapter_open_path(jtag_session *s, adapter_info *a) {
+    struct ftdi_device_list *devlist, *d;
+    char path[ADAPTER_PATH_MAX+1], serial[ADAPTER_SERIAL_MAX+1];
+    int rc=-1;
+    if (ftdi_usb_find_all(s->ftdic,&devlist,FTDI_VID,a->pid)<0) return(-1);
+    for (d=devlist;d!=NULL;d=d->next) {
+        adapter_path(d->dev,path);
+        if (strcmp(path,a->path)) continue;
+        if ((a->serial[0])&&(!s->adapter_path[0])) {		/* another adapter may be plugged into that port now */
+            if (ftdi_usb_get_strings(s->ftdic,d->dev,NULL,0,NULL,0,serial,sizeof(serial))<0) break;
+            if (strcmp(serial,a->serial)) break;
+        }
+        rc=ftdi_usb_open_dev(s->ftdic,d->dev);
+        break;
+    }
+    ftdi_list_free(&devlist);
+    return(rc);
+}
+
+/* opens the channel at its bus path, a serial number selection is searched on the bus when the */
+/* adapter is no longer at that path, a bus path selection is only opened at that path */
+static int adapter_open_channel(jtag_session *s, adapter_info *a) {
+    ftdi_set_interface(s->ftdic,INTERFACE_A+a->channel);
+    if (adapter_open_path(s,a)==0) return(0);
+    if ((a->serial[0])&&(!s->adapter_path[0]))
+        return(ftdi_usb_open_desc(s->ftdic,FTDI_VID,a->pid,NULL,a->serial));
+    return(-1);
+}
+
+/* opens the channel selected by set_adapter, looked up in the cache first and scanned */
+/* for when it is not listed or the cached entry cannot be opened, returns 0 on success */
+int adapter_open(jtag_session *s, unsigned char bitmode) {
+    adapter_info list[ADAPTERS_MAX], *a;
+    int count,scanned=0;
+    count=adapter_cache_read(list,ADAPTERS_MAX);
+    a=adapter_match(s,list,count);
+    for (;;) {
+        if (a!=NULL) {
+            if ((bitmode==BITMODE_MPSSE)&&(a->channel>1)) {
+                printf("Channel %c of the %s %s has no MPSSE engine\n",'A'+a->channel,adapter_type(a->pid),a->path);
+                return(-1);
+            }
+            if (adapter_open_channel(s,a)==0) {
+                printf("Adapter %s channel %c at %s, serial %s\n",adapter_type(a->pid),'A'+a->channel,a->path,a->serial[0]?a->serial:"-");
+                return(0);
+            }
+        }
+        if (scanned) break;
+        if ((count=adapter_scan(list,ADAPTERS_MAX))<0) return(-1);
+        adapter_cache_write(list,count);
+        scanned=1;
+        a=adapter_match(s,list,count);
+    }
+    if (a==NULL) printf("No FTDI adapter matches the selection\n");
+    else printf("Unable to open %s channel %c at %s: %s\n",adapter_type(a->pid),'A'+a->channel,a->path,ftdi_get_error_string(s->ftdic));
+    return(-1);
+}
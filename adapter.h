@@ -0,0 +1,48 @@
+/*****************************************************************************
+*
+* File Name:         adapter.h
+*
+* Description:       Discovery and selection of the FTDI adapters
+*
+* Modules Included:  None
+*
+****************************************************************************/
+
+#ifndef ADAPTER____H
+#define ADAPTER____H
+
+#include <ftdi.h>
+
+#include "jtag.h"
+
+#define ADAPTERS_MAX		32			/* channels listed by a scan */
+#define ADAPTER_DESC_MAX	64			/* length of the product description */
+#define ADAPTER_CACHE_FILE	".flash_over_jtag_adapters"	/* device list of the last scan, in $HOME */
+#define ADAPTER_TCK_FILE	".flash_over_jtag_tck"		/* calibrated TCK divisor per adapter, in $HOME */
+#ifndef ADAPTER_SYSFS_USB
+#define ADAPTER_SYSFS_USB	"/sys/bus/usb/devices"	/* port paths of the USB devices (Linux, libftdi 0.x) */
+#endif
+
+#define FTDI_VID			0x0403
+#define PID_FT2232H			0x6010		/* two channels, MPSSE on A and B */
+#define PID_FT4232H			0x6011		/* four channels, MPSSE on A and B */
+#define PID_FT232H			0x6014		/* one channel with MPSSE */
+
+typedef struct {
+	unsigned int	pid;		/* PID_xxx */
+	int				channel;	/* 0=A, 1=B, 2=C, 3=D */
+	char			path[ADAPTER_PATH_MAX+1];		/* <bus>-<port>[.<port>...], as in /sys/bus/usb/devices, <bus>-<address> without sysfs */
+	char			serial[ADAPTER_SERIAL_MAX+1];	/* "" when the EEPROM holds none */
+	char			description[ADAPTER_DESC_MAX+1];
+} adapter_info;
+
+int set_adapter(jtag_session *s, char *spec);	/* <serial>, <bus path> or 0x<PID>, optionally :A..:D, returns -1 on a bad spec */
+int adapter_scan(adapter_info list[], int max);	/* returns the number of channels found, -1 on USB error */
+int adapter_cache_read(adapter_info list[], int max);	/* returns -1 when there is no cache */
+int adapter_cache_write(adapter_info list[], int count);
+int adapter_list(void);							/* scans, prints and caches the adapters, returns the number found */
+int adapter_open(jtag_session *s, unsigned char bitmode);	/* opens the channel selected by set_adapter, 0 on success */
+int adapter_tck_read(jtag_session *s);			/* calibrated TCK divisor of the adapter, -1 if not cached */
+int adapter_tck_write(jtag_session *s, unsigned int divisor);
+
+#endif
@@ -13,6 +13,12 @@
 * Modules Included:
 *	int read_setup(char *path, flash_constants flash_param[])
 *	int flash_prepare(flash_constants flash_param[], int flash_count)
+*	int flash_copy(flash_constants copy[], flash_constants flash_param[], int flash_count)
+*	void flash_release(flash_constants flash_param[], int flash_count)
+*	double flash_program_time(flash_constants flash_param, unsigned int words)
+*	double flash_erase_time(flash_constants flash_param, unsigned int mass)
+*	unsigned long int flash_checksum(unsigned int *data, unsigned int count)
+*	unsigned int flash_next_run(flash_constants flash_param, unsigned int addr, unsigned int end, unsigned int gap, unsigned int *start)
 *
 * Author: Daniel Malik (daniel.malik@motorola.com)
 *
@@ -20,6 +26,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "flash.h"
 
 /* Reads flash set-up from disk file */
@@ -40,6 +47,9 @@ int read_setup(char *path, flash_constants flash_param[]) {
             j = sscanf(line,"%d 0x%x 0x%x %d 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x\n",
                        &base,
                        &(flash_param[i].flash_start),
+                       &(flash_param[i].flash_end),
+                       &(flash_param[i].program_memory),
+                       &(flash_param[i].interface_address),
                        &(flash_param[i].terasel),
                        &(flash_param[i].tmel),
                        &(flash_param[i].tnvsl),
@@ -101,3 +111,93 @@ int flash_prepare(flash_constants flash_param[], int flash_count) {
     return(0);
 }
 
+/* copies the blocks together with their data and erase maps, the copy can be programmed */
+/* while the original is used by another session, returns 0 on success, -1 out of memory */
+int flash_copy(flash_constants copy[], flash_constants flash_param[], int flash_count) {
+    int i,k,words;
+
+    for (i=0;i<flash_count;i++) {
+        copy[i]=flash_param[i];
+        copy[i].data=NULL;
+        copy[i].page_erase_map=NULL;
+    }
+    for (i=0;i<flash_count;i++) {
+        if (flash_param[i].data!=NULL) {
+            words=flash_param[i].flash_end-flash_param[i].flash_start+1;
+            copy[i].data=(unsigned int*)malloc(words*sizeof(unsigned int));
+            if (copy[i].data==NULL) return(-1);
+            memcpy(copy[i].data,flash_param[i].data,words*sizeof(unsigned int));
+        }
+        if (flash_param[i].page_erase_map==NULL) continue;
+        if (!flash_param[i].duplicate) {
+            copy[i].page_erase_map=(unsigned int*)malloc(MAX_PAGE_COUNT*sizeof(unsigned int));
+            if (copy[i].page_erase_map==NULL) return(-1);
+            memcpy(copy[i].page_erase_map,flash_param[i].page_erase_map,MAX_PAGE_COUNT*sizeof(unsigned int));
+        } else {
+            k=0;							/* duplicate, share the map of the original like flash_prepare */
+            while ((k<i)&&(flash_param[i].interface_address!=flash_param[k].interface_address))
+                k++;
+            copy[i].page_erase_map=copy[k].page_erase_map;
+        }
+    }
+    return(0);
+}
+
+/* frees the memory allocated by flash_prepare or flash_copy */
+void flash_release(flash_constants flash_param[], int flash_count) {
+    int i;
+
+    for (i=0;i<flash_count;i++) {
+        if (flash_param[i].data!=NULL) free(flash_param[i].data);
+        if ((!flash_param[i].duplicate)&&(flash_param[i].page_erase_map!=NULL)) free(flash_param[i].page_erase_map);
+        flash_param[i].data=NULL;
+        flash_param[i].page_erase_map=NULL;
+    }
+}
+
+/* predicts how long the FIU is BUSY programming the given number of words */
+/* the timing registers count FIU clocks of 2*(clk_divisor+1) IPBus clocks, returns microseconds */
+double flash_program_time(flash_constants flash_param, unsigned int words) {
+    unsigned int ticks=flash_param.tnvsl+flash_param.tpgsl+flash_param.tprogl+flash_param.tnvhl+flash_param.trcvl;
+    return((double)words*ticks*2.0*(flash_param.clk_divisor+1)*1e6/FIU_IPBUS_CLOCK);
+}
+
+/* predicts how long the FIU is BUSY with one mass erase (mass!=0) or one page erase, returns microseconds */
+double flash_erase_time(flash_constants flash_param, unsigned int mass) {
+    unsigned int ticks=flash_param.tnvsl+flash_param.trcvl;
+    if (mass) ticks+=flash_param.tmel+flash_param.tnvhl1;
+    else ticks+=flash_param.terasel+flash_param.tnvhl;
+    return((double)ticks*2.0*(flash_param.clk_divisor+1)*1e6/FIU_IPBUS_CLOCK);
+}
+
+/* checksum computed by the verification routine on the target (see once_checksum_load) */
+/* Fletcher style, A = sum of the words, B = sum of the A values, both modulo 2^16, returns B:A */
+unsigned long int flash_checksum(unsigned int *data, unsigned int count) {
+    unsigned int i,a=0,b=0;
+    for (i=0;i<count;i++) {
+        a=(a+data[i])&0xffff;
+        b=(b+a)&0xffff;
+    }
+    return(((unsigned long int)b<<16)|a);
+}
+
+/* finds the next run of words to be programmed from addr up to end (exclusive) */
+/* runs are separated by at least gap erased words (0xffff), gap 0 makes one run of the whole range */
+/* returns the length of the run (0 if there is none) and its first address in *start */
+unsigned int flash_next_run(flash_constants flash_param, unsigned int addr, unsigned int end, unsigned int gap, unsigned int *start) {
+    unsigned int *data=flash_param.data;
+    unsigned int last,blank=0;
+    if (!gap) {
+        *start=addr;
+        return((end>addr)?end-addr:0);
+    }
+    while ((addr<end)&&(data[addr-flash_param.flash_start]==0xffff)) addr++;
+    *start=addr;
+    for (last=addr;addr<end;addr++) {
+        if (data[addr-flash_param.flash_start]!=0xffff) {
+            last=addr+1;
+            blank=0;
+        } else if (++blank>=gap) break;
+    }
+    return(last-*start);
+}
@@ -22,6 +22,7 @@
 #define MAX_FLASH_UNITS		32	/* how many flash blocks do we have at maximum */
 #define MAX_PAGE_COUNT		128	/* maximum flash size is 32k (128 pages, 256 words each) */
 #define MAX_LINE_LENGTH		300	/* max line length in input config file */
+#define FIU_IPBUS_CLOCK		36000000.0	/* IPBus clock assumed when predicting FIU BUSY times from the timing registers */
 
 typedef struct {
 	unsigned int	flash_start;	/* beginning of the block in memory map */
@@ -45,6 +46,13 @@ typedef struct {
 									 /* bit1: 1=request to erase this page (set by S-rec processing routine), 0=preserve page */
 } flash_constants;
 
+typedef struct {
+	unsigned int	start;		/* beginning of the block */
+	unsigned int	end;		/* end of the block */
+	unsigned char	program_memory;	/* 1-pflash, 0-dflash */
+	unsigned int	*data;		/* pointer to array where data are to be stored */
+} mem_read_constants;
+
 /* Comments:
 
 start_addr and data_count will assure that 0xffffs at beginning and end of the block will not be programmed (saves time)
@@ -56,5 +64,11 @@ for duplicate pages the page_erase_map is not freshly allocated, pointer to the
 
 int read_setup(char *path, flash_constants flash_param[]);
 int flash_prepare(flash_constants flash_param[], int flash_count);
+int flash_copy(flash_constants copy[], flash_constants flash_param[], int flash_count);
+void flash_release(flash_constants flash_param[], int flash_count);
+double flash_program_time(flash_constants flash_param, unsigned int words);	/* microseconds */
+double flash_erase_time(flash_constants flash_param, unsigned int mass);		/* microseconds */
+unsigned long int flash_checksum(unsigned int *data, unsigned int count);
+unsigned int flash_next_run(flash_constants flash_param, unsigned int addr, unsigned int end, unsigned int gap, unsigned int *start);
 
 #endif
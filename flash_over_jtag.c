@@ -11,12 +11,15 @@
 * Description:       Main application module
 *
 * Modules Included:
-*	void speed_test_32k(void);
+*	int speed_test_32k(void);
 *	void usage(void);
 *	void redirect_pport(char *text);
+*	int program_lanes(void);
+*	int load_image(void);
+*	int gang_program(void);
 *	int handleoptions(int argc,char *argv[]);
 *	int main (int argc,char *argv[]);
-*	void sys_init(void);
+*	int sys_init(void);
 *	void display_memory(mem_read_constants mem_read);
 *
 * Author: Daniel Malik (daniel.malik@motorola.com)
@@ -51,6 +54,31 @@ Changes: Beta version: changed user interface, added page erase option
 		epsilon 0.6: jtag_data_read16 was optimized by commenting out some code, but TMS was not set correctly at the end of the communication in daisy-chain environments
 					 changed daisy-chain info printout to make sure the information appears in the log file (in case one is being created)
 		epsilon 0.7: added -c option (ignore S-rec checksum errors)
+		zeta 0.1: added -mpsse option (JTAG scans driven by the FT232H MPSSE engine)
+		zeta 0.2: bit-bang pin updates are collected and sent in one USB transfer until TDO is sampled
+				  added -nobuf and -stats options
+		zeta 0.3: added -sync option (synchronous bit-bang, TDO samples are collected in one transfer)
+		zeta 0.4: added -pipe option (pipelined programming)
+		zeta 0.5: added -csum option (verification by checksums computed on the target)
+		zeta 0.6: added -diff option (differential programming of the changed pages)
+		zeta 0.7: added -gap option (erased runs inside the data are not programmed)
+		zeta 0.8: added -plan option (mass, page or no erase chosen by the predicted time)
+		zeta 0.9: added -par option (all flash interface units are erased at the same time)
+		zeta 1.0: added -overlap option (the next block is erased while the current one is programmed)
+		zeta 1.1: added -predict option (BUSY polls are skipped for the predicted flash time),
+				  -stats prints a histogram of the BUSY polls
+		zeta 1.2: added -shadow option (redundant register loads are dropped), -stats prints the
+				  OnCE instruction counts
+		zeta 1.3: added -fuse option (shorter instruction forms), -stats prints the DR scans per word
+		zeta 1.4: bit-bang DR writes are copied from precompiled pin vectors, added -novec option
+		zeta 1.5: scan kernels selected by the chain position, added -benchscan option
+		zeta 1.6: bypass bits clocked as bulk runs, added -park option, -stats prints the padding
+		zeta 1.7: several -m options program the DSPs of a chain in lockstep, one S-record file each
+		zeta 1.8: added -gang option, boards on several FT232H adapters are programmed in parallel, one thread each
+		zeta 1.9: all state of a run is kept in a session passed to the JTAG, OnCE and S-record routines
+		zeta 2.0: added -adapters and -adapter options (adapter discovery, selection by serial, bus path or PID)
+		zeta 2.1: added -calib option (TCK divisor calibrated on the target, cached per adapter), -simtck
+		zeta 2.2: added -async option (USB writes pipelined by a drain thread), -stats prints the queue
 */
 
 #include <limits.h>
@@ -59,30 +87,42 @@ Changes: Beta version: changed user interface, added page erase option
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
+#include "adapter.h"
 #include "flash.h"
 #include "jtag.h"
+#include "mpsse.h"
+#include "target_sim.h"
 #include "flash_over_jtag.h"
 #include "srec.h"
+#include "usb_queue.h"
 #include "exit_codes.h"
 
 
-flash_constants flash_param[MAX_FLASH_UNITS];	/* constants for flash units */
-int flash_count=0;								/* number of flash units */
 
 operations operation=VIEW_MEMORY;				/* what the tool is going to do: view flash is default */
 
-mem_read_constants mem_read;					/* parameters for reading memory */
 
 #ifndef PATH_MAX
 #define PATH_MAX 250
 #endif
 
 #define FILENAME_MAX_LEN	PATH_MAX
+jtag_session *session=NULL;					/* options, adapter, chain and image of this run */
 char s_rec_filename[PATH_MAX+1]="";		/* name of the s-record file */
 char cfg_filename[PATH_MAX+1]="";		/* name of the flash config file */
 char timestamp_filename[PATH_MAX+1]="";	/* name of the additional S-record file to be processed */
-char serror=0;									/* 0=report all errors, 1=silent mode (do not report all S-rec errors) */
+char lane_filename[LANES_MAX][PATH_MAX+1];	/* S-record files of the DSPs programmed in lockstep, [0] unused (s_rec_filename) */
+gang_board gang[GANG_MAX];						/* adapters of the gang mode */
+int gang_count=0;
+char show_stats=0;								/* 1=print JTAG/USB traffic counters on exit */
+char simulate=0;								/* 1=talk to the target simulator instead of the FT232H */
 
 
 /* displays contents of memory on screen */
@@ -111,22 +151,125 @@ void display_memory(mem_read_constants mem_read) {
     }
 }
 
-void sys_init(void) {
-    int i;
-    for (i=0;i<MAX_FLASH_UNITS;i++) {
-        flash_param[i].data=NULL;
-        flash_param[i].page_erase_map=NULL;
+/* wall clock time in seconds */
+static double host_time(void) {
+    struct timespec ts;
+    timespec_get(&ts,TIME_UTC);
+    return(ts.tv_sec+ts.tv_nsec/1e9);
+}
+
+static void bench_start(bench_pass *pass, char *name, unsigned long int words) {
+    jtag_flush(session);
+    jtag_reset_stats(session);
+    pass->name=name;
+    pass->words=words;
+    pass->sim_time=simulate?jtag_time(session):0;	/* the simulated clock, once the USB queue is drained */
+    pass->host_time=host_time();
+}
+
+static void bench_stop(bench_pass *pass, int result) {
+    jtag_flush(session);								/* queued traffic belongs to this pass */
+    pass->host_time=host_time()-pass->host_time;
+    pass->sim_time=simulate?jtag_time(session)-pass->sim_time:0;
+    jtag_get_stats(session,&(pass->stats));
+    pass->result=result;
+}
+
+/* times erase, program, verify and read passes over (up to) 32K words of the first flash block */
+/* the flash contents are destroyed, returns SPEED_TEST_OK on success or the exit code of the failed pass */
+int speed_test_32k(void) {
+    bench_pass pass[5];
+    flash_constants block=session->flash_param[0];
+    unsigned int *data,*buffer;
+    unsigned long int words,i,errors=0;
+    int n=0,k;
+    words=block.flash_end-block.flash_start+1;
+    if (words>BENCH_WORDS) words=BENCH_WORDS;
+    block.start_addr=block.flash_start;
+    block.data_count=words;
+    block.duplicate=0;
+    data=block.data;
+    for (i=0;i<words;i++) data[i]=(unsigned int)((i*0x9e37+0x1234)&0xffff);	/* no 0xffff runs */
+    for (i=0;i<(words+255)/256;i++) block.page_erase_map[i]=2;				/* every page requested */
+    buffer=(unsigned int*)calloc(words,sizeof(unsigned int));
+    if (buffer==NULL) {
+        printf("Memory allocation error\n");
+        return(SYSTEM_ERROR);
+    }
+    printf("Benchmark: %c:%#06x-%#06lx (%lu words), the flash contents are destroyed\n",
+           block.program_memory?'p':'x',block.flash_start,block.flash_start+words-1,words);
+    if (once_init_flash_iface(session,block)) {
+        free(buffer);
+        return(DSP_ERROR);
+    }
+
+    bench_start(&pass[n],"mass erase",block.flash_end-block.flash_start+1);
+    bench_stop(&pass[n++],once_flash_mass_erase(session,block));
+    if (!pass[n-1].result) {
+        bench_start(&pass[n],"program",words);
+        k=once_flash_program_data(session,block);	/* word by word, pipelined (-pipe) or with the flash routine (-stub) */
+        once_flash_program_end(session);
+        printf("\n");
+        bench_stop(&pass[n++],k?VERIFY_ERROR:0);
+    }
+    if ((n==2)&&(!pass[n-1].result)) {
+        bench_start(&pass[n],"verify",words);	/* R2 points to the start of the block */
+        k=once_flash_verify(session,block);				/* word by word or by checksums (-csum) */
+        printf("\n");
+        bench_stop(&pass[n++],k?VERIFY_ERROR:0);
+    }
+    if ((n==3)&&(!pass[n-1].result)) {
+        bench_start(&pass[n],"read",words);
+        once_flash_read(session,block.program_memory,block.flash_start,block.flash_start+words-1,buffer,session->flash_param,session->flash_count);
+        for (i=0;i<words;i++) if (buffer[i]!=data[i]) errors++;
+        if (errors) printf("%lu word(s) read back incorrectly\n",errors);
+        bench_stop(&pass[n++],errors?VERIFY_ERROR:0);
+    }
+    if ((n==4)&&(!pass[n-1].result)) {
+        bench_start(&pass[n],"page erase",(words+255)/256*256);
+        bench_stop(&pass[n++],once_flash_page_erase(session,block));
+    }
+
+    free(buffer);
+    printf("\n%-10s %8s %9s %10s %11s %9s %10s%s\n","pass","words","time [s]","words/s","TCK cycles","USB xfers","bytes/word",simulate?"   host [s]":"");
+    for (k=0;k<n;k++) {
+        double t=simulate?pass[k].sim_time/1e6:pass[k].host_time;
+        printf("%-10s %8lu %9.3f %10.0f %11lu %9lu %10.2f",pass[k].name,pass[k].words,t,
+               (t>0)?pass[k].words/t:0.0,pass[k].stats.tck_cycles,pass[k].stats.usb_writes+pass[k].stats.usb_reads,
+               (double)(pass[k].stats.bytes_out+pass[k].stats.bytes_in)/pass[k].words);
+        if (simulate) printf(" %10.3f",pass[k].host_time);
+        printf("%s\n",pass[k].result?"  FAILED":"");
+        if (pass[k].result) return(pass[k].result);
     }
-    mem_read.data=NULL;
+    if (simulate) printf("Times are simulated, the last column is the time taken by the host\n");
+    return(SPEED_TEST_OK);
+}
+
+/* creates the session, its flash blocks and memory buffer start empty */
+int sys_init(void) {
+    session=jtag_session_new();
+    if (session==NULL) return(-1);
+    return(0);
 }
 
 void cleanup(void) {
-    int i;
-    for (i=0;i<flash_count;i++) {
-        if (flash_param[i].data!=NULL) free(flash_param[i].data);
-        if ((!flash_param[i].duplicate)&&(flash_param[i].page_erase_map!=NULL)) free(flash_param[i].page_erase_map);
+    int k;
+    if (session==NULL) return;
+    flash_release(session->flash_param,session->flash_count);
+    for (k=1;k<LANES_MAX;k++)			/* images of the other DSPs (lockstep) */
+        flash_release(session->lane_param[k],session->flash_count);
+    jtag_disconnect(session);
+    if (show_stats) {
+        jtag_print_stats(session);
+        once_shadow_report(session);
+        once_scan_report(session);
+        once_poll_report(session);
     }
-    jtag_disconnect();
+    if (simulate) printf("Simulated time: %.3f ms\n",sim_time(session)/1000.0);
+    if (session->mem_read.data!=NULL) free(session->mem_read.data);
+    sim_free(session);
+    jtag_session_free(session);
+    session=NULL;
 }
 
 void usage(void) {
@@ -135,16 +278,213 @@ void usage(void) {
     printf("Options:\n\n");
     printf("-w\tWait for the DSP to leave the Reset state or power-up\n");
     printf("-s\tSilent mode - S-rec file errors are not reported\n");
+    printf("-stub\tEXPERIMENTAL, program with a flash routine loaded to program RAM, the target polls\n\tBUSY itself (the data is still staged with OnCE instructions, six scans per word),\n\tthe encodings of the routine were only checked against the simulator\n");
+    printf("-pipe\tStage the next word while the flash is busy, the end of programming is predicted\n\tfrom the flash timing instead of polled (with -stub: one USB round trip per row)\n");
+    printf("-predict\tSkip the BUSY polls which cannot succeed yet, the flash time is predicted\n\t\tfrom the timing values of the config file, one poll confirms the end\n");
+    printf("-stats\tPrint JTAG and USB traffic counters and the BUSY polls on exit\n");
+    printf("-shadow\tKeep a copy of R0-R3, Y0, Y1 and OMR on the host and drop the loads of values\n\tthe registers already hold\n");
+    printf("-sync\tUse the FT232H synchronous bit-bang mode\n");
+    printf("-nobuf\tSend every bit-bang pin update in its own USB transfer\n");
+    printf("-novec\tBuild the bit-bang DR writes bit by bit instead of copying precompiled pin vectors\n");
+    printf("-sim[<chain>]\tUse the target simulator instead of the FT232H. The chain is listed\n\t\tfrom TDI to TDO, d=DSP, digit=other device with that IR length, default d\n");
+    printf("-simlat<us>\tSimulated USB transfer latency, default %.0fus\n",SIM_USB_LATENCY_US);
+    printf("-simtck<MHz>\tSimulated TDO errors above this TCK frequency\n");
     printf("-d\tLeave the target in debug mode on exit\n");
     printf("-c\tIgnore checksum errors in the S-rec files\n");
+    printf("-calib\tFind the fastest TCK at which IDCODE and a loopback through the DR path read back\n\tbit-exact, the result is cached per adapter (-mpsse only)\n");
+    printf("-csum\tVerify by checksums of each flash page computed on the target, only the pages\n\twhich do not match and the first page of each block are read back\n");
+    printf("-fuse\tUse shorter instruction forms: program memory reads through OPDBR\n\t(checked on the simulator only)\n");
+    printf("-fusepp\tEXPERIMENTAL, move to and from OPGDBR by the one word short I/O forms\n\t\tMOVE Y0,X:<<pp and MOVE X:<<pp,Y0 (checked on the simulator only)\n");
+    printf("-fuseimm\tEXPERIMENTAL, write the FIU timing registers by MOVE #<data>,X:(R2+xx),\n\t\ta form reported not to work on silicon\n");
+    printf("-gap[<n>]\tDo not program runs of at least n erased (0xFFFF) words inside the data,\n\t\tdefault n %d\n",SPARSE_GAP_DEFAULT);
+    printf("-diff\tOnly erase and program the pages whose checksum on the target differs from the\n\tS-records (page erase, the other pages are kept)\n");
     printf("-page\tSpecifies that page erases should be used instead of mass erase\n");
+    printf("-overlap\tErase the next flash block (other interface unit) while the current one is\n\t\tprogrammed\n");
+    printf("-par\tErase all flash interface units at the same time before programming the blocks\n");
+    printf("-plan\tChoose mass erase, page erase or no erase for every flash interface unit by the\n\tpredicted time (pages not referenced by the S-records may keep their contents)\n");
     printf("-info\tAccess information blocks of Flash units instead of main blocks\n");
+    printf("-async[<n>]\tBuild the next scans while a second thread keeps n USB writes in flight,\n\t\tdefault n %d, at most %d\n",USB_QUEUE_DEPTH,USB_QUEUE_DEPTH_MAX);
+    printf("-adapters\tList the FT232H, FT2232H and FT4232H channels with serial numbers and bus paths\n");
+    printf("-adapter<sel>\tOpen the adapter with this serial number, bus path (e.g. 1-4.2) or PID\n\t\t(e.g. 0x6010), :A..:D selects the channel, default the first FT232H\n");
+    printf("-gang<sel>,<sel>...\tProgram the boards on these adapters in parallel,\n\t\tone thread per board, a summary is printed at the end\n");
     printf("-mI,D\tSupport for JTAG daisy-chain. I and D specify position in the chain\n");
+    printf("\tRepeat -m for up to %d DSPs of the chain, they are erased and programmed in\n\tlockstep, one S-record file per DSP in the order of the -m options\n",LANES_MAX);
+    printf("-park\tDaisy-chain: IR scans copy a cached prefix with the BYPASS bits of the other parts\n");
+    printf("-bench\tBenchmark: time erase, program, verify and read of 32K words of the first\n\tflash block in the config file (the flash contents are destroyed)\n");
+    printf("-benchscan\tHost CPU time per scan of the bit-bang scan kernels (no adapter needed)\n");
+    printf("-mpsse[<div>]\tUse the FT232H MPSSE engine, TCK = 30MHz/(div+1), default div %d\n",MPSSE_DEFAULT_DIVISOR);
     printf("-t<S-rec file>\t\tProcess additional S-record file\n");
     printf("-r<mem><start>:<end>\tDump DSP memory to S-record file\n");
     printf("-v<mem><start>:<end>\tDump DSP memory to screen\n\n");
 }
 
+/* programs the images of all DSPs of the chain in lockstep, lane 0 uses flash_param */
+int program_lanes(void) {
+    flash_constants *lanes[LANES_MAX];
+    int k;
+    lanes[0]=session->flash_param;
+    for (k=1;k<jtag_lanes(session);k++) {
+        memcpy(session->lane_param[k],session->flash_param,sizeof(session->flash_param));	/* the same config file, own data */
+        lanes[k]=session->lane_param[k];
+    }
+    for (k=0;k<jtag_lanes(session);k++) {
+        if (flash_prepare(lanes[k],session->flash_count))
+            return(CFG_ERROR);						/* allocate memory */
+        printf("DSP %d: processing S-record file: %s\n",k,k?lane_filename[k]:s_rec_filename);
+        if (read_s_record(session,k?lane_filename[k]:s_rec_filename, lanes[k], session->flash_count))
+            return(SREC_ERROR);
+        if (timestamp_filename[0]) {
+            printf("Processing timestamp file: %s\n",timestamp_filename);
+            read_s_record(session,timestamp_filename, lanes[k], session->flash_count);
+        }
+    }
+    if (once_flash_program_lanes(session,lanes,session->flash_count)) return(VERIFY_ERROR);
+    return(SUCESS);
+}
+
+/* reads the config file and, except in lockstep mode, the S-records of the image */
+int load_image(void) {
+    if ((session->flash_count=read_setup(cfg_filename,session->flash_param))<0)
+        return(CFG_ERROR);		/* read the flash config file */
+    if (simulate) sim_attach_flash(session,session->flash_param,session->flash_count);
+    if (jtag_lanes(session)>1) return(SUCESS);		/* the images are read by program_lanes */
+    if (flash_prepare(session->flash_param,session->flash_count))
+        return(CFG_ERROR);						/* allocate memory */
+    if (read_s_record(session,s_rec_filename, session->flash_param, session->flash_count))
+        return(SREC_ERROR);	/* read the input file, if error reading the file return -2 */
+    if (timestamp_filename[0]) {
+        printf("Processing timestamp file: %s\n",timestamp_filename);					/* if the filename is not null, process additional S-rec file */
+        read_s_record(session,timestamp_filename, session->flash_param, session->flash_count);
+    }
+    return(SUCESS);
+}
+
+static char *exit_code_name(int code) {
+    switch (code) {
+    case SUCESS:		return("passed");
+    case CFG_ERROR:		return("FAILED (config file)");
+    case SREC_ERROR:	return("FAILED (S-record file)");
+    case JTAG_ERROR:	return("FAILED (adapter not found)");
+    case DSP_ERROR:		return("FAILED (DSP not in debug mode)");
+    case VERIFY_ERROR:	return("FAILED (verification)");
+    case PARAM_ERROR:	return("FAILED (parameters)");
+    }
+    return("FAILED (adapter or system error)");
+}
+
+#ifdef _WIN32
+static HANDLE gang_thread[GANG_MAX];
+#else
+static pthread_t gang_thread[GANG_MAX];
+#endif
+static double gang_start;
+
+/* session of one board of the gang, runs on its own thread with the port already open */
+static int gang_board_run(gang_board *board) {
+    jtag_session *s=board->session;
+    int result=SUCESS;
+    if (jtag_init(s)) {
+        printf("Adapter %s: Command Converter not connected or disabled!\n",board->serial);
+        result=JTAG_ERROR;
+    } else if (init_target(s)) {
+        result=DSP_ERROR;
+    } else {
+        once_erase_plan(s,s->flash_param,s->flash_count);
+        if ((once_flash_erase_all(s,s->flash_param,s->flash_count))||(once_flash_program_all(s,s->flash_param,s->flash_count)))
+            result=VERIFY_ERROR;
+        else once_erase_report(s);
+    }
+    jtag_disconnect(s);
+    board->time=host_time()-gang_start;
+    return(result);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI gang_thread_main(LPVOID board) {
+    ((gang_board*)board)->result=gang_board_run((gang_board*)board);
+    return(0);
+}
+#else
+static void *gang_thread_main(void *board) {
+    ((gang_board*)board)->result=gang_board_run((gang_board*)board);
+    return(NULL);
+}
+#endif
+
+/* gang mode: the image parsed once is programmed by one thread per adapter, every board */
+/* runs a copy of the session (jtag_session_copy) with its own image and simulated target */
+/* the adapters are opened one after the other before the threads start, the output of the */
+/* boards is interleaved and the summary is printed when all of them are done */
+/* returns the exit code of the first board that failed */
+int gang_program(void) {
+    int k,result=SUCESS;
+    jtag_session *s;
+    gang_start=host_time();
+    for (k=0;k<gang_count;k++) {
+        gang[k].result=SYSTEM_ERROR;
+        gang[k].running=0;
+        gang[k].time=0;
+        s=gang[k].session=jtag_session_copy(session);
+        if ((s==NULL)||(sim_copy(s,session))) {
+            printf("Not enough memory for the session of adapter %s\n",gang[k].serial);
+            continue;
+        }
+        printf("Board %d, adapter %s\n",k,gang[k].serial);
+        if (set_adapter(s,gang[k].serial)) {
+            printf("Bad adapter selection %s\n",gang[k].serial);
+            gang[k].result=PARAM_ERROR;
+            continue;
+        }
+        if (open_port(s)!=0) {
+            printf("Unable to open adapter %s\n",gang[k].serial);
+            continue;
+        }
+#ifdef _WIN32
+        gang_thread[k]=CreateThread(NULL,0,gang_thread_main,&gang[k],0,NULL);
+        gang[k].running=(gang_thread[k]!=NULL);
+#else
+        gang[k].running=(pthread_create(&gang_thread[k],NULL,gang_thread_main,&gang[k])==0);
+#endif
+        if (!gang[k].running) {
+            printf("Unable to start the session of adapter %s\n",gang[k].serial);
+            jtag_disconnect(s);
+        }
+    }
+    for (k=0;k<gang_count;k++) if (gang[k].running) {
+#ifdef _WIN32
+        WaitForSingleObject(gang_thread[k],INFINITE);
+        CloseHandle(gang_thread[k]);
+#else
+        pthread_join(gang_thread[k],NULL);
+#endif
+    }
+    printf("\n%-6s %-*s %9s%s  %s\n","board",ADAPTER_SERIAL_MAX/2,"adapter","time [s]",simulate?"  sim [ms]":"","result");
+    for (k=0;k<gang_count;k++) {
+        printf("%-6d %-*s %9.3f",k,ADAPTER_SERIAL_MAX/2,gang[k].serial,gang[k].time);
+        if (simulate) printf(" %9.3f",(gang[k].session!=NULL)?sim_time(gang[k].session)/1000.0:0);
+        printf("  %s\n",exit_code_name(gang[k].result));
+        if ((gang[k].result!=SUCESS)&&(result==SUCESS)) result=gang[k].result;
+    }
+    printf("Total time %.3f s\n",host_time()-gang_start);
+    for (k=0;k<gang_count;k++) {
+        if ((s=gang[k].session)==NULL) continue;
+        if ((show_stats)&&(gang[k].running)) {
+            printf("\nBoard %d, adapter %s\n",k,gang[k].serial);
+            jtag_print_stats(s);
+            once_shadow_report(s);
+            once_scan_report(s);
+            once_poll_report(s);
+        }
+        flash_release(s->flash_param,s->flash_count);
+        sim_free(s);
+        jtag_session_free(s);
+        gang[k].session=NULL;
+    }
+    show_stats=0;								/* the counters of the boards are printed above */
+    simulate=0;
+    return(result);
+}
+
 /* returns number of parameters or negative number in case of error */
 int handleoptions(int argc,char *argv[]) {
     int i,notoption=0;
@@ -156,39 +496,111 @@ int handleoptions(int argc,char *argv[]) {
                 break;
             case 'c':	/* -i - ignore S-rec checksum errors */
             case 'C':
-                srec_check_checksums(0);
+                if (!strcmp(argv[i]+1,"csum")) {
+                    set_verify_mode(session,1);	/* verify by checksums computed on the target */
+                    break;
+                }
+                if (!strcmp(argv[i]+1,"calib")) {
+                    set_tck_calibrate(session,1);	/* fastest TCK with clean reads, cached per adapter */
+                    break;
+                }
+                srec_check_checksums(session,0);
                 break;
             case 't':	/* -t<S-record file> */
             case 'T':
                 strcpy(timestamp_filename,argv[i]+2);
                 break;
+            case 'f':
+            case 'F':
+                if (!strcmp(argv[i]+1,"fuse")) {
+                    set_fused_forms(session,1);	/* shorter instruction forms */
+                    break;
+                }
+                if (!strcmp(argv[i]+1,"fuseimm")) {
+                    set_fused_immediate(session,1);	/* FIU timing by immediate to memory moves, experimental */
+                    printf("Warning: -fuseimm is experimental, the form was reported not to work on silicon\n");
+                    break;
+                }
+                if (!strcmp(argv[i]+1,"fusepp")) {
+                    set_fused_short_io(session,1);	/* OPGDBR by short I/O moves, experimental */
+                    printf("Warning: -fusepp is experimental, the short I/O moves were only checked against the simulator\n");
+                    break;
+                }
+                printf("Unknown option %s\n",argv[i]);
+                break;
+            case 'g':
+            case 'G':
+                if (!strncmp(argv[i]+1,"gang",4)) {	/* -gang<serial>,<serial>... */
+                    char *serial=strtok(argv[i]+5,",");
+                    for (;serial!=NULL;serial=strtok(NULL,",")) {
+                        if (gang_count==GANG_MAX) {
+                            printf("Too many adapters, at most %d, %s ignored\n",GANG_MAX,serial);
+                            continue;
+                        }
+                        strncpy(gang[gang_count].serial,serial,ADAPTER_SERIAL_MAX);
+                        gang[gang_count].serial[ADAPTER_SERIAL_MAX]=0;
+                        gang_count++;
+                    }
+                    break;
+                }
+                if (!strncmp(argv[i]+1,"gap",3)) {	/* -gap[<words>] */
+                    set_sparse_gap(session,argv[i][4]?atoi(argv[i]+4):SPARSE_GAP_DEFAULT);
+                    break;
+                }
+                printf("Unknown option %s\n",argv[i]);
+                break;
             case 'h':	/* -help */
             case 'H':
                 if (!strcmp(argv[i]+1,"help")) {
                     usage();
                     break;
                 }
+            case 'p':
             case 'P':
+                if (!strcmp(argv[i]+1,"pipe")) {
+                    set_pipeline(session,1);	/* stage the next word/row while the FIU is BUSY */
+                    break;
+                }
                 if (!strcmp(argv[i]+1,"page")) {
-                    set_erase_mode(1);
+                    set_erase_mode(session,1);
                     printf("Using Page Erase mode.\n");
                     break;
                 }
+                if (!strcmp(argv[i]+1,"par")) {
+                    set_erase_concurrent(session,1);	/* erase all FIUs at the same time */
+                    break;
+                }
+                if (!strcmp(argv[i]+1,"predict")) {
+                    set_busy_predict(session,1);	/* idle for the predicted BUSY time, then poll */
+                    break;
+                }
+                if (!strcmp(argv[i]+1,"plan")) {
+                    set_erase_planner(session,1);	/* mass, page or no erase by the predicted time */
+                    break;
+                }
+                if (!strcmp(argv[i]+1,"park")) {
+                    set_park_mode(session,1);	/* IR scans from a cached prefix, the other parts stay in BYPASS */
+                    break;
+                }
             case 'i':
             case 'I':
                 if (!strcmp(argv[i]+1,"info")) {
-                    set_info_block(1);
+                    set_info_block(session,1);
                     printf("Flash Information Block access.\n");
                 }
                 break;
             case 'm':
             case 'M':	{	/* -mI,D */
                 int instr,data;
+                if (!strncmp(argv[i]+1,"mpsse",5)) {	/* -mpsse[<divisor>] */
+                    set_transport(session,TRANSPORT_MPSSE);
+                    if (argv[i][6]) set_tck_divisor(session,atoi(argv[i]+6));
+                    break;
+                }
                 sscanf(argv[i]+2,"%d,%d",&instr,&data);
                 /* the printout is done after all parameters are processed to make sure it appears in the log */
                 //printf("Target at position %d of instruction chain and %d of data chain.\n",instr,data);
-                set_data_pp(data);
-                set_instr_pp(instr);
+                if (jtag_add_target(session,instr,data)<0) printf("Too many targets, at most %d DSPs, %s ignored\n",LANES_MAX,argv[i]);
                 break;
             }
             case 'v':
@@ -198,26 +610,26 @@ int handleoptions(int argc,char *argv[]) {
             case 'R':	{	/* read memory */
                 char mem_type;
                 if ((argv[i][1]=='r')||(argv[i][1]=='R')) operation=READ_MEMORY;
-                sscanf(argv[i]+2,"%c0x%x:0x%x",&mem_type,&(mem_read.start),&(mem_read.end));
+                sscanf(argv[i]+2,"%c0x%x:0x%x",&mem_type,&(session->mem_read.start),&(session->mem_read.end));
                 switch (mem_type) {
                 case 'x':
                 case 'X':
-                    mem_read.program_memory=0;	/* data memory */
+                    session->mem_read.program_memory=0;	/* data memory */
                     break;
                 case 'p':
                 case 'P':
-                    mem_read.program_memory=1;	/* program memory */
+                    session->mem_read.program_memory=1;	/* program memory */
                     break;
                 default:
                     printf("Incorrect memory type\n");
                     return(-1);
                 }
-                if (mem_read.end<mem_read.start) {
+                if (session->mem_read.end<session->mem_read.start) {
                     printf("Address range incorrect\n");
                     return(-1);
                 }
-                mem_read.data=(unsigned int*)calloc(mem_read.end-mem_read.start+1,sizeof(unsigned int));
-                if (mem_read.data==NULL) {
+                session->mem_read.data=(unsigned int*)calloc(session->mem_read.end-session->mem_read.start+1,sizeof(unsigned int));
+                if (session->mem_read.data==NULL) {
                     printf("Memory allocation error\n");
                     return(-1);
                 }
@@ -225,15 +637,102 @@ int handleoptions(int argc,char *argv[]) {
             }
             case 's':
             case 'S':
-                serror=1;	/* do not report S-rec errors */
+                if (!strcmp(argv[i]+1,"stub")) {
+                    set_stub_mode(session,1);	/* program with the flash routine in program RAM */
+                    printf("Warning: -stub is experimental, the flash routine was only checked against the simulator\n");
+                    break;
+                }
+                if (!strcmp(argv[i]+1,"stats")) {
+                    show_stats=1;	/* print traffic counters */
+                    break;
+                }
+                if (!strcmp(argv[i]+1,"shadow")) {
+                    set_register_shadow(session,1);	/* drop loads of values the registers hold */
+                    break;
+                }
+                if (!strcmp(argv[i]+1,"sync")) {
+                    set_transport(session,TRANSPORT_SYNCBB);	/* synchronous bit-bang */
+                    break;
+                }
+                if (!strncmp(argv[i]+1,"simtck",6)) {	/* -simtck<MHz> */
+                    sim_set_tck_limit(session,atof(argv[i]+7));
+                    break;
+                }
+                if (!strncmp(argv[i]+1,"simlat",6)) {	/* -simlat<us> */
+                    sim_set_latency(session,atof(argv[i]+7));
+                    break;
+                }
+                if (!strncmp(argv[i]+1,"sim",3)) {		/* -sim[<chain>] */
+                    if (sim_configure(session,argv[i]+4)) {
+                        printf("Incorrect simulated chain %s\n",argv[i]+4);
+                        return(-1);
+                    }
+                    set_jtag_port(session,&sim_port);
+                    set_jtag_clock(session,sim_time);	/* measured times are simulated as well */
+                    simulate=1;
+                    break;
+                }
+                session->serror=1;	/* do not report S-rec errors */
+                break;
+            case 'o':
+            case 'O':
+                if (!strcmp(argv[i]+1,"overlap")) {
+                    set_erase_overlap(session,1);	/* erase the next block while the current one is programmed */
+                    break;
+                }
+                printf("Unknown option %s\n",argv[i]);
+                break;
+            case 'n':
+            case 'N':
+                if (!strcmp(argv[i]+1,"nobuf")) {
+                    set_output_buffer(session,0);	/* one USB transfer per pin update */
+                    break;
+                }
+                if (!strcmp(argv[i]+1,"novec")) {
+                    set_pin_vectors(session,0);	/* bit by bit DR writes */
+                    break;
+                }
+                printf("Unknown option %s\n",argv[i]);
+                break;
+            case 'b':
+            case 'B':
+                if (!strcmp(argv[i]+1,"bench")) {
+                    operation=BENCHMARK;	/* throughput benchmark */
+                    break;
+                }
+                if (!strcmp(argv[i]+1,"benchscan")) {
+                    operation=SCAN_BENCHMARK;	/* host CPU time of the scan kernels */
+                    break;
+                }
+                printf("Unknown option %s\n",argv[i]);
+                break;
+            case 'a':
+            case 'A':
+                if (!strcmp(argv[i]+1,"adapters")) {
+                    operation=LIST_ADAPTERS;	/* list the FTDI channels on the bus */
+                    break;
+                }
+                if (!strncmp(argv[i]+1,"async",5)) {	/* -async[<depth>] */
+                    set_usb_queue(session,argv[i][6]?atoi(argv[i]+6):USB_QUEUE_DEPTH);
+                    break;
+                }
+                if (!strncmp(argv[i]+1,"adapter",7)) {	/* -adapter<serial>|<bus path>|0x<PID>[:A..D] */
+                    if (set_adapter(session,argv[i]+8)) printf("Bad adapter selection %s, ignored\n",argv[i]+8);
+                    break;
+                }
+                printf("Unknown option %s\n",argv[i]);
                 break;
             case 'w':
             case 'W':		/* wait for the DSP to come out of reset */
-                set_DSP_wait(1);
+                set_DSP_wait(session,1);
                 break;
             case 'd':
             case 'D':
-                set_exit_mode(1);	/* leave the part in debug mode on exit */
+                if (!strcmp(argv[i]+1,"diff")) {
+                    set_diff_mode(session,1);	/* only erase and program the pages which changed */
+                    break;
+                }
+                set_exit_mode(session,1);	/* leave the part in debug mode on exit */
                 break;
             default:
                 printf("Unknown option %s\n",argv[i]);
@@ -246,7 +745,10 @@ int handleoptions(int argc,char *argv[]) {
             if (notoption==1) { /* second parameter which is not an option is the S-record file */
                 strncpy(s_rec_filename,argv[i],FILENAME_MAX_LEN);
             }
-            if (notoption>=2) {
+            if ((notoption>=2)&&(notoption<=LANES_MAX)) { /* further S-record files are the images of the next DSPs (lockstep) */
+                strncpy(lane_filename[notoption-1],argv[i],FILENAME_MAX_LEN);
+            }
+            if (notoption>LANES_MAX) {
                 printf("Too many parameters!\n");
             }
             notoption++;
@@ -270,50 +772,90 @@ int main (int argc,char *argv[]) {
         printf("Error setting \"at exit\" function\n");
         return(SYSTEM_ERROR);
     }
-    sys_init();								/* init system variables */
-    if (open_port() != 0)
-        return SYSTEM_ERROR;
+    if (sys_init()) {						/* init system variables */
+        printf("Not enough memory for the session\n");
+        return(SYSTEM_ERROR);
+    }
 
     parcount=handleoptions(argc,argv);
-    if ((parcount < 1) || (parcount > 2)) {	/* number of parameters is incorrect */
+    if (operation==LIST_ADAPTERS) {		/* no target and no files needed */
+        return((adapter_list()<0)?SYSTEM_ERROR:SUCESS);
+    }
+    if (operation==SCAN_BENCHMARK) {		/* no target and no files needed */
+        jtag_scan_bench(session);
+        return(0);
+    }
+    if ((parcount < 1) || (parcount > 1+jtag_lanes(session))) {	/* number of parameters is incorrect */
         printf("Number of parameters incorrect or other error\n");
         usage();
         return(PARAM_ERROR);
     }
-    if (jtag_init()) {
+    if ((operation==VIEW_MEMORY)&&(session->mem_read.data==NULL)) {	/* no -r/-v option: program the S-record file */
+        if (parcount<2) {
+            printf("S-record file or memory range missing\n");
+            usage();
+            return(PARAM_ERROR);
+        }
+        operation=PROGRAM_FLASH;
+    }
+    if ((jtag_lanes(session)>1)&&((operation!=PROGRAM_FLASH)||(parcount!=1+jtag_lanes(session)))) {
+        printf("Several DSPs (-m options) can only be programmed, one S-record file per DSP\n");
+        usage();
+        return(PARAM_ERROR);
+    }
+    if (gang_count) {						/* one session per adapter, the image is parsed once */
+        if ((operation!=PROGRAM_FLASH)||(jtag_lanes(session)>1)) {
+            printf("-gang programs one S-record file into one DSP per board\n");
+            return(PARAM_ERROR);
+        }
+        if ((i=load_image())!=SUCESS) return(i);
+        return(gang_program());
+    }
+    if (open_port(session) != 0)					/* opened after the options are known (transport selection) */
+        return SYSTEM_ERROR;
+    if (jtag_init(session)) {
         printf("Command Converter not connected or disabled!");
         return(JTAG_ERROR);
     }
-    if (get_data_pp()||get_instr_pp()) {	/* if in daisy-chained environment, print target position */
-        printf("Target at position %d of instruction chain and %d of data chain.\n",get_instr_pp(),get_data_pp());
+    if (jtag_lanes(session)>1) {		/* several DSPs programmed in lockstep */
+        for (i=0;i<jtag_lanes(session);i++)
+            printf("Target %d at position %d of instruction chain and %d of data chain.\n",i,get_lane_instr_pp(session,i),get_lane_data_pp(session,i));
+    } else if (get_data_pp(session)||get_instr_pp(session)) {	/* if in daisy-chained environment, print target position */
+        printf("Target at position %d of instruction chain and %d of data chain.\n",get_instr_pp(session),get_data_pp(session));
     }
-    if (init_target()) return(DSP_ERROR);
+    if (init_target(session)) return(DSP_ERROR);
     switch (operation) {
     case PROGRAM_FLASH:
-        if ((flash_count=read_setup(cfg_filename,flash_param))<0)
-            return(CFG_ERROR);		/* read the flash config file */
-        if (flash_prepare(flash_param,flash_count))
-            return(CFG_ERROR);						/* allocate memory */
-        if (read_s_record(s_rec_filename, flash_param, flash_count, &serror))
-            return(SREC_ERROR);	/* read the input file, if error reading the file return -2 */
-        if (timestamp_filename[0]) {
-            printf("Processing timestamp file: %s\n",timestamp_filename);					/* if the filename is not null, process additional S-rec file */
-            read_s_record(timestamp_filename, flash_param, flash_count, &serror);
-        }
-        for (i=0;i<flash_count;i++) if (once_flash_program(flash_param[i])) return(VERIFY_ERROR);
+        if ((i=load_image())!=SUCESS) return(i);
+        if (jtag_lanes(session)>1) return(program_lanes());
+        once_erase_plan(session,session->flash_param,session->flash_count);	/* only with -plan, -par or -overlap */
+        if (once_flash_erase_all(session,session->flash_param,session->flash_count)) return(VERIFY_ERROR);	/* only with -par */
+        if (once_flash_program_all(session,session->flash_param,session->flash_count)) return(VERIFY_ERROR);
+        once_erase_report(session);
         return(SUCESS);
     case READ_MEMORY:
-        if ((flash_count=read_setup(cfg_filename,flash_param))<0) return(CFG_ERROR);		/* read the flash config file */
-        once_flash_read(mem_read.program_memory, mem_read.start, mem_read.end, mem_read.data,flash_param,flash_count);
-        if (strlen(s_rec_filename)==0) write_s_record(cfg_filename, mem_read); else
-            write_s_record(s_rec_filename, mem_read);	/* if only one file specified, use ir as S-record filename */
+        if ((session->flash_count=read_setup(cfg_filename,session->flash_param))<0) return(CFG_ERROR);		/* read the flash config file */
+        if (simulate) sim_attach_flash(session,session->flash_param,session->flash_count);
+        once_flash_read(session,session->mem_read.program_memory, session->mem_read.start, session->mem_read.end, session->mem_read.data,session->flash_param,session->flash_count);
+        if (strlen(s_rec_filename)==0) write_s_record(cfg_filename, session->mem_read); else
+            write_s_record(s_rec_filename, session->mem_read);	/* if only one file specified, use ir as S-record filename */
         printf("Output written.\n");
         break;
     case VIEW_MEMORY:
-        if ((flash_count=read_setup(cfg_filename,flash_param))<0) return(CFG_ERROR);		/* read the flash config file */
-        once_flash_read(mem_read.program_memory, mem_read.start, mem_read.end, mem_read.data,flash_param,flash_count);
-        display_memory(mem_read);
+        if ((session->flash_count=read_setup(cfg_filename,session->flash_param))<0) return(CFG_ERROR);		/* read the flash config file */
+        if (simulate) sim_attach_flash(session,session->flash_param,session->flash_count);
+        once_flash_read(session,session->mem_read.program_memory, session->mem_read.start, session->mem_read.end, session->mem_read.data,session->flash_param,session->flash_count);
+        display_memory(session->mem_read);
         break;
+    case BENCHMARK:
+        if ((session->flash_count=read_setup(cfg_filename,session->flash_param))<1) return(CFG_ERROR);		/* read the flash config file */
+        if (simulate) sim_attach_flash(session,session->flash_param,session->flash_count);
+        if (flash_prepare(session->flash_param,session->flash_count))
+            return(CFG_ERROR);						/* allocate memory */
+        return(speed_test_32k());
+    case SCAN_BENCHMARK:
+    case LIST_ADAPTERS:
+        break;								/* done before the port is opened */
     }
     return(SUCESS);
 }
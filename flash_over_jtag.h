@@ -19,25 +19,47 @@
 #ifndef FLASH_OVER_JTAG____H
 #define FLASH_OVER_JTAG____H
 
+#include "jtag.h"
+
 typedef enum {
     PROGRAM_FLASH,
     READ_MEMORY,
     VIEW_MEMORY,
+    BENCHMARK,
+    SCAN_BENCHMARK,
+    LIST_ADAPTERS,
 } operations;
 
+#define BENCH_WORDS		0x8000		/* words per benchmark pass, limited to the size of the flash block */
+
+typedef struct {
+	char			*name;		/* pass name */
+	unsigned long int words;	/* words processed */
+	double			host_time;	/* wall clock time of the pass [s] */
+	double			sim_time;	/* simulated time of the pass [us], 0 when running on hardware */
+	jtag_statistics	stats;		/* JTAG & USB traffic of the pass */
+	int				result;		/* 0=pass succeeded */
+} bench_pass;
+
+#define GANG_MAX		16			/* boards (FT232H adapters) programmed at the same time */
+
 typedef struct {
-	unsigned int	start;		/* beginning of the block */
-	unsigned int	end;		/* end of the block */
-	unsigned char	program_memory;	/* 1-pflash, 0-dflash */
-	unsigned int	*data;		/* pointer to array where data are to be stored */
-} mem_read_constants;
+	char			serial[ADAPTER_SERIAL_MAX+1];	/* serial number of the FT232H */
+	jtag_session	*session;	/* copy of the session for the adapter */
+	int				running;	/* 1: a thread runs the session */
+	int				result;		/* exit code of the session */
+	double			time;		/* wall clock time until the session ended [s] */
+} gang_board;
 
-void sys_init(void);
+int sys_init(void);
 void cleanup(void);
 void usage(void);
 int handleoptions(int argc,char *argv[]);
 int main (int argc,char *argv[]);
 void display_memory(mem_read_constants mem_read);
+int speed_test_32k(void);
+int load_image(void);
+int gang_program(void);
 
 
 #endif
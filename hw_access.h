@@ -19,6 +19,8 @@
 #ifndef HW_ACCESS___H
 #define HW_ACCESS___H
 
+#include "jtag.h"
+
 #define JTAG_RESET_MASK		0x0001
 #define JTAG_TMS_MASK		0x0002
 #define JTAG_TCK_MASK		0x0004
@@ -26,32 +28,48 @@
 #define JTAG_TRST_MASK		0x0010
 #define JTAG_TDO_MASK		0x0020
 
+void set_jtag_port(jtag_session *s, jtag_port *new_port);
+
+/* low level access to the FTDI device (jtag.c) */
+void jtag_outp(jtag_session *s, unsigned char data);
+unsigned char jtag_inp(jtag_session *s);
+int jtag_usb_write(jtag_session *s, unsigned char *buf, int size);
+int jtag_usb_read(jtag_session *s, unsigned char *buf, int size);
+int jtag_tdo_future(jtag_session *s);
+int jtag_tdo_resolve(jtag_session *s, int future);
+
 /**************************************************************************/
 
-#define JTAG_TCK_SET		pport_data|=JTAG_TCK_MASK;jtag_outp(pport_data)
-#define JTAG_TCK_RESET		pport_data&=~JTAG_TCK_MASK;jtag_outp(pport_data)
+/* the pin macros work on the session in the variable s of the caller */
 
-#define JTAG_TMS_SET		pport_data|=JTAG_TMS_MASK
-#define JTAG_TMS_RESET		pport_data&=~JTAG_TMS_MASK
+#define JTAG_TCK_SET		s->pport_data|=JTAG_TCK_MASK;jtag_outp(s,s->pport_data)
+#define JTAG_TCK_RESET		s->pport_data&=~JTAG_TCK_MASK;jtag_outp(s,s->pport_data)
 
-#define JTAG_TDI_SET		{pport_data|=JTAG_TDI_MASK;}
-#define JTAG_TDI_RESET		{pport_data&=~JTAG_TDI_MASK;}
+#define JTAG_TMS_SET		s->pport_data|=JTAG_TMS_MASK
+#define JTAG_TMS_RESET		s->pport_data&=~JTAG_TMS_MASK
+
+#define JTAG_TDI_SET		{s->pport_data|=JTAG_TDI_MASK;}
+#define JTAG_TDI_RESET		{s->pport_data&=~JTAG_TDI_MASK;}
 
 #define JTAG_TDI_ASSIGN(i)	if (i&0x0001) JTAG_TDI_SET else JTAG_TDI_RESET
 
-#define JTAG_TRST_SET		pport_data|=JTAG_TRST_MASK;jtag_outp(pport_data)
-#define JTAG_TRST_RESET		pport_data&=~JTAG_TRST_MASK;jtag_outp(pport_data)
+#define JTAG_TRST_SET		s->pport_data|=JTAG_TRST_MASK;jtag_outp(s,s->pport_data)
+#define JTAG_TRST_RESET		s->pport_data&=~JTAG_TRST_MASK;jtag_outp(s,s->pport_data)
+
+#define JTAG_RESET_SET		s->pport_data&=~JTAG_RESET_MASK;jtag_outp(s,s->pport_data)
+#define JTAG_RESET_RESET	s->pport_data|=JTAG_RESET_MASK;jtag_outp(s,s->pport_data)
 
-#define JTAG_RESET_SET		pport_data&=~JTAG_RESET_MASK;jtag_outp(pport_data)
-#define JTAG_RESET_RESET	pport_data|=JTAG_RESET_MASK;jtag_outp(pport_data)
+#define JTAG_TDO_VALUE				((jtag_inp(s) & JTAG_TDO_MASK) ? 1 : 0)
 
-#define JTAG_TDO_VALUE				((jtag_inp() & JTAG_TDO_MASK) ? 1 : 0)
+/* deferred TDO sampling, the value is only guaranteed after JTAG_TDO_RESOLVE */
+#define JTAG_TDO_FUTURE				jtag_tdo_future(s)
+#define JTAG_TDO_RESOLVE(future)	jtag_tdo_resolve(s,future)
 
 // extern "C" unsigned int initdelay(void);
 // extern "C" void delay50ns(void);
 
 #define INIT_WAIT_FUNCTION
-#define WAIT_100_NS			jtag_outp(pport_data)
+#define WAIT_100_NS			jtag_outp(s,s->pport_data)
 
 #endif
 
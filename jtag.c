@@ -12,37 +12,103 @@
 * Description:       Jtag and OnCE access
 *
 * Modules Included:
-*	int jtag_init(void);
-*	int jtag_instruction_exec(int instruction);
-*	int jtag_instruction_exec_in_reset(int instruction);
-*	unsigned long int jtag_data_shift(unsigned long int data, int bit_count);
-*	int init_target (void);
-*	int once_init_flash_iface(flash_constants flash_param);
-*	void once_flash_program_prepare (unsigned int fiu_address, unsigned int addr);
-*	void once_flash_program_pg_no (unsigned int addr);
-*	void once_flash_program_end (void);
-*	void once_flash_program_1word(flash_constants flash_param, unsigned int data);
-*	int once_flash_verify_1word(flash_constants flash_param, unsigned int data);
-*	int once_flash_mass_erase(flash_constants flash_param);
-*	int once_flash_page_erase(flash_constants flash_param);
-*	int once_flash_program(flash_constants flash_param);
-*	void jtag_disconnect(void);
-*	void jtag_data_write8(unsigned int data);
-*	void jtag_data_write16(unsigned int data);
-*	unsigned int jtag_data_read16(void);
-*	void jtag_measure_paths(void);
-*	int get_data_pl(void);
-*	int get_instr_pl(void);
-*	int get_data_pp(void);
-*	int get_instr_pp(void);
-*	void set_data_pp(int length);
-*	void set_instr_pp(int length);
-*	void once_flash_read_prepare (unsigned int addr, flash_constants flash_param[], int flash_count);
-*	unsigned int once_flash_read_1word(unsigned char program_memory);
-*	void once_flash_read(unsigned char program_memory, unsigned int start_addr, unsigned int end_addr, unsigned int *buffer, flash_constants flash_param[], int flash_count);
-*	void set_erase_mode(unsigned char mode)
+*	int jtag_init(jtag_session *s);
+*	int jtag_instruction_exec(jtag_session *s, int instruction);
+*	int jtag_instruction_exec_in_reset(jtag_session *s, int instruction);
+*	unsigned long int jtag_data_shift(jtag_session *s, unsigned long int data, int bit_count);
+*	int init_target (jtag_session *s);
+*	int once_init_flash_iface(jtag_session *s, flash_constants flash_param);
+*	void once_flash_program_prepare (jtag_session *s, unsigned int fiu_address, unsigned int addr);
+*	void once_flash_program_pg_no (jtag_session *s, unsigned int addr);
+*	void once_flash_program_end (jtag_session *s);
+*	void once_flash_program_1word(jtag_session *s, flash_constants flash_param, unsigned int data);
+*	int once_flash_verify_1word(jtag_session *s, flash_constants flash_param, unsigned int data);
+*	int once_flash_mass_erase(jtag_session *s, flash_constants flash_param);
+*	int once_flash_page_erase(jtag_session *s, flash_constants flash_param);
+*	int once_flash_program_data(jtag_session *s, flash_constants flash_param);
+*	int once_flash_program(jtag_session *s, flash_constants flash_param);
+*	int once_flash_verify(jtag_session *s, flash_constants flash_param);
+*	int once_flash_program_diff(jtag_session *s, flash_constants flash_param);
+*	void set_diff_mode(jtag_session *s, unsigned char mode);
+*	void set_sparse_gap(jtag_session *s, unsigned int words);
+*	int once_flash_checksum(jtag_session *s, unsigned int addr, unsigned int count, unsigned long int *sum);
+*	void jtag_disconnect(jtag_session *s);
+*	void jtag_data_write8(jtag_session *s, unsigned int data);
+*	void jtag_data_write16(jtag_session *s, unsigned int data);
+*	unsigned int jtag_data_read16(jtag_session *s);
+*	void once_execute1(jtag_session *s, unsigned int opcode);
+*	void once_execute2(jtag_session *s, unsigned int opcode1, unsigned int opcode2);
+*	void once_execute1_run(jtag_session *s, unsigned int opcode);
+*	void once_shadow_invalidate(jtag_session *s);
+*	void set_register_shadow(jtag_session *s, unsigned char mode);
+*	void once_shadow_report(jtag_session *s);
+*	void set_fused_forms(jtag_session *s, unsigned char mode);
+*	void set_fused_immediate(jtag_session *s, unsigned char mode);
+*	void set_fused_short_io(jtag_session *s, unsigned char mode);
+*	void once_scan_report(jtag_session *s);
+*	void jtag_measure_paths(jtag_session *s);
+*	void jtag_select_kernels(jtag_session *s);
+*	void jtag_scan_bench(jtag_session *s);
+*	int get_data_pl(jtag_session *s);
+*	int get_instr_pl(jtag_session *s);
+*	int get_data_pp(jtag_session *s);
+*	int get_instr_pp(jtag_session *s);
+*	void set_data_pp(jtag_session *s, int length);
+*	void set_instr_pp(jtag_session *s, int length);
+*	int jtag_add_target(jtag_session *s, int instr_position, int data_position);
+*	int jtag_lanes(jtag_session *s);
+*	int get_lane_instr_pp(jtag_session *s, int lane);
+*	int get_lane_data_pp(jtag_session *s, int lane);
+*	unsigned int jtag_lane_value(jtag_session *s, int lane);
+*	void jtag_data_write16_lanes(jtag_session *s, unsigned int *data);
+*	void once_flash_read_prepare (jtag_session *s, unsigned int addr, flash_constants flash_param[], int flash_count);
+*	unsigned int once_flash_read_1word(jtag_session *s, unsigned char program_memory);
+*	void once_flash_read(jtag_session *s, unsigned char program_memory, unsigned int start_addr, unsigned int end_addr, unsigned int *buffer, flash_constants flash_param[], int flash_count);
+*	void set_erase_mode(jtag_session *s, unsigned char mode)
 *	void set_port(unsigned int port);
-*	void set_info_block(unsigned int value);
+*	void set_info_block(jtag_session *s, unsigned int value);
+*	void set_transport(jtag_session *s, unsigned char mode);
+*	void set_tck_divisor(jtag_session *s, unsigned int divisor);
+*	void set_tck_calibrate(jtag_session *s, unsigned char mode);
+*	int jtag_calibrate_tck(jtag_session *s);
+*	void set_adapter_serial(jtag_session *s, char *serial);
+*	void set_output_buffer(jtag_session *s, unsigned char mode);
+*	void set_pin_vectors(jtag_session *s, unsigned char mode);
+*	void set_park_mode(jtag_session *s, unsigned char mode);
+*	void set_jtag_port(jtag_session *s, jtag_port *new_port);
+*	jtag_session *jtag_session_new(void);
+*	void jtag_session_free(jtag_session *s);
+*	jtag_session *jtag_session_copy(jtag_session *s);
+*	void set_stub_mode(jtag_session *s, unsigned char mode);
+*	void once_stub_load(jtag_session *s, unsigned int program_memory);
+*	int once_flash_program_stub(jtag_session *s, flash_constants flash_param);
+*	void set_verify_mode(jtag_session *s, unsigned char mode);
+*	void once_checksum_load(jtag_session *s, unsigned int program_memory);
+*	int once_flash_verify_checksum(jtag_session *s, flash_constants flash_param, int readback);
+*	void set_pipeline(jtag_session *s, unsigned char mode);
+*	void set_busy_predict(jtag_session *s, unsigned char mode);
+*	void once_poll_report(jtag_session *s);
+*	void set_erase_planner(jtag_session *s, unsigned char mode);
+*	void once_erase_plan(jtag_session *s, flash_constants flash_param[], int flash_count);
+*	void once_erase_report(jtag_session *s);
+*	void set_erase_concurrent(jtag_session *s, unsigned char mode);
+*	int once_flash_erase_all(jtag_session *s, flash_constants flash_param[], int flash_count);
+*	void set_erase_overlap(jtag_session *s, unsigned char mode);
+*	int once_flash_program_all(jtag_session *s, flash_constants flash_param[], int flash_count);
+*	void once_move_lanes_to_y1(jtag_session *s, unsigned int *data);
+*	int once_flash_program_lanes(jtag_session *s, flash_constants *lane_param[], int flash_count);
+*	double once_predicted_time(jtag_session *s, unsigned int words, unsigned int reads);
+*	void set_jtag_clock(jtag_session *s, double (*clock)(jtag_session *s));
+*	double jtag_time(jtag_session *s);
+*	int once_flash_program_pipelined(jtag_session *s, flash_constants flash_param);
+*	void jtag_idle(jtag_session *s, double us);
+*	double jtag_queued_time(jtag_session *s);
+*	void jtag_flush(jtag_session *s);
+*	int jtag_tdo_future(jtag_session *s);
+*	int jtag_tdo_resolve(jtag_session *s, int future);
+*	void jtag_get_stats(jtag_session *s, jtag_statistics *stats);
+*	void jtag_reset_stats(jtag_session *s);
+*	void jtag_print_stats(jtag_session *s);
 *
 * Author: Daniel Malik (daniel.malik@motorola.com)
 *
@@ -50,116 +116,557 @@
 
 #include <ftdi.h>
 
+#include "adapter.h"
 #include "hw_access.h"
 #include "flash.h"
 #include "jtag.h"
+#include "mpsse.h"
+#include "usb_queue.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
 
-unsigned int pport_data=0;						/* mirror of output port to save accesses */
+static unsigned long int jtag_lane_dr(jtag_session *s, int bits, unsigned long int data, int read);
+/* the first scan before jtag_measure_paths selects the kernels for the configured positions */
+static void jtag_write_select(jtag_session *s, unsigned int data, int bits);
+static unsigned int jtag_read16_select(jtag_session *s);
+static int jtag_ir_select(jtag_session *s, int instruction);
 
-unsigned char page_erase=0;						/* 1: page erase, 0: mass erase */
+/* wall clock time in microseconds */
+static double jtag_wall_clock(jtag_session *s) {
+    struct timespec ts;
+    (void)s;								/* the same clock for every session */
+    timespec_get(&ts,TIME_UTC);
+    return(ts.tv_sec*1e6+ts.tv_nsec/1e3);
+}
 
-unsigned char info_block=0;						/* 1: info block, 0: normal flash access */
+/* set info block (1) or normal access (0) mode */
+void set_info_block(jtag_session *s, unsigned int value) {
+    s->info_block=value;
+}
 
-unsigned char wait_for_DSP=0;					/* 1: wait for DSP to come out of reset (external reset circuit or power down/up for 801 bootloader erasure) */
+/* select bit-bang (TRANSPORT_BITBANG) or MPSSE (TRANSPORT_MPSSE) access */
+void set_transport(jtag_session *s, unsigned char mode) {
+    s->transport=mode;
+}
 
-unsigned char exit_mode=0;	/* ==0 - reset the target, !=0 - leave in debug mode */
+/* MPSSE TCK divisor, TCK = 30MHz/(divisor+1) */
+void set_tck_divisor(jtag_session *s, unsigned int divisor) {
+    s->tck_divisor=divisor;
+}
 
-int data_pl;		/* lengths of JTAG paths */
-int instr_pl;
-int data_pp=0;		/* position of the part in the JTAG chain, 0=beginning */
-int instr_pp=0;
+/* calibrate the TCK after the target entered debug mode (1) or keep the divisor (0) */
+void set_tck_calibrate(jtag_session *s, unsigned char mode) {
+    if (mode) s->tck_calibrate=1; else s->tck_calibrate=0;
+}
 
-struct ftdi_context *ftdic = NULL;
-bool ftdi_open = false;
+/* selects the FT232H by its serial number, must be called before open_port() */
+void set_adapter_serial(jtag_session *s, char *serial) {
+    strncpy(s->adapter_serial,serial,ADAPTER_SERIAL_MAX);
+    s->adapter_serial[ADAPTER_SERIAL_MAX]=0;
+}
 
-/* set info block (1) or normal access (0) mode */
-void set_info_block(unsigned int value) {
-    info_block=value;
+/* collect bit-bang pin updates in the output buffer (1) or send each one immediately (0) */
+void set_output_buffer(jtag_session *s, unsigned char mode) {
+    s->out_buffering=mode;
 }
 
-/* port number */
-int open_port() {
-    ftdic = ftdi_new();
-    if (!ftdic)
+/* set precompiled pin vectors (1) or the bit by bit code (0) for the bit-bang DR writes */
+void set_pin_vectors(jtag_session *s, unsigned char mode) {
+    if (mode) s->pin_vectors=1; else s->pin_vectors=0;
+}
+
+/* set cached IR prefixes for the parts parked in BYPASS (1) or IR scans built bit by bit (0) */
+void set_park_mode(jtag_session *s, unsigned char mode) {
+    if (mode) s->park_mode=1; else s->park_mode=0;
+    mpsse_set_park(s,s->park_mode);
+}
+
+/* opens the FT232H in the given bit mode */
+static int ftdi_port_open(jtag_session *s, unsigned char bitmode) {
+    s->ftdic = ftdi_new();
+    if (!s->ftdic)
         return -1;
 
-    ftdi_init(ftdic);
+    ftdi_init(s->ftdic);
 
-    if (ftdi_usb_open(ftdic, 0x0403, 0x6014) != 0) { // FT232H adapt the PID if needed
+    if ((s->adapter_serial[0]) || (s->adapter_path[0]) || (s->adapter_pid) || (s->adapter_channel >= 0)) {
+        if (adapter_open(s, bitmode) != 0)		/* selected by -adapter or -gang (adapter.c) */
+            return -1;
+    } else if (ftdi_usb_open(s->ftdic, 0x0403, 0x6014) != 0) { // FT232H adapt the PID if needed
         printf("Unable to open FT232H\n");
         return -1;
     }
-    ftdi_open = true;
 
-    if (ftdi_set_bitmode(ftdic,
+    if (bitmode==BITMODE_MPSSE) {
+        ftdi_usb_reset(s->ftdic);
+        ftdi_set_latency_timer(s->ftdic, 1);		/* results are returned as soon as they are available */
+        ftdi_set_bitmode(s->ftdic, 0, BITMODE_RESET);
+    }
+    if (ftdi_set_bitmode(s->ftdic,
+                         (bitmode==BITMODE_MPSSE) ? 0 :
                          JTAG_RESET_MASK |
                              JTAG_TMS_MASK |
                              JTAG_TCK_MASK |
                              JTAG_TDI_MASK |
                              JTAG_TRST_MASK,
-                         BITMODE_BITBANG) != 0) {
-        ftdi_usb_close(ftdic);
+                         bitmode) != 0) {
+        printf("Unable to set FT232H bit mode %#x\n", bitmode);
+        ftdi_usb_close(s->ftdic);
+        return -1;
+    }
+    if (bitmode!=BITMODE_BITBANG)
+        ftdi_usb_purge_buffers(s->ftdic);
+    return 0;
+}
+
+static void ftdi_port_close(jtag_session *s) {
+    ftdi_usb_close(s->ftdic);
+}
+
+static int ftdi_port_write(jtag_session *s, unsigned char *buf, int size) {
+    return ftdi_write_data(s->ftdic, buf, size);
+}
+
+static int ftdi_port_read(jtag_session *s, unsigned char *buf, int size) {
+    return ftdi_read_data(s->ftdic, buf, size);
+}
+
+static int ftdi_port_read_pins(jtag_session *s, unsigned char *pins) {
+    return ftdi_read_pins(s->ftdic, pins);
+}
+
+#ifdef LIBFTDI1
+/* asynchronous writes of libftdi1, libftdi 0.x only has blocking writes */
+static void *ftdi_port_submit(jtag_session *s, unsigned char *buf, int size) {
+    return ftdi_write_data_submit(s->ftdic, buf, size);
+}
+
+static int ftdi_port_complete(jtag_session *s, void *transfer) {
+    (void)s;
+    return ftdi_transfer_data_done((struct ftdi_transfer_control *)transfer);
+}
+
+jtag_port ftdi_port={ftdi_port_open, ftdi_port_close, ftdi_port_write, ftdi_port_read, ftdi_port_read_pins, ftdi_port_submit, ftdi_port_complete};
+#else
+jtag_port ftdi_port={ftdi_port_open, ftdi_port_close, ftdi_port_write, ftdi_port_read, ftdi_port_read_pins, NULL, NULL};
+#endif
+
+/* replaces the FT232H by another device (e.g. the target simulator), must be called before open_port() */
+void set_jtag_port(jtag_session *s, jtag_port *new_port) {
+    s->port=new_port;
+}
+
+/* allocates a session with the default options, the FT232H as the port and the wall clock */
+jtag_session *jtag_session_new(void) {
+    jtag_session *s;
+    s=(jtag_session*)calloc(1,sizeof(jtag_session));
+    if (s==NULL) return(NULL);
+    s->port=&ftdi_port;
+    s->jtag_clock=jtag_wall_clock;
+    s->transport=TRANSPORT_BITBANG;
+    s->tck_divisor=MPSSE_DEFAULT_DIVISOR;
+    s->out_buffering=1;
+    s->pin_vectors=1;
+    s->scan_write=jtag_write_select;
+    s->scan_read16=jtag_read16_select;
+    s->scan_ir=jtag_ir_select;
+    s->scan_kernel_name="none";
+    s->vector_pp=-1;
+    s->pad_base=-1;
+    s->ir_prefix_base=-1;
+    s->ir_prefix_pad=-1;
+    s->mpsse_prefix_pad=-1;
+    s->adapter_channel=-1;
+    s->checksums=1;
+    return(s);
+}
+
+/* releases the session, the port must be closed by jtag_disconnect first */
+void jtag_session_free(jtag_session *s) {
+    free(s);
+}
+
+/* allocates a session with the options, the chain and the image of s, used by the gang mode */
+/* to run one session per adapter, s must not have opened its port yet, the copy gets its own */
+/* image but no simulated target (sim_copy), NULL if out of memory */
+jtag_session *jtag_session_copy(jtag_session *s) {
+    jtag_session *c;
+    c=(jtag_session*)malloc(sizeof(jtag_session));
+    if (c==NULL) return(NULL);
+    memcpy(c,s,sizeof(jtag_session));
+    c->ftdic=NULL;
+    c->ftdi_open=false;
+    c->sim=NULL;
+    c->usb_queue=NULL;
+    c->mem_read.data=NULL;
+    if (flash_copy(c->flash_param,s->flash_param,s->flash_count)) {
+        flash_release(c->flash_param,c->flash_count);
+        free(c);
+        return(NULL);
+    }
+    return(c);
+}
+
+/* port number */
+int open_port(jtag_session *s) {
+    unsigned char bitmode=BITMODE_BITBANG;
+    if (s->transport==TRANSPORT_SYNCBB) bitmode=BITMODE_SYNCBB;
+    if (s->transport==TRANSPORT_MPSSE) bitmode=BITMODE_MPSSE;
+    if (s->port->open(s,bitmode) != 0)
+        return -1;
+    s->ftdi_open = true;
+    if ((s->usb_queue_depth) && (usb_queue_start(s) != 0)) {
+        printf("Unable to start the USB drain thread, writes are blocking\n");
+        s->usb_queue_depth = 0;
+    }
+    if ((s->usb_queue_depth) && (s->port->submit == NULL))	/* libftdi 0.x: no transfers in flight */
+        printf("Note: the port has no asynchronous writes, the drain thread sends one blocking write at a time\n");
+    if ((s->transport==TRANSPORT_MPSSE) && (mpsse_init(s,s->tck_divisor) != 0)) {
+        usb_queue_stop(s);
+        s->port->close(s);
+        s->ftdi_open = false;
         return -1;
     }
     return 0;
 }
 
-void jtag_outp(uint8_t data)
+int jtag_usb_write(jtag_session *s, unsigned char *buf, int size)
+{
+    int rc;
+    s->jtag_stats.usb_writes++;
+    s->jtag_stats.bytes_out+=size;
+    if (s->usb_queue)
+        rc = usb_queue_write(s,buf, size);		/* sent by the drain thread while the next scans are built */
+    else
+        rc = s->port->write(s,buf, size);
+    if (rc < 0)
+        printf("ftdi_write_data failed with: %d\n", rc);
+    return rc;
+}
+
+int jtag_usb_read(jtag_session *s, unsigned char *buf, int size)
+{
+    int rc;
+    usb_queue_sync(s);							/* the answer of the queued writes is read */
+    rc = s->port->read(s,buf, size);
+    s->jtag_stats.usb_reads++;
+    if (rc < 0)
+        printf("ftdi_read_data failed with: %d\n", rc);
+    else
+        s->jtag_stats.bytes_in+=rc;
+    return rc;
+}
+
+/* sends all queued pin updates / MPSSE commands */
+void jtag_flush(jtag_session *s)
+{
+    if (s->transport==TRANSPORT_MPSSE) {
+        mpsse_flush(s);
+        return;
+    }
+    if (!s->out_count) return;
+    if (s->transport==TRANSPORT_SYNCBB) {
+        int i,j,chunk,got,rc,retry;
+        /* every byte written returns one pin sample, the chip stops when its receive FIFO is full */
+        for (i=0;i<s->out_count;i+=chunk) {
+            chunk=(s->out_count-i>JTAG_SYNC_CHUNK)?JTAG_SYNC_CHUNK:(s->out_count-i);
+            jtag_usb_write(s,s->out_buffer+i, chunk);
+            got=0;
+            retry=100;
+            while ((got<chunk)&&(retry--)) {
+                rc=jtag_usb_read(s,s->in_buffer+got, chunk-got);
+                if (rc<0) break;
+                got+=rc;
+            }
+            for (j=0;j<JTAG_FUTURES_MAX;j++) {
+                if ((s->tdo_futures[j].position>=i)&&(s->tdo_futures[j].position<i+got)) {
+                    s->tdo_futures[j].value=(s->in_buffer[s->tdo_futures[j].position-i]&JTAG_TDO_MASK)?1:0;
+                    s->tdo_futures[j].position=-1;
+                }
+            }
+        }
+        s->out_count=0;
+        return;
+    }
+    jtag_usb_write(s,s->out_buffer, s->out_count);
+    s->out_count=0;
+}
+
+/* queues an idle period of at least us microseconds without any TCK edge in bit-bang modes */
+/* (the pin state is repeated) or with TCK running in Run-Test/Idle in MPSSE mode */
+/* the TAP is in Select-DR-Scan before and after and the OnCE stays enabled */
+void jtag_idle(jtag_session *s, double us) {
+    unsigned long int i,n;
+    if (us<=0) return;
+    if (s->transport==TRANSPORT_MPSSE) {
+        mpsse_idle(s,(unsigned long int)(us*30.0/(s->tck_divisor+1))+1,0x6,s->instr_pl,s->instr_pp);	/* keeps the OnCE enabled */
+        return;
+    }
+    n=(unsigned long int)(us*JTAG_BITBANG_RATE/1e6)+1;
+    for (i=0;i<n;i++) jtag_outp(s,s->pport_data);
+}
+
+/* returns the duration of the JTAG activity queued so far in microseconds */
+/* USB latency is not included, so the real time spent is never shorter */
+double jtag_queued_time(jtag_session *s) {
+    if (s->transport==TRANSPORT_MPSSE) return(s->jtag_stats.tck_cycles*(s->tck_divisor+1)/30.0);
+    return(s->jtag_stats.pin_writes*1e6/JTAG_BITBANG_RATE);
+}
+
+/* registers a TDO sample at the current position of the pin sequence */
+/* in synchronous bit-bang mode the sample is taken by an extra byte and resolved by the next flush, */
+/* in the other modes the pins are read immediately */
+int jtag_tdo_future(jtag_session *s) {
+    int future=s->tdo_future_next;
+    s->tdo_future_next=(s->tdo_future_next+1)%JTAG_FUTURES_MAX;
+    if (s->transport==TRANSPORT_SYNCBB) {
+        if (s->out_count==JTAG_OUT_BUFFER_SIZE) jtag_flush(s);
+        s->tdo_futures[future].position=s->out_count;
+        jtag_outp(s,s->pport_data);					/* repeats the current pin state to sample TDO */
+    } else {
+        s->tdo_futures[future].position=-1;
+        s->tdo_futures[future].value=JTAG_TDO_VALUE;
+    }
+    return(future);
+}
+
+/* returns the TDO level of a sample registered by jtag_tdo_future */
+int jtag_tdo_resolve(jtag_session *s, int future) {
+    if (s->tdo_futures[future].position>=0) jtag_flush(s);
+    return(s->tdo_futures[future].value);
+}
+
+void jtag_outp(jtag_session *s, unsigned char data)
 {
-    ftdi_write_data(ftdic, &data, 1);
+    s->jtag_stats.pin_writes++;
+    if ((data&JTAG_TCK_MASK)&&(!(s->out_last&JTAG_TCK_MASK))) s->jtag_stats.tck_cycles++;
+    s->out_last=data;
+    if (s->transport==TRANSPORT_MPSSE) {
+        mpsse_set_pins(s,data);
+        return;
+    }
+    if ((!s->out_buffering)&&(s->transport!=TRANSPORT_SYNCBB)) {
+        jtag_usb_write(s,&data, 1);
+        return;
+    }
+    s->out_buffer[s->out_count++]=data;
+    if (s->out_count==JTAG_OUT_BUFFER_SIZE) jtag_flush(s);
     return;
 }
 
-uint8_t jtag_inp()
+unsigned char jtag_inp(jtag_session *s)
 {
-    uint8_t ret = 0;
-    int rc = ftdi_read_pins(ftdic, &ret);
+    unsigned char ret = 0;
+    int rc;
+    if (s->transport==TRANSPORT_MPSSE)
+        return mpsse_get_tdo(s) ? JTAG_TDO_MASK : 0;
+    jtag_flush(s);								/* the pins must reflect all updates before TDO is sampled */
+    s->jtag_stats.usb_reads++;
+    s->jtag_stats.bytes_in++;
+    usb_queue_sync(s);
+    rc = s->port->read_pins(s,&ret);
     if (rc != 0)
         printf("ftdi_read_pins failed with: %d\n", rc);
     return ret;
 }
 
+/* replaces the wall clock (e.g. by the simulated time), the clock returns microseconds */
+void set_jtag_clock(jtag_session *s, double (*clock)(jtag_session *s)) {
+    s->jtag_clock=clock;
+}
+
+/* sends the queued traffic and returns the time in microseconds */
+double jtag_time(jtag_session *s) {
+    jtag_flush(s);
+    usb_queue_sync(s);
+    return(s->jtag_clock(s));
+}
+
+/* predicts the time of OnCE instruction words (8-bit command and 16-bit data scan each) and of */
+/* OnCE register reads (command and read scan) in microseconds, from the scan lengths, the transport */
+/* and JTAG_USB_LATENCY per USB transfer */
+double once_predicted_time(jtag_session *s, unsigned int words, unsigned int reads) {
+    double tck,pins,transfers;
+    tck=words*(32.0+2*s->data_pp)+reads*(31.0+s->data_pl);	/* Capture..Select-DR-Scan included */
+    if (s->transport==TRANSPORT_MPSSE) return(tck*(s->tck_divisor+1)/30.0+reads*2*JTAG_USB_LATENCY);
+    pins=2*tck+4.0*(words+reads);					/* two pin updates per TCK, two waits per scan */
+    if (s->transport==TRANSPORT_SYNCBB) {
+        pins+=16.0*reads;							/* TDO samples */
+        transfers=2.0*reads+2*pins/JTAG_SYNC_CHUNK;
+    } else if (s->out_buffering) {
+        transfers=32.0*reads+pins/JTAG_OUT_BUFFER_SIZE;	/* one write and one pin read per TDO bit */
+    } else transfers=pins+16.0*reads;
+    return(pins*1e6/JTAG_BITBANG_RATE+transfers*JTAG_USB_LATENCY);
+}
+
+void jtag_get_stats(jtag_session *s, jtag_statistics *stats) {
+    usb_queue_sync(s);							/* collects the counters of the drain thread */
+    *stats=s->jtag_stats;
+}
+
+void jtag_reset_stats(jtag_session *s) {
+    jtag_statistics zero={0};
+    usb_queue_sync(s);
+    s->jtag_stats=zero;
+}
+
+void jtag_print_stats(jtag_session *s) {
+    printf("JTAG traffic: %lu TCK cycles, %lu pin updates, %lu OnCE DR scans\n",s->jtag_stats.tck_cycles,s->jtag_stats.pin_writes,s->jtag_stats.dr_scans);
+    printf("USB traffic: %lu writes (%lu bytes), %lu reads (%lu bytes)\n",
+           s->jtag_stats.usb_writes,s->jtag_stats.bytes_out,s->jtag_stats.usb_reads,s->jtag_stats.bytes_in);
+    if (s->jtag_stats.usb_writes) printf("Average write size: %.1f bytes\n",(double)s->jtag_stats.bytes_out/s->jtag_stats.usb_writes);
+    if (s->jtag_stats.pad_cycles) printf("Bypass padding: %lu TCK cycles (%.1f%% of TCK), %.2f per OnCE DR scan\n",s->jtag_stats.pad_cycles,
+                                       100.0*s->jtag_stats.pad_cycles/s->jtag_stats.tck_cycles,(double)s->jtag_stats.pad_cycles/(s->jtag_stats.dr_scans?s->jtag_stats.dr_scans:1));
+    if (s->usb_queue_depth) printf("USB queue: depth %u, %lu writes queued at most, %lu stalls on a full queue, %lu waits for the queue to drain, %lu times empty\n",
+                                   s->usb_queue_depth,s->jtag_stats.queue_max,s->jtag_stats.queue_stalls,s->jtag_stats.queue_waits,s->jtag_stats.queue_idle);
+    printf("Scan kernels: %s\n",s->scan_kernel_name);
+}
+
+/* the MPSSE engine clocks TCK from low, bring TCK there before a queued scan */
+static void mpsse_handover(jtag_session *s) {
+    if (s->pport_data&JTAG_TCK_MASK) {
+        JTAG_TCK_RESET;
+    }
+    s->pport_data|=JTAG_TMS_MASK|JTAG_TDI_MASK;	/* state of TMS & TDI after the scan (Select-DR-Scan) */
+}
+
 
 /* set mass erase (0) or page_erase (1) mode */
-void set_erase_mode(unsigned char mode) {
-    if (mode) page_erase=1; else page_erase=0;
+void set_erase_mode(jtag_session *s, unsigned char mode) {
+    if (mode) s->page_erase=1; else s->page_erase=0;
+}
+
+/* set word by word programming (0) or programming by the flash routine in program RAM (1) */
+void set_stub_mode(jtag_session *s, unsigned char mode) {
+    if (mode) s->stub_mode=1; else s->stub_mode=0;
+}
+
+/* set the shortest run of erased words which is skipped when programming, 0 disables skipping */
+void set_sparse_gap(jtag_session *s, unsigned int words) {
+    s->sparse_gap=words;
+}
+
+/* set differential (1) or full (0) programming */
+void set_diff_mode(jtag_session *s, unsigned char mode) {
+    if (mode) s->diff_mode=1; else s->diff_mode=0;
+}
+
+/* set word by word (0) or checksum (1) verification */
+void set_verify_mode(jtag_session *s, unsigned char mode) {
+    if (mode) s->verify_mode=1; else s->verify_mode=0;
+}
+
+/* set pipelined (1) or polled (0) programming */
+void set_pipeline(jtag_session *s, unsigned char mode) {
+    if (mode) s->pipeline=1; else s->pipeline=0;
+}
+
+/* set dropping of redundant register loads (1) or every load executed (0) */
+void set_register_shadow(jtag_session *s, unsigned char mode) {
+    if (mode) s->register_shadow=1; else s->register_shadow=0;
+}
+
+/* set selection of the fused instruction forms (1) or the original sequences only (0) */
+void set_fused_forms(jtag_session *s, unsigned char mode) {
+    if (mode) s->fused_forms=1; else s->fused_forms=0;
+}
+
+/* set the FIU timing writes by MOVE #<data>,X:(R2+xx) (1) or through Y0 (0), not verified on silicon */
+void set_fused_immediate(jtag_session *s, unsigned char mode) {
+    if (mode) s->fused_immediate=1; else s->fused_immediate=0;
+}
+
+/* set the OPGDBR moves by the short I/O forms (1) or the absolute forms (0), not verified on silicon */
+void set_fused_short_io(jtag_session *s, unsigned char mode) {
+    if (mode) s->fused_short_io=1; else s->fused_short_io=0;
+}
+
+/* set predicted BUSY waits (1) or BUSY polling only (0) */
+void set_busy_predict(jtag_session *s, unsigned char mode) {
+    if (mode) s->busy_predict=1; else s->busy_predict=0;
+}
+
+/* set erase planning (1) or the erase mode of set_erase_mode (0) */
+void set_erase_planner(jtag_session *s, unsigned char mode) {
+    if (mode) s->erase_planner=1; else s->erase_planner=0;
+}
+
+/* set concurrent erase of all FIUs before programming (1) or erase block by block (0) */
+void set_erase_concurrent(jtag_session *s, unsigned char mode) {
+    if (mode) s->erase_concurrent=1; else s->erase_concurrent=0;
+}
+
+/* set erase of the next block while the current one is programmed (1) or erase block by block (0) */
+void set_erase_overlap(jtag_session *s, unsigned char mode) {
+    if (mode) s->erase_overlap=1; else s->erase_overlap=0;
 }
 
 /* routines for handling data path length variables */
-int get_data_pl(void) {
-    return(data_pl);
+int get_data_pl(jtag_session *s) {
+    return(s->data_pl);
+}
+int get_instr_pl(jtag_session *s) {
+    return(s->instr_pl);
+}
+int get_data_pp(jtag_session *s) {
+    return(s->data_pp);
+}
+int get_instr_pp(jtag_session *s) {
+    return(s->instr_pp);
+}
+void set_data_pp(jtag_session *s, int length) {
+    s->data_pp=length;
 }
-int get_instr_pl(void) {
-    return(instr_pl);
+void set_instr_pp(jtag_session *s, int length) {
+    s->instr_pp=length;
 }
-int get_data_pp(void) {
-    return(data_pp);
+
+/* adds a DSP at the given chain positions, the first one is also the single target (data_pp, */
+/* instr_pp), returns the number of DSPs or -1 if there are too many */
+int jtag_add_target(jtag_session *s, int instr_position, int data_position) {
+    if (s->lane_count==LANES_MAX) return(-1);
+    if (s->lane_count==0) {
+        set_instr_pp(s,instr_position);
+        set_data_pp(s,data_position);
+    }
+    s->lane_instr_pp[s->lane_count]=instr_position;
+    s->lane_data_pp[s->lane_count]=data_position;
+    return(++s->lane_count);
+}
+
+/* number of DSPs programmed in lockstep, 1 without several -m options */
+int jtag_lanes(jtag_session *s) {
+    return((s->lane_count>1)?s->lane_count:1);
 }
-int get_instr_pp(void) {
-    return(instr_pp);
+
+int get_lane_instr_pp(jtag_session *s, int lane) {
+    return(s->lane_instr_pp[lane]);
 }
-void set_data_pp(int length) {
-    data_pp=length;
+int get_lane_data_pp(jtag_session *s, int lane) {
+    return(s->lane_data_pp[lane]);
 }
-void set_instr_pp(int length) {
-    instr_pp=length;
+
+/* word of the DSP of the lane in the last DR read (lockstep mode) */
+unsigned int jtag_lane_value(jtag_session *s, int lane) {
+    return((unsigned int)s->lane_read[lane]);
 }
 
-void set_DSP_wait(char wait) {
-    wait_for_DSP=wait;
+void set_DSP_wait(jtag_session *s, char wait) {
+    s->wait_for_DSP=wait;
 }
 
-void set_exit_mode(unsigned char mode) {
-    exit_mode=mode;
+void set_exit_mode(jtag_session *s, unsigned char mode) {
+    s->exit_mode=mode;
 }
 
 /* measures data and instruction JTAG path lengths */
 /* expects Select-DR-Scan state of the Jtag state machine state upon entry */
 /* and leaves the Jtag in Select-DR-Scan on exit */
 /* returns 0 in case measurement has overflown, 1 in case measurement is OK */
-int jtag_measure_paths(void) {
+int jtag_measure_paths(jtag_session *s) {
     int i;
     JTAG_TMS_SET;								/* Go to Select-IR-Scan */
     JTAG_TCK_RESET;
@@ -193,7 +700,7 @@ int jtag_measure_paths(void) {
     JTAG_TCK_SET;
     JTAG_TCK_RESET;									/* Go to Select-DR-Scan */
     JTAG_TCK_SET;
-    instr_pl=i;
+    s->instr_pl=i;
 
     JTAG_TMS_RESET;								/* Go to Capture-DR */
     JTAG_TCK_RESET;
@@ -224,13 +731,14 @@ int jtag_measure_paths(void) {
     JTAG_TCK_SET;
     JTAG_TCK_RESET;								/* Go to Select-DR-Scan */
     JTAG_TCK_SET;
-    data_pl=i;
-    if ((data_pl<JTAG_PATH_LEN_MAX)&&(instr_pl<JTAG_PATH_LEN_MAX)) return(1); else return(0);
+    s->data_pl=i;
+    jtag_select_kernels(s);						/* the positions are known now */
+    if ((s->data_pl<JTAG_PATH_LEN_MAX)&&(s->instr_pl<JTAG_PATH_LEN_MAX)) return(1); else return(0);
 }
 
 /* initialises JTAG, but leaves the part int reset */
 /* the DSP is brought out of reset in "init_target" routine */
-int jtag_init(void) {
+int jtag_init(jtag_session *s) {
     long int i;
     INIT_WAIT_FUNCTION;
     WAIT_100_NS;								/* wait for power to stabilise */
@@ -275,7 +783,7 @@ int jtag_init(void) {
 
 /* resets the DSP core by asserting /RESET and executes the JTAG instruction */
 /* useful for bringing the target into debug mode when flash contains errorneous code */
-int jtag_instruction_exec_in_reset(int instruction) {
+int jtag_instruction_exec_in_reset(jtag_session *s, int instruction) {
     int i,status=0;
     JTAG_RESET_RESET;							/* /RESET signal goes low */
     WAIT_100_NS;
@@ -290,11 +798,11 @@ int jtag_instruction_exec_in_reset(int instruction) {
     JTAG_TCK_SET;
     JTAG_TCK_RESET;
     JTAG_TCK_SET;								/* Go to Shift-IR */ /* Now the Jtag is in the Shift-IR state */
-    if (instr_pl-instr_pp-4) {
+    if (s->instr_pl-s->instr_pp-4) {
         JTAG_TDI_ASSIGN(1);
     }
 
-    for(i=0;i<(instr_pl-instr_pp-4);i++) {
+    for(i=0;i<(s->instr_pl-s->instr_pp-4);i++) {
         JTAG_TCK_RESET;
         JTAG_TCK_SET;
     }
@@ -302,15 +810,15 @@ int jtag_instruction_exec_in_reset(int instruction) {
     for (i=0;i<4;i++) {
         JTAG_TDI_ASSIGN(instruction);
         instruction>>=1;
-        if ((instr_pp==0)&&(i==3)) JTAG_TMS_SET;	/* Go to Exit1-IR */
+        if ((s->instr_pp==0)&&(i==3)) JTAG_TMS_SET;	/* Go to Exit1-IR */
         JTAG_TCK_RESET;
         JTAG_TCK_SET;
         status>>=1;
         status|=JTAG_TDO_VALUE<<3;
     }
-    if (instr_pp) JTAG_TDI_ASSIGN(1);
-    for (i=0;i<instr_pp;i++) {
-        if (i==(instr_pp-1)) JTAG_TMS_SET;			/* Go to Exit1-IR */
+    if (s->instr_pp) JTAG_TDI_ASSIGN(1);
+    for (i=0;i<s->instr_pp;i++) {
+        if (i==(s->instr_pp-1)) JTAG_TMS_SET;			/* Go to Exit1-IR */
         JTAG_TCK_RESET;
         JTAG_TCK_SET;
     }
@@ -324,100 +832,72 @@ int jtag_instruction_exec_in_reset(int instruction) {
 }
 
 /* Set all JTAG signals inactive and reset target DSP */
-void jtag_disconnect(void) {
-    if (ftdi_open) {
+void jtag_disconnect(jtag_session *s) {
+    if (s->ftdi_open) {
         JTAG_TCK_RESET;
         JTAG_TMS_RESET;
         JTAG_TDI_RESET;
-        if (exit_mode==0) {
+        if (s->exit_mode==0) {
             JTAG_RESET_RESET;						/* /TRST & /RESET signals go low */
-            once_jmp_run(0);						/* jump to address 0 in case the /RESET line would not be connected */
+            once_jmp_run(s,0);						/* jump to address 0 in case the /RESET line would not be connected */
             JTAG_TRST_RESET;
-            jtag_instruction_exec(0x2);				/* execute IDCODE in case the /TRST line would not be connected */
+            jtag_instruction_exec(s,0x2);				/* execute IDCODE in case the /TRST line would not be connected */
             WAIT_100_NS;
             WAIT_100_NS;
             JTAG_TRST_SET;							/* /TRST & /RESET signals go high */
             JTAG_RESET_SET;
             printf("The target was reset, the application is running\n");
         } else {
-            jtag_instruction_exec(0x2);				/* execute IDCODE */
+            jtag_instruction_exec(s,0x2);				/* execute IDCODE */
             JTAG_TRST_SET;							/* /TRST & /RESET signals go high */
             JTAG_RESET_SET;
             printf("The target was left in debug mode\n");
         }
-        ftdi_usb_close(ftdic);
-    }
-    ftdi_free(ftdic);
-}
-
-/* Executes Jtag command */
-/* expects Select-DR-Scan state of the Jtag state machine state upon entry */
-/* and leaves the Jtag in Select-DR-Scan on exit */
-int jtag_instruction_exec(int instruction) {
-    int i,status=0;
-    JTAG_TMS_SET;								/* Go to Select-IR-Scan */
-    JTAG_TCK_RESET;
-    JTAG_TCK_SET;
-    JTAG_TMS_RESET;								/* Go to Capture-IR */
-    JTAG_TCK_RESET;
-    JTAG_TCK_SET;
-    JTAG_TCK_RESET;
-    JTAG_TCK_SET;								/* Go to Shift-IR */ /* Now the Jtag is in the Shift-IR state */
-    if (instr_pl-instr_pp-4) JTAG_TDI_ASSIGN(1);
-    for(i=0;i<(instr_pl-instr_pp-4);i++) {
-        JTAG_TCK_RESET;
-        JTAG_TCK_SET;
-    }
-    for (i=0;i<4;i++) {
-        JTAG_TDI_ASSIGN(instruction);
-        instruction>>=1;
-        if ((instr_pp==0)&&(i==3)) JTAG_TMS_SET;	/* Go to Exit1-IR */
-        JTAG_TCK_RESET;
-        JTAG_TCK_SET;
-        status>>=1;
-        status|=JTAG_TDO_VALUE<<3;
-    }
-    if (instr_pp) JTAG_TDI_ASSIGN(1);
-    for (i=0;i<instr_pp;i++) {
-        if (i==(instr_pp-1)) JTAG_TMS_SET;			/* Go to Exit1-IR */
-        JTAG_TCK_RESET;
-        JTAG_TCK_SET;
+        jtag_flush(s);
+        usb_queue_stop(s);
+        s->port->close(s);
     }
-    JTAG_TCK_RESET;								/* Go to Update-IR */
-    JTAG_TCK_SET;
-    JTAG_TCK_RESET;								/* Go to Select-DR-Scan */
-    JTAG_TCK_SET;
-    return(status);
+    if (s->ftdic)
+        ftdi_free(s->ftdic);
+    s->ftdic=NULL;
 }
 
 /* shifts up to 32 bits in and out of the jtag DR path */
 /* expects Select-DR-Scan state of the Jtag state machine state upon entry */
 /* and leaves the Jtag in Select-DR-Scan on exit */
-unsigned long int jtag_data_shift(unsigned long int data, int bit_count) {
+unsigned long int jtag_data_shift(jtag_session *s, unsigned long int data, int bit_count) {
     int i;
+    int tdo[32];
     unsigned long int result=0;
+    if (s->lane_count>1) {					/* every DSP returns its own value, lane_read[] */
+        jtag_lane_dr(s,bit_count,data,1);
+        return(s->lane_read[0]);
+    }
+    if (s->transport==TRANSPORT_MPSSE) {
+        mpsse_handover(s);
+        return(mpsse_data_shift(s,data,bit_count,s->data_pl,s->data_pp));
+    }
     JTAG_TMS_RESET;								/* Go to Capture-DR */
     JTAG_TCK_RESET;
     JTAG_TCK_SET;								/* Go to Shift-DR */
     JTAG_TCK_RESET;
     JTAG_TCK_SET;								/* Now the Jtag is in the Shift-DR state */
-    if (data_pl-1-data_pp) JTAG_TDI_ASSIGN(1);
-    for(i=0;i<(data_pl-1-data_pp);i++) {
+    if (s->data_pl-1-s->data_pp) JTAG_TDI_ASSIGN(1);
+    for(i=0;i<(s->data_pl-1-s->data_pp);i++) {
         JTAG_TCK_RESET;
         JTAG_TCK_SET;
     }
     for (i=0;i<bit_count;i++) {
         JTAG_TDI_ASSIGN(data);
         data>>=1;
-        if ((data_pp==0)&&(i==(bit_count-1))) JTAG_TMS_SET;	/* Go to Exit1-DR */
+        if ((s->data_pp==0)&&(i==(bit_count-1))) JTAG_TMS_SET;	/* Go to Exit1-DR */
         JTAG_TCK_RESET;
         JTAG_TCK_SET;
-        result>>=1;
-        result|=((unsigned long int)JTAG_TDO_VALUE)<<(bit_count-1);
+        tdo[i]=JTAG_TDO_FUTURE;
     }
-    if (data_pp) JTAG_TDI_ASSIGN(1);
-    for (i=0;i<data_pp;i++) {
-        if (i==(data_pp-1)) JTAG_TMS_SET;			/* Go to Exit1-DR */
+    if (s->data_pp) JTAG_TDI_ASSIGN(1);
+    for (i=0;i<s->data_pp;i++) {
+        if (i==(s->data_pp-1)) JTAG_TMS_SET;			/* Go to Exit1-DR */
         JTAG_TCK_RESET;
         JTAG_TCK_SET;
     }
@@ -427,19 +907,44 @@ unsigned long int jtag_data_shift(unsigned long int data, int bit_count) {
     WAIT_100_NS;
     WAIT_100_NS;
     JTAG_TCK_SET;
+    for (i=0;i<bit_count;i++) result|=((unsigned long int)JTAG_TDO_RESOLVE(tdo[i]))<<i;
     return(result);
 }
 
+/* requests Debug mode and enables the Once interface, returns 1 if the target refuses */
+static int jtag_debug_entry(jtag_session *s) {
+    int status, i;
+    status=jtag_instruction_exec(s,0x7);			/*Debug Request*/
+    /*if (!wait_for_DSP) {
+        JTAG_RESET_SET;
+        usleep(10);
+    }
+    status=jtag_instruction_exec(0x7);	*/	// Debug Request #2
+    printf("Debug Request status: %#x\n",status);
+    i=RETRY_DEBUG;
+    do {
+        status=jtag_instruction_exec(s,0x6);	/*Enable OnCE*/
+        printf("Enable OnCE status: %#x, polls left: %d\n",status,i);
+        if (!(i--)) {
+            printf("Target chip refused to enter Debug mode!\n");
+            return(1);
+        }
+    } while (status!=0xd);
+    printf("Enable OnCE successful, target chip is in Debug mode\n");
+    return(0);
+}
+
 /* brings target into Debug mode and enables the Once interface */
-int init_target (void) {
+int init_target (jtag_session *s) {
     int status = 0, i = 0;
     unsigned long int result;
-    jtag_measure_paths();				/* measure JTAG chain length */
-    if (wait_for_DSP) {					/* we need to wait until the DSP powers-up or comes out of Reset */
+    once_shadow_invalidate(s);			/* the registers of the target are not known */
+    jtag_measure_paths(s);				/* measure JTAG chain length */
+    if (s->wait_for_DSP) {					/* we need to wait until the DSP powers-up or comes out of Reset */
         printf("Waiting for target board to power-up & DSP to come out of reset...\n");
         JTAG_RESET_SET;					/* /RESET signal goes high */
         while(status!=0x0d) {
-            jtag_measure_paths();		/* measure again (in case the board had no power we need to get correct lengths) */
+            jtag_measure_paths(s);		/* measure again (in case the board had no power we need to get correct lengths) */
             JTAG_TRST_RESET;			/* /TRST signal goes low */
             WAIT_100_NS;
             WAIT_100_NS;
@@ -456,7 +961,7 @@ int init_target (void) {
             JTAG_TMS_SET;				/* Go to Select-DR-Scan */
             JTAG_TCK_RESET;
             JTAG_TCK_SET;
-            status=jtag_instruction_exec(0x7);	/*Debug Request*/
+            status=jtag_instruction_exec(s,0x7);	/*Debug Request*/
             switch (status) {
             case (0x00):
             case (0x0f):	printf("No power?          \n"); break;
@@ -466,67 +971,300 @@ int init_target (void) {
             }
         }
     }
-    printf("JTAG IR path length: %d\n",get_instr_pl());		/* print JTAG path lengths */
-    printf("JTAG DR path length: %d (BYPASS)\n",get_data_pl());
-    status=jtag_instruction_exec(0x2);			/*IDCODE*/
+    printf("JTAG IR path length: %d\n",get_instr_pl(s));		/* print JTAG path lengths */
+    printf("JTAG DR path length: %d (BYPASS)\n",get_data_pl(s));
+    status=jtag_instruction_exec(s,0x2);			/*IDCODE*/
     printf("IDCode status: %#x\n",status);
-    result=jtag_data_shift(0,32);
+    result=jtag_data_shift(s,0,32);
     printf("Jtag ID: %#lx\n",result);
-    status=jtag_instruction_exec(0x7);			/*Debug Request*/
-    /*if (!wait_for_DSP) {
-        JTAG_RESET_SET;
-        usleep(10);
-    }
-    status=jtag_instruction_exec(0x7);	*/	// Debug Request #2
-    printf("Debug Request status: %#x\n",status);
-    i=RETRY_DEBUG;
-    do {
-        status=jtag_instruction_exec(0x6);	/*Enable OnCE*/
-        printf("Enable OnCE status: %#x, polls left: %d\n",status,i);
-        if (!(i--)) {
-            printf("Target chip refused to enter Debug mode!\n");
-            return(1);
+    for (i=1;i<s->lane_count;i++) printf("Jtag ID of DSP %d: %#lx\n",i,s->lane_read[i]);
+    if (jtag_debug_entry(s)) return(1);
+    if (s->tck_calibrate) {						/* only with -calib, MPSSE */
+        jtag_calibrate_tck(s);
+        if (jtag_instruction_exec(s,0x6)!=0xd) {	/* Enable OnCE at the new TCK, the DSP must still be in debug mode */
+            printf("Target chip left Debug mode during the TCK calibration, requesting it again\n");
+            if (jtag_debug_entry(s)) return(1);
         }
-    } while (status!=0xd);
-    printf("Enable OnCE successful, target chip is in Debug mode\n");
+    }
     /* Now switch the memory map to internal flash (just in case EXTBOOT=1) */
-    once_move_data_to_y0(0);		/* MOVE #0x0000,Y0 */
-    once_move_y0_to_omr();			/* MOVE Y0,OMR */
+    once_move_data_to_y0(s,0);		/* MOVE #0x0000,Y0 */
+    once_move_y0_to_omr(s);			/* MOVE Y0,OMR */
     /* make sure the SR contains meaningful value (bits 10..14 must be 0) */
-    once_jmp(0);					/* JMP #0x0000 - clear PC extension (bits 10..14 of SR) */
-    once_move_data_to_y0(0x0300);	/* MOVE #0x0300,Y0 */
-    once_move_y0_to_sr();			/* MOVE Y0,SR */
+    once_jmp(s,0);					/* JMP #0x0000 - clear PC extension (bits 10..14 of SR) */
+    once_move_data_to_y0(s,0x0300);	/* MOVE #0x0300,Y0 */
+    once_move_y0_to_sr(s);			/* MOVE Y0,SR */
     return(0);
 }
 
-/* writes 8 bits to the JTAG DR path */
-/* expects Select-DR-Scan state of the Jtag state machine state upon entry */
-/* and leaves the Jtag in Select-DR-Scan on exit */
-void jtag_data_write8(unsigned int data) {
+/* TCK calibration, the fastest TCK at which repeated IDCODE reads and a loopback of test patterns */
+/* through the DR path are bit-exact, searched between 30MHz and the configured TCK */
+/* the scans only use the path selected by Test-Logic-Reset, no IR is loaded and no OnCE command */
+/* is sent, so a TCK too fast for the board can neither load a wrong instruction nor make the core */
+/* execute anything, the OnCE is enabled by the caller once the TCK is chosen */
+#define CALIB_ROUNDS		16			/* IDCODE reads and loopback patterns per divisor */
+#define CALIB_CONFIRM		4			/* the result is checked CALIB_CONFIRM times more */
+#define CALIB_ECHO_WORDS	(JTAG_PATH_LEN_MAX/32+2)	/* the patterns come out of the longest path */
+#define CALIB_MARKER		0x12345678UL	/* all 32 rotations differ, gives the path length modulo 32 */
+
+static const unsigned long int calib_patterns[CALIB_ROUNDS]={
+    0x00000000UL,0xffffffffUL,0xaaaaaaaaUL,0x55555555UL,0x00000001UL,0x80000000UL,0xfffffffeUL,0x7fffffffUL,
+    0x0000ffffUL,0xffff0000UL,0x0f0f0f0fUL,0xf0f0f0f0UL,0x33333333UL,0xccccccccUL,CALIB_MARKER,0xedcba987UL
+};
+
+/* IDCODE read right after Test-Logic-Reset, which selects it without an IR scan, so a TCK too */
+/* fast for the board cannot load a wrong instruction, only TMS is clocked before the DR scan */
+/* in a chain the devices which leave the reset in IDCODE instead of BYPASS move the bits, the */
+/* value only has to repeat, returns 0 if TDO looks stuck */
+static unsigned long int jtag_calib_idcode(jtag_session *s) {
+    unsigned long int idcode;
+    mpsse_handover(s);
+    mpsse_tms(s,0x5f,7);						/* Test-Logic-Reset from any state, Run-Test/Idle, Select-DR-Scan */
+    idcode=mpsse_data_shift(s,0,32,s->data_pl,s->data_pp);
+    if ((idcode==0)||(idcode==0xffffffffUL)) idcode=0;
+    return(idcode);
+}
+
+/* shifts the pattern repeatedly through the path selected by Test-Logic-Reset (IDCODE or BYPASS */
+/* of every device) until it comes out of TDO, returns the last word read, the pattern rotated by */
+/* the path length, Update-DR does not change an IDCODE or BYPASS register */
+static unsigned long int jtag_calib_echo(jtag_session *s, unsigned long int pattern) {
+    unsigned long int echo=0;
+    int i;
+    mpsse_handover(s);
+    mpsse_tms(s,0x5f,7);						/* Test-Logic-Reset from any state, Run-Test/Idle, Select-DR-Scan */
+    mpsse_tms(s,0x00,2);						/* Capture-DR, Shift-DR */
+    for (i=1;i<CALIB_ECHO_WORDS;i++) mpsse_shift(s,pattern,32,NULL,0);
+    mpsse_shift(s,pattern,32,&echo,1);			/* back to Select-DR-Scan */
+    mpsse_flush(s);
+    return(echo);
+}
+
+static unsigned long int calib_rotate(unsigned long int pattern, int k) {
+    if (!k) return(pattern);
+    return(((pattern>>k)|(pattern<<(32-k)))&0xffffffffUL);
+}
+
+/* path length modulo 32 from the echo of CALIB_MARKER, -1 if the marker does not come back */
+static int jtag_calib_delay(jtag_session *s) {
+    unsigned long int echo=jtag_calib_echo(s,CALIB_MARKER);
+    int k;
+    for (k=0;k<32;k++) if (calib_rotate(CALIB_MARKER,k)==echo) return(k);
+    return(-1);
+}
+
+/* 1 if all reads at the divisor are bit-exact, delay is the rotation of the loopback patterns */
+static int jtag_calib_pass(jtag_session *s, unsigned int divisor, unsigned long int idcode, int delay, int rounds) {
+    int i,pass=1;
+    unsigned long int pattern;
+    mpsse_set_divisor(s,divisor);
+    for (i=0;(i<rounds*CALIB_ROUNDS)&&(pass);i++) if (jtag_calib_idcode(s)!=idcode) pass=0;
+    for (i=0;(i<rounds*CALIB_ROUNDS)&&(pass);i++) {
+        pattern=calib_patterns[i%CALIB_ROUNDS];
+        if (jtag_calib_echo(s,pattern)!=calib_rotate(pattern,delay)) pass=0;
+    }
+    return(pass);
+}
+
+/* sets the fastest clean TCK, the divisor cached for the adapter is only confirmed */
+/* the TAP is left after a Test-Logic-Reset, the caller enables the OnCE again (init_target) */
+/* returns the divisor, -1 if the target cannot be read cleanly at any TCK */
+int jtag_calibrate_tck(jtag_session *s) {
+    unsigned int slow=s->tck_divisor, fast=0, mid;
+    unsigned long int idcode;
+    int cached,delay=-1;
+    if (s->transport!=TRANSPORT_MPSSE) {
+        printf("TCK calibration needs the MPSSE engine (-mpsse), skipped\n");
+        return(-1);
+    }
+    for (;;) {									/* a TCK which reads cleanly to start from */
+        mpsse_set_divisor(s,slow);
+        idcode=jtag_calib_idcode(s);
+        if (idcode) delay=jtag_calib_delay(s);
+        if ((idcode)&&(delay>=0)&&(jtag_calib_pass(s,slow,idcode,delay,1))) break;
+        if (slow==MPSSE_DIVISOR_MAX) {
+            printf("TCK calibration failed, the target cannot be read cleanly at any TCK\n");
+            return(-1);
+        }
+        slow=(slow*2+1<MPSSE_DIVISOR_MAX)?slow*2+1:MPSSE_DIVISOR_MAX;
+    }
+    cached=adapter_tck_read(s);
+    if ((cached>=0)&&((unsigned int)cached<=slow)&&(jtag_calib_pass(s,cached,idcode,delay,CALIB_CONFIRM))) {
+        slow=cached;
+        printf("TCK %.3f MHz (divisor %u), cached for this adapter\n",30.0/(slow+1),slow);
+    } else {
+        while (fast<slow) {						/* slow passes, the divisors below fast fail */
+            mid=(fast+slow)/2;
+            if (jtag_calib_pass(s,mid,idcode,delay,1)) slow=mid; else fast=mid+1;
+        }
+        while ((slow<MPSSE_DIVISOR_MAX)&&(!jtag_calib_pass(s,slow,idcode,delay,CALIB_CONFIRM))) slow++;
+        printf("TCK calibrated to %.3f MHz (divisor %u)\n",30.0/(slow+1),slow);
+        adapter_tck_write(s,slow);
+    }
+    mpsse_set_divisor(s,slow);
+    return((int)slow);
+}
+
+/* precompiled pin vectors of the bit-bang DR writes, the same pin updates as the bit by bit code */
+/* below, built once per chain configuration (data_pp and the RESET/TRST pins), the vectors of */
+/* the values written before (OnCE commands, opcodes) are kept, new values (immediate data) are */
+/* patched into the template of the scan length, sending a scan is a copy into out_buffer */
+#define VECTOR_ENTRY		4			/* Capture-DR and Shift-DR updates, they keep the TDI level of the entry */
+
+/* builds the pin updates of jtag_data_write8/16 from Select-DR-Scan to Select-DR-Scan */
+static void jtag_vector_build(jtag_session *s, jtag_vector *vector, unsigned int data, int bits) {
+    unsigned char pins=s->vector_base;
+    int i,n=0;
+    vector->value=data;
+    vector->bits=bits;
+    vector->pins[n++]=pins;						/* Go to Capture-DR */
+    vector->pins[n++]=pins|=JTAG_TCK_MASK;
+    vector->pins[n++]=pins&=~JTAG_TCK_MASK;		/* Go to Shift-DR */
+    vector->pins[n++]=pins|=JTAG_TCK_MASK;
+    for (i=0;i<bits;i++) {
+        if (data&1) pins|=JTAG_TDI_MASK; else pins&=~JTAG_TDI_MASK;
+        data>>=1;
+        if ((s->data_pp==0)&&(i==bits-1)) pins|=JTAG_TMS_MASK;	/* Go to Exit1-DR */
+        vector->pins[n++]=pins&=~JTAG_TCK_MASK;
+        vector->pins[n++]=pins|=JTAG_TCK_MASK;
+    }
+    if (s->data_pp) pins|=JTAG_TDI_MASK;
+    for (i=0;i<s->data_pp;i++) {
+        if (i==(s->data_pp-1)) pins|=JTAG_TMS_MASK;	/* Go to Exit1-DR */
+        vector->pins[n++]=pins&=~JTAG_TCK_MASK;
+        vector->pins[n++]=pins|=JTAG_TCK_MASK;
+    }
+    vector->pins[n++]=pins&=~JTAG_TCK_MASK;		/* Go to Update-DR */
+    vector->pins[n++]=pins|=JTAG_TCK_MASK;
+    vector->pins[n++]=pins&=~JTAG_TCK_MASK;		/* Go to Select-DR-Scan */
+    vector->pins[n++]=pins;						/* WAIT_100_NS */
+    vector->pins[n++]=pins;
+    vector->pins[n++]=pins|=JTAG_TCK_MASK;
+    vector->length=n;
+}
+
+/* patches the data bits into a copy of the template, if data_pp is 0 the TDI level of the last */
+/* data bit is kept up to the end of the scan */
+static void jtag_vector_patch(jtag_session *s, jtag_vector *vector, unsigned int data, int bits) {
+    jtag_vector *template=&s->vector_template[bits==16];
+    int i,n=VECTOR_ENTRY;
+    memcpy(vector->pins,template->pins,template->length);
+    vector->length=template->length;
+    vector->value=data;
+    vector->bits=bits;
+    for (i=0;i<bits;i++,n+=2) if (data&(1<<i)) {
+        vector->pins[n]|=JTAG_TDI_MASK;
+        vector->pins[n+1]|=JTAG_TDI_MASK;
+    }
+    if ((!s->data_pp)&&(data&(1<<(bits-1)))) for (;n<vector->length;n++) vector->pins[n]|=JTAG_TDI_MASK;
+}
+
+/* writes a DR scan from its pin vector, the buffer is sent whenever it is full, like jtag_outp does */
+static void jtag_vector_write(jtag_session *s, unsigned int data, int bits) {
+    jtag_vector *vector;
+    unsigned char base=s->pport_data&~(JTAG_TMS_MASK|JTAG_TCK_MASK|JTAG_TDI_MASK);
+    int i,n,copied;
+    if ((s->vector_pp!=s->data_pp)||(s->vector_base!=base)) {	/* new chain configuration */
+        s->vector_pp=s->data_pp;
+        s->vector_base=base;
+        jtag_vector_build(s,&s->vector_template[0],0,8);
+        jtag_vector_build(s,&s->vector_template[1],0,16);
+        for (i=0;i<VECTOR_CACHE;i++) s->vector_cache[i].bits=0;
+    }
+    vector=&s->vector_cache[(data^(data>>6)^(data>>12)^bits)%VECTOR_CACHE];
+    if ((vector->bits!=bits)||(vector->value!=data)) jtag_vector_patch(s,vector,data,bits);
+    for (copied=0;copied<vector->length;copied+=n) {
+        n=vector->length-copied;
+        if (n>JTAG_OUT_BUFFER_SIZE-s->out_count) n=JTAG_OUT_BUFFER_SIZE-s->out_count;
+        memcpy(s->out_buffer+s->out_count,vector->pins+copied,n);
+        for (i=copied;i<VECTOR_ENTRY;i++) {		/* TDI is not changed before the first data bit */
+            if (i>=copied+n) break;
+            s->out_buffer[s->out_count+i-copied]=(vector->pins[i]&~JTAG_TDI_MASK)|(s->pport_data&JTAG_TDI_MASK);
+        }
+        s->out_count+=n;
+        if (s->out_count==JTAG_OUT_BUFFER_SIZE) jtag_flush(s);
+    }
+    s->jtag_stats.pin_writes+=vector->length;
+    s->jtag_stats.tck_cycles+=bits+s->data_pp+4;
+    s->jtag_stats.pad_cycles+=s->data_pp;
+    s->pport_data=s->out_last=vector->pins[vector->length-1];
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* scan kernels, the DR writes, 16-bit DR reads and IR scans of the OnCE in variants for the */
+/* transport and the position of the DSP in the chain, jtag_select_kernels() picks them once the */
+/* path lengths and positions are known, so the loops do not test the chain position per bit */
+/* jtag_data_shift (IDCODE, once per session) keeps the general code */
+
+/* copies pin updates into out_buffer, the buffer is sent whenever it is full, like jtag_outp does */
+static void jtag_buffer_copy(jtag_session *s, unsigned char *pins, int length) {
+    int n,copied;
+    for (copied=0;copied<length;copied+=n) {
+        n=length-copied;
+        if (n>JTAG_OUT_BUFFER_SIZE-s->out_count) n=JTAG_OUT_BUFFER_SIZE-s->out_count;
+        memcpy(s->out_buffer+s->out_count,pins+copied,n);
+        s->out_count+=n;
+        if (s->out_count==JTAG_OUT_BUFFER_SIZE) jtag_flush(s);
+    }
+    s->jtag_stats.pin_writes+=length;
+}
+
+/* clocks n bits of TDI=1 (bypass padding), TMS is set with the last one if tms */
+/* in the buffered bit-bang modes the run is copied from a vector built once per pin state */
+static void jtag_pad(jtag_session *s, int n, int tms) {
+    unsigned char base;
+    int i,k;
+    if (n<=0) return;
+    s->jtag_stats.pad_cycles+=n;
+    s->pport_data|=JTAG_TDI_MASK;
+    if ((!s->out_buffering)&&(s->transport==TRANSPORT_BITBANG)) {
+        for (i=0;i<n;i++) {
+            if ((tms)&&(i==n-1)) JTAG_TMS_SET;
+            JTAG_TCK_RESET;
+            JTAG_TCK_SET;
+        }
+        return;
+    }
+    base=s->pport_data&~JTAG_TCK_MASK;
+    if (s->pad_base!=base) {
+        for (i=0;i<PAD_VECTOR;i+=2) {
+            s->pad_vector[i]=base;
+            s->pad_vector[i+1]=base|JTAG_TCK_MASK;
+        }
+        s->pad_base=base;
+    }
+    if (tms) n--;								/* the last one is clocked with TMS below */
+    for (i=0;i<n;i+=k) {
+        k=n-i;
+        if (k>PAD_VECTOR/2) k=PAD_VECTOR/2;
+        jtag_buffer_copy(s,s->pad_vector,2*k);
+    }
+    s->jtag_stats.tck_cycles+=n;
+    s->pport_data=s->out_last=base|JTAG_TCK_MASK;
+    if (tms) {
+        JTAG_TMS_SET;
+        JTAG_TCK_RESET;
+        JTAG_TCK_SET;
+    }
+}
+
+/* DR write of the DSP alone in the chain or last in the chain (data_pp 0) */
+static void jtag_write_single(jtag_session *s, unsigned int data, int bits) {
     int i;
     JTAG_TMS_RESET;								/* Go to Capture-DR */
     JTAG_TCK_RESET;
     JTAG_TCK_SET;
     JTAG_TCK_RESET;								/* Go to Shift-DR */
     JTAG_TCK_SET;								/* Now the Jtag is in the Shift-DR state */
-    //	if (data_pl-1-data_pp) JTAG_TDI_ASSIGN(1);	// this is not needed for write only operation
-    //	for(i=0;i<(data_pl-1-data_pp);i++) {
-    //		JTAG_TCK_RESET;
-    //		JTAG_TCK_SET;
-    //	}
-    for (i=0;i<8;i++) {
+    for (i=0;i<bits-1;i++) {
         JTAG_TDI_ASSIGN(data);
         data>>=1;
-        if ((data_pp==0)&&(i==7)) JTAG_TMS_SET;		/* Go to Exit1-DR */
-        JTAG_TCK_RESET;
-        JTAG_TCK_SET;
-    }
-    if (data_pp) JTAG_TDI_ASSIGN(1);
-    for (i=0;i<data_pp;i++) {
-        if (i==(data_pp-1)) JTAG_TMS_SET;			/* Go to Exit1-DR */
         JTAG_TCK_RESET;
         JTAG_TCK_SET;
     }
+    JTAG_TDI_ASSIGN(data);
+    JTAG_TMS_SET;								/* Go to Exit1-DR */
+    JTAG_TCK_RESET;
+    JTAG_TCK_SET;
     JTAG_TCK_RESET;								/* Go to Update-DR */
     JTAG_TCK_SET;
     JTAG_TCK_RESET;								/* Go to Select-DR-Scan */
@@ -535,34 +1273,21 @@ void jtag_data_write8(unsigned int data) {
     JTAG_TCK_SET;
 }
 
-/* writes 16 bits to the JTAG DR path */
-/* expects Select-DR-Scan state of the Jtag state machine state upon entry */
-/* and leaves the Jtag in Select-DR-Scan on exit */
-void jtag_data_write16(unsigned int data) {
+/* DR write with data_pp bypass bits behind the data */
+static void jtag_write_padded(jtag_session *s, unsigned int data, int bits) {
     int i;
     JTAG_TMS_RESET;								/* Go to Capture-DR */
     JTAG_TCK_RESET;
     JTAG_TCK_SET;
     JTAG_TCK_RESET;								/* Go to Shift-DR */
     JTAG_TCK_SET;								/* Now the Jtag is in the Shift-DR state */
-    //	if (data_pl-1-data_pp) JTAG_TDI_ASSIGN(1);	//this is not needed for write only operation
-    //	for(i=0;i<(data_pl-1-data_pp);i++) {
-    //		JTAG_TCK_RESET;
-    //		JTAG_TCK_SET;
-    //	}
-    for (i=0;i<16;i++) {
+    for (i=0;i<bits;i++) {
         JTAG_TDI_ASSIGN(data);
         data>>=1;
-        if ((data_pp==0)&&(i==15)) JTAG_TMS_SET;		/* Go to Exit1-DR */
-        JTAG_TCK_RESET;
-        JTAG_TCK_SET;
-    }
-    if (data_pp) JTAG_TDI_ASSIGN(1);
-    for (i=0;i<data_pp;i++) {
-        if (i==(data_pp-1)) JTAG_TMS_SET;			/* Go to Exit1-DR */
         JTAG_TCK_RESET;
         JTAG_TCK_SET;
     }
+    jtag_pad(s,s->data_pp,1);						/* Go to Exit1-DR with the last one */
     JTAG_TCK_RESET;								/* Go to Update-DR */
     JTAG_TCK_SET;
     JTAG_TCK_RESET;								/* Go to Select-DR-Scan */
@@ -571,335 +1296,1692 @@ void jtag_data_write16(unsigned int data) {
     JTAG_TCK_SET;
 }
 
-/* reads 16 bits from the jtag DR path */
-/* expects Select-DR-Scan state of the Jtag state machine state upon entry */
-/* and leaves the Jtag in Select-DR-Scan on exit */
-unsigned int jtag_data_read16(void) {
+static void jtag_write_vector(jtag_session *s, unsigned int data, int bits) {
+    jtag_vector_write(s,data&((1<<bits)-1),bits);
+}
+
+static void jtag_write_mpsse(jtag_session *s, unsigned int data, int bits) {
+    mpsse_handover(s);
+    mpsse_data_write(s,data,bits,s->data_pp);
+}
+
+/* 16-bit DR read, the bits behind the DSP (data_pp) are not clocked, the ones in front */
+/* (data_pl-1-data_pp) are bypass padding, pad!=0 selects the padded variant */
+static unsigned int jtag_read16_scan(jtag_session *s, int pad) {
     int i;
+    int tdo[16];
     unsigned int result=0;
     JTAG_TMS_RESET;								/* Go to Capture-DR */
     JTAG_TCK_RESET;
     JTAG_TCK_SET;								/* Go to Shift-DR */
     JTAG_TCK_RESET;
     JTAG_TCK_SET;								/* Now the Jtag is in the Shift-DR state */
-    if (data_pl-1-data_pp) {
-        JTAG_TDI_ASSIGN(1);
-    }
-    for(i=0;i<(data_pl-1-data_pp);i++) {
+    if (pad) jtag_pad(s,s->data_pl-1-s->data_pp,0);
+    for (i=0;i<15;i++) {
         JTAG_TCK_RESET;
         JTAG_TCK_SET;
+        tdo[i]=JTAG_TDO_FUTURE;
     }
-    for (i=0;i<16;i++) {
-        //		if ((data_pp==0)&&(i==15)) JTAG_TMS_SET;	/* Go to Exit1-DR */
-        if (i==15) JTAG_TMS_SET;					/* Go to Exit1-DR */
-        JTAG_TCK_RESET;
-        JTAG_TCK_SET;
-        result>>=1;
-        if (JTAG_TDO_VALUE)
-            result |= 0x8000;
-    }
-    //	if (data_pp) JTAG_TDI_ASSIGN(1);			//this is not needed for read only operation
-    //	for (i=0;i<data_pp;i++) {
-    //		if (i==(data_pp-1)) JTAG_TMS_SET;		/* Go to Exit1-DR */
-    //		JTAG_TCK_RESET;
-    //		JTAG_TCK_SET;
-    //	}
+    JTAG_TMS_SET;								/* Go to Exit1-DR */
+    JTAG_TCK_RESET;
+    JTAG_TCK_SET;
+    tdo[15]=JTAG_TDO_FUTURE;
     JTAG_TCK_RESET;								/* Go to Update-DR */
     JTAG_TCK_SET;
     JTAG_TCK_RESET;								/* Go to Select-DR-Scan */
     WAIT_100_NS;
     WAIT_100_NS;
     JTAG_TCK_SET;
+    for (i=0;i<16;i++) if (JTAG_TDO_RESOLVE(tdo[i])) result|=1<<i;
+    return(result);
+}
+
+static unsigned int jtag_read16_single(jtag_session *s) {
+    return(jtag_read16_scan(s,0));
+}
+
+static unsigned int jtag_read16_padded(jtag_session *s) {
+    return(jtag_read16_scan(s,1));
+}
+
+static unsigned int jtag_read16_mpsse(jtag_session *s) {
+    mpsse_handover(s);
+    return(mpsse_data_read16(s,s->data_pl,s->data_pp));
+}
+
+/* with -park the IR scans copy the path from Select-DR-Scan to Shift-IR and the BYPASS ones of */
+/* the parts in front of the DSP from a prefix built once per chain configuration and pin state */
+static void jtag_ir_prefix(jtag_session *s) {
+    unsigned char base=s->pport_data&~(JTAG_TMS_MASK|JTAG_TCK_MASK);
+    unsigned char pins;
+    int i,n=0,pad=s->instr_pl-s->instr_pp-4;
+    if ((s->ir_prefix_base!=base)||(s->ir_prefix_pad!=pad)) {
+        pins=base|JTAG_TMS_MASK;				/* Go to Select-IR-Scan */
+        s->ir_prefix[n++]=pins;
+        s->ir_prefix[n++]=pins|JTAG_TCK_MASK;
+        pins=base;								/* Go to Capture-IR */
+        s->ir_prefix[n++]=pins;
+        s->ir_prefix[n++]=pins|JTAG_TCK_MASK;
+        s->ir_prefix[n++]=pins;					/* Go to Shift-IR */
+        s->ir_prefix[n++]=pins|JTAG_TCK_MASK;
+        if (pad>0) pins|=JTAG_TDI_MASK;
+        for (i=0;i<pad;i++) {
+            s->ir_prefix[n++]=pins;
+            s->ir_prefix[n++]=pins|JTAG_TCK_MASK;
+        }
+        s->ir_prefix_length=n;
+        s->ir_prefix_base=base;
+        s->ir_prefix_pad=pad;
+    }
+    jtag_buffer_copy(s,s->ir_prefix,s->ir_prefix_length);
+    s->jtag_stats.tck_cycles+=s->ir_prefix_length/2;
+    if (pad>0) s->jtag_stats.pad_cycles+=pad;
+    s->pport_data=s->out_last=s->ir_prefix[s->ir_prefix_length-1];
+}
+
+/* IR scan of the 4-bit DSP instruction, instr_pl-instr_pp-4 bypass bits in front, instr_pp behind */
+/* pad: 0 single variant, 1 padded variant, 2 padded variant with the parked prefix */
+static int jtag_ir_scan(jtag_session *s, int instruction, int pad) {
+    int i,status=0;
+    int tdo[4];
+    if (pad==2) jtag_ir_prefix(s);
+    else {
+        JTAG_TMS_SET;							/* Go to Select-IR-Scan */
+        JTAG_TCK_RESET;
+        JTAG_TCK_SET;
+        JTAG_TMS_RESET;							/* Go to Capture-IR */
+        JTAG_TCK_RESET;
+        JTAG_TCK_SET;
+        JTAG_TCK_RESET;
+        JTAG_TCK_SET;							/* Go to Shift-IR */ /* Now the Jtag is in the Shift-IR state */
+        if (pad) jtag_pad(s,s->instr_pl-s->instr_pp-4,0);
+    }
+    for (i=0;i<4;i++) {
+        JTAG_TDI_ASSIGN(instruction);
+        instruction>>=1;
+        if ((!pad)&&(i==3)) JTAG_TMS_SET;		/* Go to Exit1-IR */
+        JTAG_TCK_RESET;
+        JTAG_TCK_SET;
+        tdo[i]=JTAG_TDO_FUTURE;
+    }
+    if (pad) jtag_pad(s,s->instr_pp,1);				/* Go to Exit1-IR with the last one */
+    JTAG_TCK_RESET;								/* Go to Update-IR */
+    JTAG_TCK_SET;
+    JTAG_TCK_RESET;								/* Go to Select-DR-Scan */
+    JTAG_TCK_SET;
+    for (i=0;i<4;i++) status|=JTAG_TDO_RESOLVE(tdo[i])<<i;
+    return(status);
+}
+
+static int jtag_ir_single(jtag_session *s, int instruction) {
+    return(jtag_ir_scan(s,instruction,0));
+}
+
+static int jtag_ir_padded(jtag_session *s, int instruction) {
+    return(jtag_ir_scan(s,instruction,1));
+}
+
+static int jtag_ir_parked(jtag_session *s, int instruction) {
+    return(jtag_ir_scan(s,instruction,2));
+}
+
+static int jtag_ir_mpsse(jtag_session *s, int instruction) {
+    mpsse_handover(s);
+    return(mpsse_instruction_exec(s,instruction,s->instr_pl,s->instr_pp));
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* lockstep scans of several DSPs in the chain (-m given once per DSP), every scan carries the */
+/* same OnCE command or instruction to all of them, only jtag_data_write16_lanes writes a word */
+/* per DSP, the DR reads keep the word of every DSP in lane_read[] and return the OR of them, so */
+/* a BUSY bit set in any DSP keeps the polling loops going, the other parts stay in BYPASS */
+#define LANE_SCAN_MAX		(JTAG_PATH_LEN_MAX+32*LANES_MAX)	/* bits of a lockstep scan */
+
+/* one scan from Select-DR-Scan through Shift-DR (ir==0) or Shift-IR back to Select-DR-Scan */
+/* bit i of the scan shifts tdi[i] in, TMS is set with the last one, sample[i]>=0 stores the TDO */
+/* bit of chain position i as bit (sample[i]&0xff) of result[sample[i]>>8] */
+static void jtag_lane_scan(jtag_session *s, int ir, unsigned char *tdi, int *sample, int n, unsigned long int *result) {
+    int future[LANE_SCAN_MAX];
+    unsigned long int chunk[LANE_SCAN_MAX/32+1],bits;
+    int i,j,k,resolved=0,pending=0,read=0;
+    for (k=0;k<s->lane_count;k++) result[k]=0;
+    for (i=0;i<n;i++) if (sample[i]>=0) read=1;
+    if (s->transport==TRANSPORT_MPSSE) {
+        mpsse_handover(s);
+        mpsse_tms(s,ir?0x01:0x00,ir?3:2);			/* Shift-IR or Shift-DR */
+        for (i=0;i<n;i+=32) {
+            k=(n-i>32)?32:n-i;
+            for (bits=0,j=0;j<k;j++) bits|=(unsigned long int)tdi[i+j]<<j;
+            chunk[i/32]=0;
+            mpsse_shift(s,bits,k,read?&chunk[i/32]:NULL,i+k==n);	/* the last chunk leaves to Select-DR-Scan */
+        }
+        if (!read) return;						/* writes stay queued */
+        mpsse_flush(s);
+        for (i=0;i<n;i++) if (sample[i]>=0) result[sample[i]>>8]|=((chunk[i/32]>>(i%32))&1)<<(sample[i]&0xff);
+        return;
+    }
+    if (ir) {
+        JTAG_TMS_SET;							/* Go to Select-IR-Scan */
+        JTAG_TCK_RESET;
+        JTAG_TCK_SET;
+    }
+    JTAG_TMS_RESET;								/* Go to Capture-xR */
+    JTAG_TCK_RESET;
+    JTAG_TCK_SET;
+    JTAG_TCK_RESET;								/* Go to Shift-xR */
+    JTAG_TCK_SET;
+    for (i=0;i<n;i++) {
+        JTAG_TDI_ASSIGN(tdi[i]);
+        if (i==n-1) JTAG_TMS_SET;				/* Go to Exit1-xR */
+        JTAG_TCK_RESET;
+        JTAG_TCK_SET;
+        future[i]=-1;
+        if (sample[i]<0) continue;
+        future[i]=JTAG_TDO_FUTURE;
+        if (++pending<JTAG_FUTURES_MAX) continue;
+        for (;resolved<=i;resolved++) if (future[resolved]>=0) {	/* the ring of samples is full */
+            result[sample[resolved]>>8]|=(unsigned long int)JTAG_TDO_RESOLVE(future[resolved])<<(sample[resolved]&0xff);
+        }
+        pending=0;
+    }
+    JTAG_TCK_RESET;								/* Go to Update-xR */
+    JTAG_TCK_SET;
+    JTAG_TCK_RESET;								/* Go to Select-DR-Scan */
+    if (!ir) {
+        WAIT_100_NS;
+        WAIT_100_NS;
+    }
+    JTAG_TCK_SET;
+    for (;resolved<n;resolved++) if (future[resolved]>=0) {
+        result[sample[resolved]>>8]|=(unsigned long int)JTAG_TDO_RESOLVE(future[resolved])<<(sample[resolved]&0xff);
+    }
+}
+
+/* DR scan of bits per DSP, the DSPs nearer TDO come first in a read, the ones nearer TDI last in */
+/* a write, other parts in the chain take one bit each, returns the OR of the words read */
+static unsigned long int jtag_lane_dr(jtag_session *s, int bits, unsigned long int data, int read) {
+    unsigned char tdi[LANE_SCAN_MAX];
+    int sample[LANE_SCAN_MAX];
+    int offset[LANES_MAX];
+    int i,k,b,n=0,before,after;
+    unsigned long int value,result=0;
+    for (k=0;k<s->lane_count;k++) {
+        for (before=after=i=0;i<s->lane_count;i++) {
+            if (s->lane_data_pp[i]<s->lane_data_pp[k]) before++;
+            if (s->lane_data_pp[i]>s->lane_data_pp[k]) after++;
+        }
+        if (read) offset[k]=s->data_pl-1-s->lane_data_pp[k]+(bits-1)*after;	/* from TDO */
+        else offset[k]=s->lane_data_pp[k]+(bits-1)*before;					/* from TDI */
+        if (offset[k]+bits>n) n=offset[k]+bits;
+    }
+    for (i=0;i<n;i++) {
+        tdi[i]=1;
+        sample[i]=-1;
+    }
+    for (k=0;k<s->lane_count;k++) {
+        value=(s->lane_write)?s->lane_write[k]:data;
+        for (b=0;b<bits;b++) {
+            if (read) sample[offset[k]+b]=(k<<8)|b;
+            else tdi[n-offset[k]-bits+b]=(value>>b)&1;
+        }
+    }
+    jtag_lane_scan(s,0,tdi,sample,n,s->lane_read);
+    if (!read) return(0);
+    for (k=0;k<s->lane_count;k++) result|=s->lane_read[k];
     return(result);
 }
 
+static void jtag_write_lanes(jtag_session *s, unsigned int data, int bits) {
+    jtag_lane_dr(s,bits,data,0);
+}
+
+static unsigned int jtag_read16_lanes(jtag_session *s) {
+    return((unsigned int)jtag_lane_dr(s,16,0,1));
+}
+
+/* IR scan of the same instruction into every DSP, returns the status if all DSPs agree, else 0 */
+static int jtag_ir_lanes(jtag_session *s, int instruction) {
+    unsigned char tdi[JTAG_PATH_LEN_MAX];
+    int sample[JTAG_PATH_LEN_MAX];
+    unsigned long int status[LANES_MAX];
+    int i,k,b,offset;
+    for (i=0;i<s->instr_pl;i++) {
+        tdi[i]=1;
+        sample[i]=-1;
+    }
+    for (k=0;k<s->lane_count;k++) {
+        offset=s->instr_pl-s->lane_instr_pp[k]-4;		/* from TDO */
+        for (b=0;b<4;b++) {
+            tdi[offset+b]=(instruction>>b)&1;
+            sample[offset+b]=(k<<8)|b;
+        }
+    }
+    jtag_lane_scan(s,1,tdi,sample,s->instr_pl,status);
+    for (k=1;k<s->lane_count;k++) if (status[k]!=status[0]) return(0);
+    return((int)status[0]);
+}
+
+/* selects the scan kernels for the transport and the chain position */
+void jtag_select_kernels(jtag_session *s) {
+    if (s->lane_count>1) {
+        s->scan_write=jtag_write_lanes;
+        s->scan_read16=jtag_read16_lanes;
+        s->scan_ir=jtag_ir_lanes;
+        s->scan_kernel_name="lockstep";
+        return;
+    }
+    if (s->transport==TRANSPORT_MPSSE) {
+        s->scan_write=jtag_write_mpsse;
+        s->scan_read16=jtag_read16_mpsse;
+        s->scan_ir=jtag_ir_mpsse;
+        s->scan_kernel_name="MPSSE";
+        return;
+    }
+    if ((s->data_pp==0)&&(s->data_pl<=1)&&(s->instr_pp==0)&&(s->instr_pl<=4)) {
+        s->scan_write=jtag_write_single;
+        s->scan_read16=jtag_read16_single;
+        s->scan_ir=jtag_ir_single;
+        s->scan_kernel_name="single device";
+    } else {
+        s->scan_write=(s->data_pp)?jtag_write_padded:jtag_write_single;
+        s->scan_read16=(s->data_pl-1-s->data_pp>0)?jtag_read16_padded:jtag_read16_single;
+        s->scan_ir=((s->instr_pp)||(s->instr_pl>4))?jtag_ir_padded:jtag_ir_single;
+        s->scan_kernel_name="padded";
+        if ((s->park_mode)&&((s->out_buffering)||(s->transport==TRANSPORT_SYNCBB))) {
+            s->scan_ir=jtag_ir_parked;
+            s->scan_kernel_name="padded, parked";
+        }
+    }
+    if ((s->pin_vectors)&&((s->out_buffering)||(s->transport==TRANSPORT_SYNCBB))) s->scan_write=jtag_write_vector;
+}
+
+static void jtag_write_select(jtag_session *s, unsigned int data, int bits) {
+    jtag_select_kernels(s);
+    s->scan_write(s,data,bits);
+}
+
+static unsigned int jtag_read16_select(jtag_session *s) {
+    jtag_select_kernels(s);
+    return(s->scan_read16(s));
+}
+
+static int jtag_ir_select(jtag_session *s, int instruction) {
+    jtag_select_kernels(s);
+    return(s->scan_ir(s,instruction));
+}
+
+/* host CPU time of the scan kernels, the pin updates go to a port which discards them */
+#define SCAN_BENCH_COUNT	20000
+#define SCAN_BENCH_PASSES	3
+
+static int bench_port_open(jtag_session *s, unsigned char bitmode) {
+    (void)s;
+    (void)bitmode;
+    return(0);
+}
+static void bench_port_close(jtag_session *s) {
+    (void)s;
+}
+static int bench_port_write(jtag_session *s, unsigned char *buf, int size) {
+    (void)s;
+    (void)buf;
+    return(size);
+}
+static int bench_port_read(jtag_session *s, unsigned char *buf, int size) {
+    (void)s;
+    memset(buf,0,size);
+    return(size);
+}
+static int bench_port_read_pins(jtag_session *s, unsigned char *pins) {
+    (void)s;
+    *pins=0;
+    return(0);
+}
+jtag_port bench_port={bench_port_open, bench_port_close, bench_port_write, bench_port_read, bench_port_read_pins, NULL, NULL};
+
+/* times SCAN_BENCH_COUNT 16-bit writes, reads and IR scans in ns per scan, best of SCAN_BENCH_PASSES */
+static void jtag_scan_bench_run(jtag_session *s, char *chain, char *variant) {
+    double t[4],best[3]={0,0,0};
+    int i,k,pass;
+    jtag_select_kernels(s);
+    for (pass=0;pass<SCAN_BENCH_PASSES;pass++) {
+        t[0]=jtag_wall_clock(s);
+        for (i=0;i<SCAN_BENCH_COUNT;i++) s->scan_write(s,i,16);
+        jtag_flush(s);
+        t[1]=jtag_wall_clock(s);
+        for (i=0;i<SCAN_BENCH_COUNT;i++) s->scan_read16(s);
+        t[2]=jtag_wall_clock(s);
+        for (i=0;i<SCAN_BENCH_COUNT;i++) s->scan_ir(s,0x07);
+        jtag_flush(s);
+        t[3]=jtag_wall_clock(s);
+        for (k=0;k<3;k++) if ((pass==0)||(t[k+1]-t[k]<best[k])) best[k]=t[k+1]-t[k];
+    }
+    printf("%-12s %-16s %-8s %8.0f %8.0f %8.0f\n",chain,s->scan_kernel_name,variant,
+           best[0]*1e3/SCAN_BENCH_COUNT,best[1]*1e3/SCAN_BENCH_COUNT,best[2]*1e3/SCAN_BENCH_COUNT);
+}
+
+/* host CPU time per scan of the kernels in the transport selected by the options, */
+/* for the DSP alone and in the middle of chains of four and sixteen parts (4-bit IRs) */
+void jtag_scan_bench(jtag_session *s) {
+    jtag_port *saved_port=s->port;
+    unsigned char saved_vectors=s->pin_vectors;
+    int c,v;
+    static struct {
+        char *name;
+        int data_pl,data_pp,instr_pl,instr_pp;
+    } chains[3]={{"single",1,0,4,0},{"4 in chain",4,1,16,4},{"16 in chain",16,8,64,28}};
+    if (s->transport==TRANSPORT_MPSSE) {
+        printf("The scan benchmark measures the bit-bang kernels, -mpsse ignored\n");
+        s->transport=TRANSPORT_BITBANG;
+    }
+    s->port=&bench_port;
+    printf("Host CPU time per scan [ns], %d scans, pin updates discarded\n",SCAN_BENCH_COUNT);
+    printf("%-12s %-16s %-8s %8s %8s %8s\n","chain","kernels","writes","write16","read16","IR");
+    for (c=0;c<3;c++) {
+        s->data_pl=chains[c].data_pl;
+        s->data_pp=chains[c].data_pp;
+        s->instr_pl=chains[c].instr_pl;
+        s->instr_pp=chains[c].instr_pp;
+        for (v=0;v<2;v++) {
+            s->pin_vectors=v;
+            jtag_scan_bench_run(s,chains[c].name,v?"vectors":"bits");
+        }
+    }
+    s->pin_vectors=saved_vectors;
+    s->port=saved_port;
+    jtag_reset_stats(s);
+}
+
+/* Executes Jtag command */
+/* expects Select-DR-Scan state of the Jtag state machine state upon entry */
+/* and leaves the Jtag in Select-DR-Scan on exit */
+int jtag_instruction_exec(jtag_session *s, int instruction) {
+    return(s->scan_ir(s,instruction));
+}
+
+/* writes 8 bits to the JTAG DR path */
+/* expects Select-DR-Scan state of the Jtag state machine state upon entry */
+/* and leaves the Jtag in Select-DR-Scan on exit */
+void jtag_data_write8(jtag_session *s, unsigned int data) {
+    s->jtag_stats.dr_scans++;
+    s->scan_write(s,data,8);
+}
+
+/* writes 16 bits to the JTAG DR path */
+/* expects Select-DR-Scan state of the Jtag state machine state upon entry */
+/* and leaves the Jtag in Select-DR-Scan on exit */
+void jtag_data_write16(jtag_session *s, unsigned int data) {
+    s->jtag_stats.dr_scans++;
+    s->scan_write(s,data,16);
+}
+
+/* reads 16 bits from the jtag DR path */
+/* expects Select-DR-Scan state of the Jtag state machine state upon entry */
+/* and leaves the Jtag in Select-DR-Scan on exit */
+unsigned int jtag_data_read16(jtag_session *s) {
+    s->jtag_stats.dr_scans++;
+    return(s->scan_read16(s));
+}
+
+/* writes data[k] to the DSP of lane k (lockstep mode), data[0] otherwise */
+void jtag_data_write16_lanes(jtag_session *s, unsigned int *data) {
+    s->jtag_stats.dr_scans++;
+    if (s->lane_count>1) s->lane_write=data;
+    s->scan_write(s,data[0],16);
+    s->lane_write=NULL;
+}
+
+/* host side shadow of the target registers, index = bit number of the REG_xx mask: R0-R3, Y0, Y1, OMR */
+/* a register whose bit is set in shadow_valid holds shadow_value[], the shadow follows every */
+/* instruction executed through the OnCE, including the post-increments (R0-R3 are linear, M01 is */
+/* never changed by the loader), and is invalidated whenever the core runs or is reset */
+#define SHADOW_Y0		4
+#define SHADOW_Y1		5
+#define SHADOW_OMR		6
+
+void once_shadow_invalidate(jtag_session *s) {
+    s->shadow_valid=0;
+}
+
+static void once_shadow_set(jtag_session *s, int reg, unsigned int value) {
+    s->shadow_value[reg]=value&0xffff;
+    s->shadow_valid|=1<<reg;
+}
+
+/* (Rn)+ addressing */
+static void once_shadow_increment(jtag_session *s, int reg) {
+    s->shadow_value[reg]=(s->shadow_value[reg]+1)&0xffff;
+}
+
+/* follows a one word instruction, the instructions the loader does not use make all registers unknown */
+static void once_shadow_update(jtag_session *s, unsigned int opcode) {
+    int n=opcode&3;
+    if ((opcode&0xffc0)==FUSED_MOVE_Y0_PP) return;
+    if ((opcode&0xffc0)==FUSED_MOVE_PP_Y0) {
+        s->shadow_valid&=~REG_Y0;
+        return;
+    }
+    switch (opcode&0xfffc) {
+        case 0xf114:							/* MOVE x:(Rn),Y0 */
+        case 0x811c:							/* MOVE SR,Y0 (0x811d) */
+            s->shadow_valid&=~REG_Y0;
+            return;
+        case 0xf100:							/* MOVE x:(Rn)+,Y0 */
+        case 0xe120:							/* MOVE p:(Rn)+,Y0 */
+            s->shadow_valid&=~REG_Y0;
+            once_shadow_increment(s,n);
+            return;
+        case 0xd100:							/* MOVE Y0,x:(Rn)+ */
+        case 0xd300:							/* MOVE Y1,x:(Rn)+ */
+        case 0xe100:							/* MOVE Y0,p:(Rn)+ */
+        case 0xe300:							/* MOVE Y1,p:(Rn)+ */
+            once_shadow_increment(s,n);
+            return;
+        case 0x8110:							/* MOVE Rn,Y0 */
+            if (s->shadow_valid&(1<<n)) once_shadow_set(s,SHADOW_Y0,s->shadow_value[n]);
+            else s->shadow_valid&=~REG_Y0;
+            return;
+    }
+    switch (opcode) {
+        case 0xe040:							/* NOP */
+        case 0xd115:							/* MOVE Y0,x:(R1) */
+        case 0x8d81:							/* MOVE Y0,SR */
+            return;
+        case 0x8118:							/* MOVE OMR,Y0 */
+            if (s->shadow_valid&REG_OMR) once_shadow_set(s,SHADOW_Y0,s->shadow_value[SHADOW_OMR]);
+            else s->shadow_valid&=~REG_Y0;
+            return;
+        case 0x8881:							/* MOVE Y0,OMR */
+            if (s->shadow_valid&REG_Y0) once_shadow_set(s,SHADOW_OMR,s->shadow_value[SHADOW_Y0]);
+            else s->shadow_valid&=~REG_OMR;
+            return;
+    }
+    s->shadow_valid=0;
+}
+
+/* executes a one word instruction through the OnCE */
+void once_execute1(jtag_session *s, unsigned int opcode) {
+    once_shadow_update(s,opcode);
+    s->once_issued++;
+    s->once_issued_words++;
+    once_instruction_exec(s,0x09,0,1,0);
+    once_data_write(s,opcode);
+}
+
+/* executes a two word instruction through the OnCE, a MOVE #<data> to a register which already */
+/* holds the data is dropped in shadow mode, with set_fused_short_io the absolute moves to and */
+/* from the top 64 words of X memory (OPGDBR) are replaced by the one word short I/O form */
+void once_execute2(jtag_session *s, unsigned int opcode1, unsigned int opcode2) {
+    int reg=-1;
+    if ((s->fused_short_io)&&((opcode1==0xd154)||(opcode1==0xf154))&&((opcode2&0xffff)>=FUSED_PP_BASE)) {
+        once_execute1(s,((opcode1==0xd154)?FUSED_MOVE_Y0_PP:FUSED_MOVE_PP_Y0)|(opcode2&0x3f));
+        return;
+    }
+    if ((opcode1&0xfffc)==0x87d0) reg=opcode1&3;	/* MOVE #<data>,Rn */
+    else if (opcode1==0x87c1) reg=SHADOW_Y0;		/* MOVE #<data>,Y0 */
+    else if (opcode1==0x87c3) reg=SHADOW_Y1;		/* MOVE #<data>,Y1 */
+    if (reg>=0) {
+        if ((s->register_shadow)&&(s->shadow_valid&(1<<reg))&&(s->shadow_value[reg]==(opcode2&0xffff))) {
+            s->once_dropped++;
+            s->once_dropped_words+=2;
+            return;
+        }
+        once_shadow_set(s,reg,opcode2);
+    } else if (opcode1==0xf154) s->shadow_valid&=~REG_Y0;	/* MOVE x:<address>,Y0 */
+    else if ((opcode1!=0xd154)&&(opcode1!=0xe984)&&((opcode1&0xff80)!=FUSED_MOVE_DATA_XR2_OFF)) s->shadow_valid=0;	/* MOVE Y0,x:<address>, JMP and MOVE #<data>,x:(R2+xx) keep them */
+    s->once_issued++;
+    s->once_issued_words+=2;
+    once_instruction_exec(s,0x09,0,0,0);
+    once_data_write(s,opcode1);
+    once_instruction_exec(s,0x09,0,1,0);
+    once_data_write(s,opcode2);
+}
+
+/* executes a one word instruction and exits the debug mode, the core runs from there */
+void once_execute1_run(jtag_session *s, unsigned int opcode) {
+    s->shadow_valid=0;
+    s->once_issued++;
+    s->once_issued_words++;
+    once_instruction_exec(s,0x09,0,1,1);
+    once_data_write(s,opcode);
+}
+
+/* prints the OnCE instructions executed and the ones the shadow dropped */
+void once_shadow_report(jtag_session *s) {
+    printf("OnCE instructions: %lu (%lu words) executed",s->once_issued,s->once_issued_words);
+    if (s->once_dropped) printf(", %lu (%lu words) dropped, %lu (%lu words) without the register shadow",
+                                 s->once_dropped,s->once_dropped_words,s->once_issued+s->once_dropped,s->once_issued_words+s->once_dropped_words);
+    printf("\n");
+}
+
+#define SCAN_READ		0				/* paths of the DR scan report */
+#define SCAN_INIT		1
+#define SCAN_PROGRAM	2
+#define SCAN_VERIFY		3
+
+char *scan_names[SCAN_PATHS]={"read","FIU init","program","verify"};
+
+/* adds the DR scans since start (jtag_stats.dr_scans) to the path */
+static void once_scan_account(jtag_session *s, int path, unsigned long int start, unsigned long int words) {
+    s->scan_count[path]+=s->jtag_stats.dr_scans-start;
+    s->scan_words[path]+=words;
+}
+
+/* prints the DR scans per word of the paths which were used */
+void once_scan_report(jtag_session *s) {
+    int i;
+    for (i=0;i<SCAN_PATHS;i++) {
+        if (!s->scan_words[i]) continue;
+        printf("DR scans per word, %-9s %6.2f (%lu scans, %lu words)\n",scan_names[i],(double)s->scan_count[i]/s->scan_words[i],s->scan_count[i],s->scan_words[i]);
+    }
+}
+
+#define FIU_TIMING_REGS		9			/* FIU_CKDIVISOR to FIU_TRCV, from interface_address+8 on */
+
 /* initialises the Flash Timing registers for Flash programming interface at given address */
-int once_init_flash_iface(flash_constants flash_param) {
+/* with set_fused_immediate the timing registers are written by MOVE #<data>,X:(R2+xx), without Y0 */
+int once_init_flash_iface(jtag_session *s, flash_constants flash_param) {
+    unsigned int timing[FIU_TIMING_REGS];
+    unsigned long int scans=s->jtag_stats.dr_scans;
+    int i;
+    timing[0]=flash_param.clk_divisor;
+    timing[1]=flash_param.terasel;
+    timing[2]=flash_param.tmel;
+    timing[3]=flash_param.tnvsl;
+    timing[4]=flash_param.tpgsl;
+    timing[5]=flash_param.tprogl;
+    timing[6]=flash_param.tnvhl;
+    timing[7]=flash_param.tnvhl1;
+    timing[8]=flash_param.trcvl;
     printf("Initialising FIU at address: %#x\n",flash_param.interface_address);
-    once_move_data_to_r2(flash_param.interface_address);	/* MOVE #<base address>,R2		*/
-    once_move_data_to_y0(info_block?0x0040:0);	/* MOVE #0+IFREN,Y0				*/
-    once_move_y0_to_xr2_inc();					/* clear FIU_CNTL register	*/
-    if (info_block) once_move_data_to_y0(0);	/* MOVE #0,Y0				*/
-    once_move_y0_to_xr2_inc();					/* clear FIU_PE register	*/
-    once_move_y0_to_xr2_inc();					/* clear FIU_EE register	*/
-
-    once_move_data_to_r1(flash_param.interface_address);	/* MOVE #<base address>,R1 	 */
-    once_move_data_to_r0(flash_param.interface_address+8);	/* MOVE #<base address+8>,R0 */
-    once_move_xr1_inc_to_y0();					/* MOVE x:R1,Y0				 	*/
-    once_move_y0_to_xmem(0xffff);				/* MOVE Y0,<OPGDBR> 		 	*/
-    if (once_opgdbr_read()&0x8000) {			/* Read OPGDBR register 		*/
+    once_move_data_to_r2(s,flash_param.interface_address);	/* MOVE #<base address>,R2		*/
+    once_move_data_to_y0(s,s->info_block?0x0040:0);	/* MOVE #0+IFREN,Y0				*/
+    once_move_y0_to_xr2_inc(s);					/* clear FIU_CNTL register	*/
+    if (s->info_block) {
+        once_move_data_to_y0(s,0);				/* MOVE #0,Y0, braces needed as the macro expands to several statements */
+    }
+    once_move_y0_to_xr2_inc(s);					/* clear FIU_PE register	*/
+    once_move_y0_to_xr2_inc(s);					/* clear FIU_EE register	*/
+
+    once_move_data_to_r1(s,flash_param.interface_address);	/* MOVE #<base address>,R1 	 */
+    once_move_data_to_r0(s,flash_param.interface_address+8);	/* MOVE #<base address+8>,R0 */
+    once_move_xr1_inc_to_y0(s);					/* MOVE x:R1,Y0				 	*/
+    once_move_y0_to_xmem(s,0xffff);				/* MOVE Y0,<OPGDBR> 		 	*/
+    if (once_opgdbr_read(s)&0x8000) {			/* Read OPGDBR register 		*/
         printf("FIU initialisation failed, BUSY bit is set.\n");
         return(1);
     }
-    once_move_data_to_y0(flash_param.clk_divisor);			/* now fill the timing registers */
-    once_move_y0_to_xr0_inc();
-    once_move_data_to_y0(flash_param.terasel);
-    once_move_y0_to_xr0_inc();
-    once_move_data_to_y0(flash_param.tmel);
-    once_move_y0_to_xr0_inc();
-    once_move_data_to_y0(flash_param.tnvsl);
-    once_move_y0_to_xr0_inc();
-    once_move_data_to_y0(flash_param.tpgsl);
-    once_move_y0_to_xr0_inc();
-    once_move_data_to_y0(flash_param.tprogl);
-    once_move_y0_to_xr0_inc();
-    once_move_data_to_y0(flash_param.tnvhl);
-    once_move_y0_to_xr0_inc();
-    once_move_data_to_y0(flash_param.tnvhl1);
-    once_move_y0_to_xr0_inc();
-    once_move_data_to_y0(flash_param.trcvl);
-    once_move_y0_to_xr0_inc();
+    for (i=0;i<FIU_TIMING_REGS;i++) {			/* now fill the timing registers */
+        if (s->fused_immediate) {
+            once_execute_instruction2(s,FUSED_MOVE_DATA_XR2_OFF|(i+5),timing[i]);	/* MOVE #<data>,X:(R2+xx), R2 = base+3 */
+        } else {
+            once_move_data_to_y0(s,timing[i]);	/* MOVE #<data>,Y0			 */
+            once_move_y0_to_xr0_inc(s);			/* MOVE Y0,x:R0				 */
+        }
+    }
+    once_scan_account(s,SCAN_INIT,scans,3+FIU_TIMING_REGS);
     printf("FIU (%#x) initialisation done.\n", flash_param.interface_address);
     return(0);
 }
 
 /* prepares flash programming */
 /* R0 = R2 = start address, R0 for writing, R2 for verification */
-void once_flash_program_prepare (unsigned int fiu_address, unsigned int addr) {
-    once_move_data_to_r0(addr);				/* MOVE #<address>,R0 		 */
-    once_move_data_to_r1(fiu_address+1);	/* MOVE #<fiu_address+1>,R1  */
-    once_move_data_to_r2(addr);				/* MOVE #<address>,R2 		 */
-    once_move_data_to_r3(fiu_address);		/* MOVE #<fiu_address>,R3	 */
+void once_flash_program_prepare (jtag_session *s, unsigned int fiu_address, unsigned int addr) {
+    once_move_data_to_r0(s,addr);				/* MOVE #<address>,R0 		 */
+    once_move_data_to_r1(s,fiu_address+1);	/* MOVE #<fiu_address+1>,R1  */
+    once_move_data_to_r2(s,addr);				/* MOVE #<address>,R2 		 */
+    once_move_data_to_r3(s,fiu_address);		/* MOVE #<fiu_address>,R3	 */
 #ifdef DEBUG
     printf("\nDBG: FIU_ADDR: 0x%x",fiu_address);
     printf("\nDBG: START_ADDR: 0x%x",addr);
 #endif
 }
 
-void once_flash_program_pg_no (unsigned int addr) {
-#ifdef DEBUG
-    printf("\nDBG: PG_NO: 0x%x",addr);
-#endif
+#define ERASE_POLL_WORDS		6		/* one BUSY poll of the erase loops, plus the OPGDBR read */
+#define FLASH_POLL_SAMPLE		1		/* instruction words of a poll up to the read of FIU_CNTL */
+#define ERASE_POLL_SAMPLE		4
+
+#define POLL_WORD				0		/* BUSY waits of the poll histogram */
+#define POLL_ROW				1
+#define POLL_MASS				2
+#define POLL_PAGE				3
+
+char *poll_names[POLL_OPERATIONS]={"word program","row end","mass erase","page erase"};
+
+/* records the start of a BUSY period of the predicted duration, at the current position of the queue */
+static void once_busy_start(jtag_session *s, int operation, double busy) {
+    s->busy_until=jtag_queued_time(s)+busy;
+    s->busy_operation=operation;
+    s->polls[operation].busy+=busy;
+}
+
+/* queues an idle period instead of the polls which cannot see the end of BUSY, the FIU_CNTL read */
+/* comes the given time after the start of a poll, so the idle period is shorter by it */
+/* not done with one USB transfer per pin update, where the idle period would take far longer */
+static void once_busy_skip(jtag_session *s, int operation, double poll) {
+    double idle;
+    if ((!s->busy_predict)||((s->transport==TRANSPORT_BITBANG)&&(!s->out_buffering))) return;
+    idle=s->busy_until-jtag_queued_time(s)-poll;
+    if (idle<=0) return;
+    jtag_idle(s,idle);
+    s->polls[operation].idle+=idle;
+}
+
+/* adds a BUSY wait which took n polls to the histogram */
+static void once_poll_record(jtag_session *s, int operation, unsigned long int n) {
+    int bucket=3;
+    s->polls[operation].waits++;
+    s->polls[operation].polls+=n;
+    if (n<=3) bucket=n-1;
+    else while ((bucket<POLL_BUCKETS-1)&&(n>=(8UL<<(bucket-3)))) bucket++;
+    s->polls[operation].count[bucket]++;
+}
+
+/* waits until BUSY of the FIU at R3 is clear, in predicted mode after the idle period one poll */
+/* normally confirms the end of BUSY */
+static void once_flash_wait(jtag_session *s, int operation) {
+    unsigned long int n=0;
+    once_busy_skip(s,operation,once_predicted_time(s,FLASH_POLL_SAMPLE,0));
     do {
-        once_move_xr3_to_y0();				/* MOVE x:R3,Y0				 */
-        once_move_y0_to_xmem(0xffff);		/* MOVE Y0,<OPGDBR> 		 */
+        once_move_xr3_to_y0(s);				/* MOVE x:R3,Y0				 */
+        once_move_y0_to_xmem(s,0xffff);		/* MOVE Y0,<OPGDBR> 		 */
+        n++;
     }
-    while (once_opgdbr_read()&0x8000);	/* repeat poll while BUSY is set */
-    once_move_data_to_y0(0x4000 + (( addr >> 5) & 0x03ff));	/* MOVE #<pe>,Y0 */
-    once_move_y0_to_xr1();					/* MOVE Y0,x:R1	(FIU_PE)	 */
+    while (once_opgdbr_read(s)&0x8000);	/* repeat poll while BUSY is set */
+    once_poll_record(s,operation,n);
 }
 
-void once_flash_program_end (void) {
-    do {
-        once_move_xr3_to_y0();				/* MOVE x:R3,Y0				 */
-        once_move_y0_to_xmem(0xffff);		/* MOVE Y0,<OPGDBR> 		 */
+/* prints the number of polls of the BUSY waits, many polls per wait mean the time goes to the */
+/* flash, one poll per wait that it goes to the JTAG traffic */
+void once_poll_report(jtag_session *s) {
+    int i,j;
+    printf("BUSY waits    polls:     1     2     3   4-7  8-15 16-31   32+   avg  busy[ms] idle[ms]\n");
+    for (i=0;i<POLL_OPERATIONS;i++) {
+        if (!s->polls[i].waits) continue;
+        printf("%-20s",poll_names[i]);
+        for (j=0;j<POLL_BUCKETS;j++) printf(" %5lu",s->polls[i].count[j]);
+        printf(" %5.1f %9.1f %8.1f\n",(double)s->polls[i].polls/s->polls[i].waits,s->polls[i].busy/1000.0,s->polls[i].idle/1000.0);
     }
-    while (once_opgdbr_read()&0x8000);	/* repeat poll while BUSY is set */
-    once_move_data_to_y0(0);				/* MOVE #0,Y0				 */
-    once_move_y0_to_xr1();					/* MOVE Y0,x:R1	(FIU_PE)	 */
+}
+
+void once_flash_program_pg_no (jtag_session *s, unsigned int addr) {
+#ifdef DEBUG
+    printf("\nDBG: PG_NO: 0x%x",addr);
+#endif
+    once_flash_wait(s,POLL_ROW);
+    once_move_data_to_y0(s,0x4000 + (( addr >> 5) & 0x03ff));	/* MOVE #<pe>,Y0 */
+    once_move_y0_to_xr1(s);					/* MOVE Y0,x:R1	(FIU_PE)	 */
+}
+
+void once_flash_program_end (jtag_session *s) {
+    once_flash_wait(s,POLL_ROW);
+    once_move_data_to_y0(s,0);				/* MOVE #0,Y0				 */
+    once_move_y0_to_xr1(s);					/* MOVE Y0,x:R1	(FIU_PE)	 */
 }
 
 /* programs one word */
-void once_flash_program_1word(flash_constants flash_param, unsigned int data) {
+void once_flash_program_1word(jtag_session *s, flash_constants flash_param, unsigned int data) {
 #ifdef DEBUG
     printf("\nDBG: DATA: 0x%x",data);
 #endif
-    once_move_data_to_y1(data);				/* MOVE #<data>,Y1			 */
-    do {
-        once_move_xr3_to_y0();				/* MOVE x:R3,Y0				 */
-        once_move_y0_to_xmem(0xffff);		/* MOVE Y0,<OPGDBR> 		 */
-    }
-    while (once_opgdbr_read()&0x8000);	/* repeat poll while BUSY is set */
+    once_move_data_to_y1(s,data);				/* MOVE #<data>,Y1			 */
+    once_flash_wait(s,POLL_WORD);
     if (!(flash_param.program_memory))
     {
-        once_move_y1_to_xr0_inc();
+        once_move_y1_to_xr0_inc(s);
     }			/* MOVE Y0,x:R0	(data->x:addr)*/
     else
     {
-        once_move_y1_to_pr0_inc();
+        once_move_y1_to_pr0_inc(s);
     }			/* MOVE Y0,x:R0	(data->p:addr)*/
+    once_busy_start(s,POLL_WORD,flash_program_time(flash_param,1));
 }
 
-/* verification of one word */
-int once_flash_verify_1word(flash_constants flash_param, unsigned int data) {
-    unsigned int i;
+/* reads the word at R2 and increments R2 */
+static unsigned int once_verify_read(jtag_session *s, flash_constants flash_param) {
     if (!(flash_param.program_memory))
     {
-        once_move_xr2_inc_to_y0();
+        once_move_xr2_inc_to_y0(s);
     }			/* MOVE x:R2,Y0	(x:addr)	 */
     else
     {
-        once_move_pr2_inc_to_y0();
+        once_move_pr2_inc_to_y0(s);
     }			/* MOVE p:R2,Y0 (p:addr)	 */
-    once_move_y0_to_xmem(0xffff);				/* MOVE Y0,<OPGDBR> 			 */
-    if ((i=once_opgdbr_read())!=data) {		/* Read OPGDBR register 	 */
+    if ((s->fused_forms)&&(flash_param.program_memory)) return(once_opdbr_read(s));	/* the word passed the PDB */
+    once_move_y0_to_xmem(s,0xffff);			/* MOVE Y0,<OPGDBR> 			 */
+    return(once_opgdbr_read(s));				/* Read OPGDBR register 	 */
+}
+
+/* verification of one word */
+int once_flash_verify_1word(jtag_session *s, flash_constants flash_param, unsigned int data) {
+    unsigned int i;
+    i=once_verify_read(s,flash_param);
+    if (i!=data) {
         unsigned int addr;
-        once_move_r2_to_y0();					/* MOVE R2,Y0		 			 */
-        once_move_y0_to_xmem(0xffff);			/* MOVE Y0,<OPGDBR> 			 */
-        addr=once_opgdbr_read();
+        once_move_r2_to_y0(s);					/* MOVE R2,Y0		 			 */
+        once_move_y0_to_xmem(s,0xffff);			/* MOVE Y0,<OPGDBR> 			 */
+        addr=once_opgdbr_read(s);
         printf("Verification error at addr: %#x, wr: %#x, rd: %#x\n", addr-1, data, i);
         return(1);
     }
     return(0);
 }
 
-/* performs mass erase */
-int once_flash_mass_erase(flash_constants flash_param) {
-    once_move_data_to_r1(flash_param.interface_address);	/* MOVE #<base address>,R1  */
+/* starts a mass erase of the FIU, returns 1 if the FIU is BUSY, clobbers R0, R1, Y0 */
+static int once_mass_erase_start(jtag_session *s, flash_constants flash_param) {
+    once_move_data_to_r1(s,flash_param.interface_address);	/* MOVE #<base address>,R1  */
     if (flash_param.interface_address==0x1380) {/* see page 5-18 in the user's manual: Bflash in 807 is an exeption */
-        once_move_data_to_r0(0xf800);						/* MOVE #0xF800,R0 			*/
+        once_move_data_to_r0(s,0xf800);						/* MOVE #0xF800,R0 			*/
     } else {
-        once_move_data_to_r0(flash_param.flash_start);		/* MOVE #<address>,R0 		*/
+        once_move_data_to_r0(s,flash_param.flash_start);		/* MOVE #<address>,R0 		*/
     }
-    once_move_xr1_inc_to_y0();					/* MOVE x:R1,Y0				*/
-    once_move_y0_to_xmem(0xffff);				/* MOVE Y0,<OPGDBR> 		*/
-    if (once_opgdbr_read()&0x8000) {			/* Read OPGDBR register 	*/
+    once_move_xr1_inc_to_y0(s);					/* MOVE x:R1,Y0				*/
+    once_move_y0_to_xmem(s,0xffff);				/* MOVE Y0,<OPGDBR> 		*/
+    if (once_opgdbr_read(s)&0x8000) {			/* Read OPGDBR register 	*/
         printf("Flash mass erase failed, BUSY bit is set.\n");
         return(1);
     }
-    once_move_data_to_r1(flash_param.interface_address+2); /* MOVE #<base address+2>,R1 */
+    once_move_data_to_r1(s,flash_param.interface_address+2); /* MOVE #<base address+2>,R1 */
     if (flash_param.interface_address==0x1380) {/* see page 5-18 in the user's manual: Bflash in 807 is an exeption */
-        once_move_data_to_y0(0x4078);			/* MOVE #<ee>,Y0			*/
+        once_move_data_to_y0(s,0x4078);			/* MOVE #<ee>,Y0			*/
     } else {
-        once_move_data_to_y0(0x4000);			/* MOVE #<ee>,Y0			*/
+        once_move_data_to_y0(s,0x4000);			/* MOVE #<ee>,Y0			*/
     }
-    once_move_y0_to_xr1_inc();					/* MOVE Y0,x:R1	(FIU_EE)	*/
-    once_move_data_to_r1(flash_param.interface_address);	/* MOVE #<base address>,R1	 */
-    once_move_data_to_y0(0x0002|(info_block?0x0040:0));		/* MOVE #<cntl>,Y0			 */
-    once_move_y0_to_xr1_inc();					/* MOVE Y0,x:R1	(FIU_CNTL)*/
+    once_move_y0_to_xr1_inc(s);					/* MOVE Y0,x:R1	(FIU_EE)	*/
+    once_move_data_to_r1(s,flash_param.interface_address);	/* MOVE #<base address>,R1	 */
+    once_move_data_to_y0(s,0x0002|(s->info_block?0x0040:0));		/* MOVE #<cntl>,Y0			 */
+    once_move_y0_to_xr1_inc(s);					/* MOVE Y0,x:R1	(FIU_CNTL)*/
     if (!(flash_param.program_memory)) {
-        once_move_y0_to_xr0_inc();				/* MOVE Y0,x:R0	(write to x:addr)*/
+        once_move_y0_to_xr0_inc(s);				/* MOVE Y0,x:R0	(write to x:addr)*/
     } else {
-        once_move_y0_to_pr0_inc();				/* MOVE Y0,x:R0	(write to p:addr)*/
+        once_move_y0_to_pr0_inc(s);				/* MOVE Y0,x:R0	(write to p:addr)*/
     }
-    do {
-        once_move_data_to_r1(flash_param.interface_address);	/* MOVE #<base address>,R1  */
-        once_nop();								/* NOP						*/
-        once_move_xr1_inc_to_y0();				/* MOVE x:R1,Y0				*/
-        once_move_y0_to_xmem(0xffff);			/* MOVE Y0,<OPGDBR> 		*/
-    }
-    while (once_opgdbr_read()&0x8000);	/* repeat poll while BUSY is set */
-    once_move_data_to_r1(flash_param.interface_address+2);		/* MOVE #<base address+2>,R1 */
-    once_move_data_to_r0(flash_param.interface_address);		/* MOVE #<base address>,R0	 */
-    once_move_data_to_y0(info_block?0x0040:0);					/* MOVE #IFREN,Y0			 */
-    once_move_y0_to_xr0_inc();					/* MOVE Y0,x:R0	(FIU_CNTL)	*/
-    once_move_y0_to_xr1_inc();					/* MOVE Y0,x:R1	(FIU_EE)	*/
+    return(0);
+}
+
+/* selects page erase in FIU_CNTL, clobbers R1, Y0 */
+static void once_page_erase_cntl(jtag_session *s, unsigned int interface_address) {
+    once_move_data_to_r1(s,interface_address);						/* MOVE #<base address>,R1	*/
+    once_move_data_to_y0(s,0x0004|(s->info_block?0x0040:0));				/* MOVE #<cntl>,Y0			*/
+    once_move_y0_to_xr1_inc(s);										/* MOVE Y0,x:R1	(FIU_CNTL)	*/
+}
+
+/* starts the page erase of the page at addr, FIU_CNTL must select page erase, returns 1 if the FIU is BUSY */
+/* clobbers R0, R1, Y0 */
+static int once_page_erase_start(jtag_session *s, flash_constants flash_param, unsigned int addr) {
+    once_move_data_to_r1(s,flash_param.interface_address);	/* MOVE #<base address>,R1	*/
+    once_move_data_to_r0(s,addr);								/* MOVE #<address>,R0		*/
+    once_move_xr1_inc_to_y0(s);								/* MOVE x:R1,Y0				*/
+    once_move_y0_to_xmem(s,0xffff);							/* MOVE Y0,<OPGDBR>			*/
+    if (once_opgdbr_read(s)&0x8000) {						/* Read OPGDBR register		*/
+        printf("Flash page erase failed, BUSY bit is set.\n");
+        return(1);
+    }
+    once_move_data_to_r1(s,flash_param.interface_address+2);	/* MOVE #<base address+2>,R1 */
+    once_move_data_to_y0(s,0x4000|((addr/256)&0x007F));		/* MOVE #<ee>,Y0			*/
+    once_move_y0_to_xr1_inc(s);								/* MOVE Y0,x:R1	(FIU_EE)	*/
+    if (!(flash_param.program_memory)) {
+        once_move_y0_to_xr0_inc(s);							/* MOVE Y0,x:R0	(write to x:addr) */
+    } else {
+        once_move_y0_to_pr0_inc(s);							/* MOVE Y0,p:R0	(write to p:addr) */
+    }
+    return(0);
+}
+
+/* one BUSY poll of an erase, returns the BUSY bit of the FIU, clobbers R1, Y0 */
+/* R1 is not incremented, so the shadow drops the load of R1 from the second poll on */
+static unsigned int once_erase_busy(jtag_session *s, unsigned int interface_address) {
+    once_move_data_to_r1(s,interface_address);	/* MOVE #<base address>,R1  */
+    once_nop(s);									/* NOP						*/
+    once_move_xr1_to_y0(s);						/* MOVE x:R1,Y0				*/
+    once_move_y0_to_xmem(s,0xffff);				/* MOVE Y0,<OPGDBR> 		*/
+    return(once_opgdbr_read(s)&0x8000);			/* Read OPGDBR register 	*/
+}
+
+/* waits until BUSY of the erasing FIU is clear, like once_flash_wait */
+static void once_erase_wait(jtag_session *s, unsigned int interface_address, int operation) {
+    unsigned long int n=0;
+    once_busy_skip(s,operation,once_predicted_time(s,ERASE_POLL_SAMPLE,0));
+    do n++;
+    while (once_erase_busy(s,interface_address));	/* repeat poll while BUSY is set */
+    once_poll_record(s,operation,n);
+}
+
+/* clears FIU_CNTL (except IFREN) and FIU_EE after an erase, clobbers R0, R1, Y0 */
+static void once_erase_end(jtag_session *s, unsigned int interface_address) {
+    once_move_data_to_r1(s,interface_address+2);		/* MOVE #<base address+2>,R1 */
+    once_move_data_to_r0(s,interface_address);		/* MOVE #<base address>,R0	 */
+    once_move_data_to_y0(s,s->info_block?0x0040:0);		/* MOVE #IFREN,Y0			 */
+    once_move_y0_to_xr0_inc(s);						/* MOVE Y0,x:R0	(FIU_CNTL)	*/
+    once_move_y0_to_xr1_inc(s);						/* MOVE Y0,x:R1	(FIU_EE)	*/
+}
+
+/* performs mass erase */
+int once_flash_mass_erase(jtag_session *s, flash_constants flash_param) {
+    if (once_mass_erase_start(s,flash_param)) return(1);
+    once_busy_start(s,POLL_MASS,flash_erase_time(flash_param,1));
+    once_erase_wait(s,flash_param.interface_address,POLL_MASS);
+    once_erase_end(s,flash_param.interface_address);
     printf("Flash (%#x) mass erase done.\n", flash_param.interface_address);
     return(0);
 }
 
 /* performs all page erases needed for programming  */
-int once_flash_page_erase(flash_constants flash_param) {
+int once_flash_page_erase(jtag_session *s, flash_constants flash_param) {
     int page_number,addr,count=0;
     addr=flash_param.start_addr;
     page_number=flash_param.start_addr/256;							/* pages are 256 words long */
-    once_move_data_to_r1(flash_param.interface_address);			/* MOVE #<base address>,R1	*/
-    once_move_data_to_y0(0x0004|(info_block?0x0040:0));				/* MOVE #<cntl>,Y0			*/
-    once_move_y0_to_xr1_inc();										/* MOVE Y0,x:R1	(FIU_CNTL)	*/
+    once_page_erase_cntl(s,flash_param.interface_address);
     while (page_number*256<=flash_param.flash_end) {
         if ((flash_param.page_erase_map[(addr-flash_param.flash_start)/256]&2)&&(!(flash_param.page_erase_map[(addr-flash_param.flash_start)/256]&1))) {	/* bit 0 says whether the page was already erased, bit 1 says whether to erase the page or not */
             /* now perform page erase of page "page_number" */
             count++;
             flash_param.page_erase_map[(addr-flash_param.flash_start)/256]|=1;		/* mark the page as erased */
-            once_move_data_to_r1(flash_param.interface_address);	/* MOVE #<base address>,R1	*/
-            once_move_data_to_r0(addr);								/* MOVE #<address>,R0		*/
-            once_move_xr1_inc_to_y0();								/* MOVE x:R1,Y0				*/
-            once_move_y0_to_xmem(0xffff);							/* MOVE Y0,<OPGDBR>			*/
-            if (once_opgdbr_read()&0x8000) {						/* Read OPGDBR register		*/
-                printf("Flash page erase failed, BUSY bit is set.\n");
-                return(1);
-            }
-            once_move_data_to_r1(flash_param.interface_address+2);	/* MOVE #<base address+2>,R1 */
-            once_move_data_to_y0(0x4000|(page_number&0x007F));		/* MOVE #<ee>,Y0			*/
-            once_move_y0_to_xr1_inc();								/* MOVE Y0,x:R1	(FIU_EE)	*/
-            if (!(flash_param.program_memory)) {
-                once_move_y0_to_xr0_inc();							/* MOVE Y0,x:R0	(write to x:addr) */
-            } else {
-                once_move_y0_to_pr0_inc();							/* MOVE Y0,p:R0	(write to p:addr) */
-            }
-            do {
-                once_move_data_to_r1(flash_param.interface_address); /* MOVE #<base address>,R1	*/
-                once_nop();											/* NOP						*/
-                once_move_xr1_inc_to_y0();							/* MOVE x:R1,Y0				*/
-                once_move_y0_to_xmem(0xffff);						/* MOVE Y0,<OPGDBR>			*/
-            } while (once_opgdbr_read()&0x8000);					/* repeat poll while BUSY is set */
+            if (once_page_erase_start(s,flash_param,addr)) return(1);
+            once_busy_start(s,POLL_PAGE,flash_erase_time(flash_param,0));
+            once_erase_wait(s,flash_param.interface_address,POLL_PAGE);
         } else {
             if (flash_param.page_erase_map[(addr-flash_param.flash_start)/256]&3) printf("Page erase of page #%d skipped (flash %#x)\n",page_number,flash_param.interface_address);
         }
         addr+=256;													/* advance to next page */
         page_number++;
     }
-    once_move_data_to_r1(flash_param.interface_address+2);		/* MOVE #<base address+2>,R1 */
-    once_move_data_to_r0(flash_param.interface_address);		/* MOVE #<base address>,R0	*/
-    once_move_data_to_y0(info_block?0x0040:0);					/* MOVE #0,Y0				*/
-    once_move_y0_to_xr0_inc();									/* MOVE Y0,x:R0	(FIU_CNTL)	*/
-    once_move_y0_to_xr1_inc();									/* MOVE Y0,x:R1	(FIU_EE)	*/
+    once_erase_end(s,flash_param.interface_address);
     printf("Flash (%#x) page erase done, %d page(s) erased.\n", flash_param.interface_address,count);
     return(0);
 }
 
-/* program flash */
-int once_flash_program(flash_constants flash_param) {
-    unsigned int i,j;
-    unsigned int *data;
-    once_init_flash_iface(flash_param);
-    if (!page_erase) {
+/* advances the job to the next requested page which is not erased yet, in this or a later block */
+/* of the same FIU, the same pages as once_flash_page_erase, returns 0 if there is none */
+static int erase_job_next(erase_job *job, flash_constants flash_param[], int flash_count) {
+    flash_constants *block;
+    while (job->block<flash_count) {
+        block=&(flash_param[job->block]);
+        if (block->interface_address==job->plan->interface_address) {
+            for (;(job->addr/256)*256<=block->flash_end;job->addr+=256) {
+                if ((block->page_erase_map[(job->addr-block->flash_start)/256]&3)==2) return(1);
+            }
+        }
+        if (++job->block<flash_count) job->addr=flash_param[job->block].start_addr;
+    }
+    return(0);
+}
+
+/* starts the next erase of the job, returns 1 on error */
+static int erase_job_start(jtag_session *s, erase_job *job, flash_constants flash_param[]) {
+    flash_constants *block=&(flash_param[job->block]);
+    if (job->plan->strategy==ERASE_MASS) {
+        job->block=MAX_FLASH_UNITS;				/* nothing left after the mass erase */
+        return(once_mass_erase_start(s,*block));
+    }
+    block->page_erase_map[(job->addr-block->flash_start)/256]|=1;	/* mark the page as erased */
+    job->pages++;
+    if (once_page_erase_start(s,*block,job->addr)) return(1);
+    job->addr+=256;
+    return(0);
+}
+
+#define ERASE_START_CLOBBERS	(REG_R0|REG_R1|REG_Y0)	/* once_mass_erase_start, once_page_erase_start, once_page_erase_cntl */
+#define ERASE_POLL_CLOBBERS		(REG_R1|REG_Y0)			/* once_erase_busy */
+#define ERASE_END_CLOBBERS		(REG_R0|REG_R1|REG_Y0)	/* once_erase_end */
+
+
+/* advances the erase running in the background by one BUSY poll, when the FIU is no longer BUSY */
+/* the next page is started or the erase is finished, returns the registers clobbered (REG_xx) */
+/* the job keeps its state on the host, so any register may be changed between two calls */
+static unsigned int once_background_service(jtag_session *s) {
+    if (!s->background_active) return(0);
+    if (once_erase_busy(s,s->background.plan->interface_address)) return(ERASE_POLL_CLOBBERS);
+    if ((s->background.plan->strategy==ERASE_PAGE)&&(erase_job_next(&s->background,s->background_blocks,s->background_count))) {
+        if (erase_job_start(s,&s->background,s->background_blocks)) {
+            s->background_active=0;
+            s->background_error=1;
+        }
+        return(ERASE_POLL_CLOBBERS|ERASE_START_CLOBBERS);
+    }
+    once_erase_end(s,s->background.plan->interface_address);
+    s->background_active=0;
+    s->background.plan->done=1;
+    s->background.plan->actual=jtag_time(s)-s->background_start;
+    return(ERASE_POLL_CLOBBERS|ERASE_END_CLOBBERS);
+}
+
+/* services the background erase at the start of a flash row, the registers the programming */
+/* routines keep from word to word (R0 = next address, R1 = FIU_PE, R3 = FIU_CNTL) are set again */
+/* if the erase clobbered them, Y0 and Y1 are loaded for every word anyway */
+static void once_program_service(jtag_session *s, flash_constants flash_param, unsigned int addr) {
+    unsigned int clobbered=once_background_service(s);
+    if (clobbered&REG_R0) {
+        once_move_data_to_r0(s,addr);			/* MOVE #<address>,R0		 */
+    }
+    if (clobbered&REG_R1) {
+        once_move_data_to_r1(s,flash_param.interface_address+1);	/* MOVE #<fiu_address+1>,R1  */
+    }
+    if (clobbered&REG_R3) {
+        once_move_data_to_r3(s,flash_param.interface_address);	/* MOVE #<fiu_address>,R3	 */
+    }
+}
+
+/* OnCE instruction words of the erase routines above, each also reads OPGDBR once before the erase */
+#define MASS_ERASE_WORDS		26		/* once_flash_mass_erase without the BUSY polls */
+#define PAGE_ERASE_WORDS		13		/* once_flash_page_erase without the pages */
+#define PAGE_ERASE_PAGE_WORDS	15		/* every erased page without the BUSY polls */
+
+char *erase_names[]={"mass erase","page erase","no erase"};
+
+/* time until a BUSY poll of the given duration sees the end of busy (one poll after it in predicted mode) */
+static double once_polled_time(jtag_session *s, double busy, double poll) {
+    if (s->busy_predict) return(busy+poll);
+    return(((unsigned long int)(busy/poll)+1)*poll);
+}
+
+/* counts the pages of the block once_flash_page_erase would erase, the pages already */
+/* counted for another block of the same FIU (same page_erase_map) are marked in counted[] */
+static unsigned int flash_requested_pages(flash_constants flash_param, unsigned char *counted) {
+    unsigned int addr,page,count=0;
+    for (addr=flash_param.start_addr;(addr/256)*256<=flash_param.flash_end;addr+=256) {
+        page=(addr-flash_param.flash_start)/256;
+        if (((flash_param.page_erase_map[page]&3)==2)&&(!counted[page])) {
+            counted[page]=1;
+            count++;
+        }
+    }
+    return(count);
+}
+
+/* plans the erase of every FIU from the pages requested by the S-records and the FIU timing: */
+/* no erase if no page is requested, otherwise mass or page erase, whichever is predicted to be faster */
+/* (the page erase on a tie), the prediction includes the OnCE instructions and the BUSY polls */
+/* without the planner the concurrent and the overlapped erase get plans with the mode of set_erase_mode */
+void once_erase_plan(jtag_session *s, flash_constants flash_param[], int flash_count) {
+    int i,j,k;
+    unsigned int n;
+    unsigned char counted[MAX_PAGE_COUNT];
+    double poll;
+    erase_plan *plan;
+    s->erase_plan_count=0;
+    if (((!s->erase_planner)&&(!s->erase_concurrent)&&(!s->erase_overlap))||(s->diff_mode)) return;
+    poll=once_predicted_time(s,ERASE_POLL_WORDS,1);
+    for (i=0;i<flash_count;i++) {
+        if (flash_param[i].duplicate) continue;		/* planned with the first block of the FIU */
+        plan=&(s->erase_plans[s->erase_plan_count++]);
+        plan->interface_address=flash_param[i].interface_address;
+        plan->pages=0;
+        plan->actual=0;
+        plan->done=0;
+        plan->mass_time=once_predicted_time(s,MASS_ERASE_WORDS,1)+once_polled_time(s,flash_erase_time(flash_param[i],1),poll);
+        plan->page_time=0;
+        for (k=0;k<MAX_PAGE_COUNT;k++) counted[k]=0;
+        for (j=i;j<flash_count;j++) {
+            if (flash_param[j].interface_address!=plan->interface_address) continue;
+            n=flash_requested_pages(flash_param[j],counted);
+            plan->pages+=n;
+            plan->page_time+=once_predicted_time(s,PAGE_ERASE_WORDS,0)
+                    +n*(once_predicted_time(s,PAGE_ERASE_PAGE_WORDS,1)+once_polled_time(s,flash_erase_time(flash_param[j],0),poll));
+        }
+        if (!s->erase_planner) plan->strategy=s->page_erase?ERASE_PAGE:ERASE_MASS;
+        else if (!plan->pages) plan->strategy=ERASE_SKIP;
+        else if (plan->page_time<=plan->mass_time) plan->strategy=ERASE_PAGE;
+        else plan->strategy=ERASE_MASS;
+    }
+    if (!s->erase_planner) return;
+    printf("Erase plan:\n%-8s %6s %10s %10s  %s\n","FIU","pages","mass [ms]","page [ms]","plan");
+    for (i=0;i<s->erase_plan_count;i++) {
+        plan=&(s->erase_plans[i]);
+        printf("%#-8x %6u %10.1f %10.1f  %s\n",plan->interface_address,plan->pages,
+               plan->mass_time/1000,plan->page_time/1000,erase_names[plan->strategy]);
+    }
+}
+
+/* prints the predicted and the measured time of every planned erase */
+void once_erase_report(jtag_session *s) {
+    int i;
+    double predicted;
+    erase_plan *plan;
+    for (i=0;i<s->erase_plan_count;i++) {
+        plan=&(s->erase_plans[i]);
+        predicted=(plan->strategy==ERASE_MASS)?plan->mass_time:((plan->strategy==ERASE_PAGE)?plan->page_time:0);
+        printf("Flash (%#x) %s: predicted %.1f ms, took %.1f ms\n",plan->interface_address,
+               erase_names[plan->strategy],predicted/1000,plan->actual/1000);
+    }
+}
+
+/* returns the plan of the FIU, NULL if there is none */
+static erase_plan *once_find_plan(jtag_session *s, unsigned int interface_address) {
+    int i;
+    for (i=0;i<s->erase_plan_count;i++) {
+        if (s->erase_plans[i].interface_address==interface_address) return(&(s->erase_plans[i]));
+    }
+    return(NULL);
+}
+
+/* erases the block as planned by once_erase_plan, the time taken is added to the plan */
+static int once_flash_erase_planned(jtag_session *s, flash_constants flash_param, erase_plan *plan) {
+    int result=0;
+    double start;
+    if (plan->done) {
+        printf("Flash (%#x) already erased.\n",flash_param.interface_address);
+        return(0);
+    }
+    start=jtag_time(s);
+    switch (plan->strategy) {
+    case ERASE_MASS:
         if (flash_param.duplicate) printf("Mass erase skipped.\n");
-        else {
-            j = once_flash_mass_erase(flash_param);
-            if (j) return(j);
+        else result=once_flash_mass_erase(s,flash_param);
+        break;
+    case ERASE_PAGE:
+        result=once_flash_page_erase(s,flash_param);
+        break;
+    default:
+        printf("Flash (%#x) erase skipped, no page requested.\n",flash_param.interface_address);
+        break;
+    }
+    plan->actual+=jtag_time(s)-start;
+    return(result);
+}
+
+/* flash routine, loaded to STUB_P_ADDR */
+/* R0 = flash address, R1 = FIU_PE, R2 = staged row (x:STUB_X_BUFFER), R3 = FIU_CNTL, Y0 = word count */
+/* the staged row starts with the FIU_PE value followed by the data words */
+/* the routine returns to debug mode as soon as the last word is handed to the FIU, the next call */
+/* waits for it, so the host stages the next row while the FIU programs the last word */
+/* R0 is left at the next flash address */
+unsigned int flash_stub[]= {
+    STUB_BRSET_XRN|3, 0x8000,		/* BRSET #$8000,x:(R3),*	(wait for the previous row) */
+    0xf302,							/* MOVE x:(R2)+,Y1				*/
+    0xd315,							/* MOVE Y1,x:(R1)	(FIU_PE)	*/
+    STUB_DO_Y0, STUB_P_ADDR+9,		/* DO Y0,loop_end				*/
+    STUB_BRSET_XRN|3, 0x8000,		/* BRSET #$8000,x:(R3),*	(wait while BUSY) */
+    0xf302,							/* MOVE x:(R2)+,Y1				*/
+    0xe300,							/* loop_end: MOVE Y1,p:(R0)+	(or MOVE Y1,x:(R0)+) */
+    STUB_DEBUG						/* DEBUG						*/
+};
+
+#define FLASH_STUB_STORE	9		/* index of the instruction writing the flash */
+
+/* writes a routine to STUB_P_ADDR, the word at index patch is replaced by value */
+static void once_routine_load(jtag_session *s, unsigned int *code, unsigned int words, unsigned int patch, unsigned int value) {
+    unsigned int i;
+    once_move_data_to_r0(s,STUB_P_ADDR);			/* MOVE #STUB_P_ADDR,R0		*/
+    for (i=0;i<words;i++) {
+        once_move_data_to_y0(s,(i==patch)?value:code[i]);
+        once_move_y0_to_pr0_inc(s);				/* MOVE Y0,p:(R0)+			*/
+    }
+}
+
+/* waits for a routine started by once_jmp_run to return to debug mode, returns 1 on timeout */
+static int once_routine_wait(jtag_session *s) {
+    int retry=RETRY_STUB;
+    while (jtag_instruction_exec(s,0x6)!=0xd) {	/* Enable OnCE, returns 0xd in debug mode */
+        if (!(retry--)) {
+            jtag_instruction_exec(s,0x7);			/* Debug Request */
+            jtag_instruction_exec(s,0x6);			/* Enable OnCE */
+            return(1);
         }
-    } else {
-        j = once_flash_page_erase(flash_param);
-        if (j) return(j);
     }
+    return(0);
+}
+
+/* loads the flash routine for programming p: (program_memory!=0) or x: flash */
+void once_stub_load(jtag_session *s, unsigned int program_memory) {
+    once_routine_load(s,flash_stub,sizeof(flash_stub)/sizeof(flash_stub[0]),FLASH_STUB_STORE,program_memory?0xe300:0xd300);
+}
+
+/* programs data_count words from start_addr with the flash routine (once_stub_load) */
+/* the host stages the words of one row in data RAM and starts the routine, the BUSY polling */
+/* and the address increments are done by the target; staging still costs six OnCE scans per */
+/* word (MOVE #,Y0 and MOVE Y0,x:(R2)+) as the OnCE has no data register the core can read */
+/* in pipelined mode the programming time of the row is predicted from the FIU timing */
+/* and queued as idle time, so staging, start and the status poll normally take one USB round trip */
+int once_flash_program_stub(jtag_session *s, flash_constants flash_param) {
+    unsigned int i,k,n,addr;
+    unsigned int *data;
+    addr=flash_param.start_addr;
+    data=flash_param.data+(flash_param.start_addr-flash_param.flash_start);
+    once_move_data_to_r0(s,addr);					/* MOVE #<address>,R0		 */
+    once_move_data_to_r1(s,flash_param.interface_address+1);	/* MOVE #<fiu_address+1>,R1  */
+    once_move_data_to_r3(s,flash_param.interface_address);	/* MOVE #<fiu_address>,R3	 */
+    for (i=0;i<flash_param.data_count;i+=n) {
+        n=STUB_ROW-(addr%STUB_ROW);				/* up to the end of the row */
+        if (n>flash_param.data_count-i) n=flash_param.data_count-i;
+        if ((i%512)<n) printf("p");
+        once_program_service(s,flash_param,addr);	/* erase of the next block (R0 is left at addr by the routine) */
+        once_move_data_to_r2(s,STUB_X_BUFFER);	/* MOVE #STUB_X_BUFFER,R2	 */
+        once_move_data_to_y0(s,0x4000 + ((addr >> 5) & 0x03ff));	/* MOVE #<pe>,Y0 */
+        once_move_y0_to_xr2_inc(s);				/* MOVE Y0,x:(R2)+			 */
+        for (k=0;k<n;k++) {
+            once_move_data_to_y0(s,*(data++));	/* MOVE #<data>,Y0			 */
+            once_move_y0_to_xr2_inc(s);			/* MOVE Y0,x:(R2)+			 */
+        }
+        once_move_data_to_r2(s,STUB_X_BUFFER);	/* MOVE #STUB_X_BUFFER,R2	 */
+        once_move_data_to_y0(s,n);				/* MOVE #<count>,Y0			 */
+        once_jmp_run(s,STUB_P_ADDR);				/* start the routine		 */
+        if (s->pipeline) jtag_idle(s,flash_program_time(flash_param,n));
+        if (once_routine_wait(s)) {
+            printf("\nFlash routine did not return at address %#x\n",addr);
+            return(1);
+        }
+        addr+=n;
+    }
+    once_move_data_to_r2(s,flash_param.start_addr);	/* MOVE #<address>,R2, for verification */
+    return(0);
+}
+
+/* returns the BUSY bit of the FIU at R3 */
+static unsigned int once_flash_busy(jtag_session *s) {
+    once_move_xr3_to_y0(s);						/* MOVE x:R3,Y0				 */
+    once_move_y0_to_xmem(s,0xffff);				/* MOVE Y0,<OPGDBR> 		 */
+    return(once_opgdbr_read(s)&0x8000);
+}
+
+/* programs data_count words from start_addr without polling BUSY for every word */
+/* the next word is staged in Y1 while the FIU programs the previous one and the end of BUSY */
+/* is predicted from the FIU timing, BUSY is only polled at the start of a row (FIU_PE) */
+/* the first word of every row checks the prediction with a poll, it is doubled when BUSY is */
+/* still set, so an IPBus clock slower than FIU_IPBUS_CLOCK costs at most the rest of the row */
+int once_flash_program_pipelined(jtag_session *s, flash_constants flash_param) {
+    unsigned int i,j;
+    unsigned int *data;
+    double busy,stored=0;
+    int calibrated=0;
     j=flash_param.start_addr;
     data=flash_param.data+(flash_param.start_addr-flash_param.flash_start);
-    once_flash_program_prepare (flash_param.interface_address, j);
-    once_flash_program_pg_no(j);
+    busy=flash_program_time(flash_param,1);
     for (i=0;i<flash_param.data_count;i++) {
-        if (!(j%32)) once_flash_program_pg_no(j);
         if (!(i%512)) printf("p");
-        once_flash_program_1word(flash_param, *(data++));
+        if (!(j%32)) once_program_service(s,flash_param,j);	/* erase of the next block */
+        once_move_data_to_y1(s,*(data++));		/* MOVE #<data>,Y1, while the FIU programs the previous word */
+        if ((!i)||(!(j%32))) once_flash_program_pg_no(s,j);	/* FIU_PE is only changed when BUSY is clear */
+        else jtag_idle(s,busy-(jtag_queued_time(s)-stored));	/* rest of the previous word */
+        if (!(flash_param.program_memory)) {
+            once_move_y1_to_xr0_inc(s);			/* MOVE Y1,x:R0+	(data->x:addr) */
+        } else {
+            once_move_y1_to_pr0_inc(s);			/* MOVE Y1,p:R0+	(data->p:addr) */
+        }
+        stored=jtag_queued_time(s);
+        if ((!calibrated)||(!(j%32))) {			/* until the prediction holds, then once per row */
+            jtag_idle(s,busy);
+            if (once_flash_busy(s)) {
+                if (busy<PIPE_BUSY_MAX) busy*=2;
+                while (once_flash_busy(s));
+            } else calibrated=1;
+        }
         j++;
     }
-    printf("\n");
+    return(0);
+}
+
+/* programs one run of data_count words from start_addr, word by word or with the flash routine */
+/* leaves R2 at start_addr for the verification */
+static int once_flash_program_run(jtag_session *s, flash_constants flash_param) {
+    unsigned int i,j;
+    unsigned int *data;
+    j=flash_param.start_addr;
     data=flash_param.data+(flash_param.start_addr-flash_param.flash_start);
-    once_flash_program_end();
+    once_flash_program_prepare (s,flash_param.interface_address, j);
+    if (s->stub_mode) return(once_flash_program_stub(s,flash_param));
+    if (s->pipeline) return(once_flash_program_pipelined(s,flash_param));
+    once_flash_program_pg_no(s,j);
     for (i=0;i<flash_param.data_count;i++) {
-        if (once_flash_verify_1word(flash_param, *(data++))) return(1);
-        if (!(i%512)) printf("v");
+        if (!(j%32)) {
+            once_program_service(s,flash_param,j);	/* erase of the next block */
+            once_flash_program_pg_no(s,j);
+        }
+        if (!(i%512)) printf("p");
+        once_flash_program_1word(s,flash_param, *(data++));
+        j++;
+    }
+    return(0);
+}
+
+/* programs data_count words from start_addr, word by word or with the flash routine */
+/* runs of at least sparse_gap erased words (0xffff) are skipped, R0 is set again for each run */
+int once_flash_program_data(jtag_session *s, flash_constants flash_param) {
+    unsigned int n,addr,first,end;
+    unsigned long int scans=s->jtag_stats.dr_scans,words=0;
+    flash_constants part=flash_param;
+    if (s->stub_mode) once_stub_load(s,flash_param.program_memory);
+    end=flash_param.start_addr+flash_param.data_count;
+    for (addr=flash_param.start_addr;(n=flash_next_run(flash_param,addr,end,s->sparse_gap,&first))!=0;addr=first+n) {
+        part.start_addr=first;
+        part.data_count=n;
+        if (once_flash_program_run(s,part)) return(1);
+        words+=n;
+    }
+    once_scan_account(s,SCAN_PROGRAM,scans,words);
+    return(0);
+}
+
+/* verification routine, loaded to STUB_P_ADDR */
+/* R0 = flash address, R2 = result (x:STUB_X_BUFFER), Y0 = word count */
+/* stores the checksum of flash_checksum(), A1 first, then B1 */
+unsigned int checksum_stub[]= {
+    STUB_CLR_A,						/* CLR A						*/
+    STUB_CLR_B,						/* CLR B						*/
+    STUB_DO_Y0, STUB_P_ADDR+6,		/* DO Y0,loop_end				*/
+    0xe320,							/* MOVE p:(R0)+,Y1	(or MOVE x:(R0)+,Y1) */
+    STUB_ADD_Y1_A,					/* ADD Y1,A						*/
+    STUB_ADD_A_B,					/* loop_end: ADD A,B			*/
+    STUB_MOVE_A1_XRN|2,				/* MOVE A1,x:(R2)+				*/
+    STUB_MOVE_B1_XRN|2,				/* MOVE B1,x:(R2)+				*/
+    STUB_DEBUG						/* DEBUG						*/
+};
+
+#define CHECKSUM_STUB_LOAD	4		/* index of the instruction reading the flash */
+
+/* loads the verification routine for p: (program_memory!=0) or x: flash */
+void once_checksum_load(jtag_session *s, unsigned int program_memory) {
+    once_routine_load(s,checksum_stub,sizeof(checksum_stub)/sizeof(checksum_stub[0]),CHECKSUM_STUB_LOAD,program_memory?0xe320:0xf300);
+}
+
+/* runs the verification routine (once_checksum_load) over count words from addr */
+/* returns 1 if the routine does not return, otherwise 0 and the checksum in *sum */
+int once_flash_checksum(jtag_session *s, unsigned int addr, unsigned int count, unsigned long int *sum) {
+    once_move_data_to_r0(s,addr);					/* MOVE #<address>,R0		 */
+    once_move_data_to_r2(s,STUB_X_BUFFER);		/* MOVE #STUB_X_BUFFER,R2	 */
+    once_move_data_to_y0(s,count);				/* MOVE #<count>,Y0			 */
+    once_jmp_run(s,STUB_P_ADDR);					/* start the routine		 */
+    if (once_routine_wait(s)) return(1);
+    once_move_xmem_to_y0(s,STUB_X_BUFFER);		/* MOVE x:STUB_X_BUFFER,Y0	 */
+    once_move_y0_to_xmem(s,0xffff);				/* MOVE Y0,<OPGDBR> 		 */
+    *sum=once_opgdbr_read(s);
+    once_move_xmem_to_y0(s,STUB_X_BUFFER+1);		/* MOVE x:STUB_X_BUFFER+1,Y0 */
+    once_move_y0_to_xmem(s,0xffff);				/* MOVE Y0,<OPGDBR> 		 */
+    *sum|=(unsigned long int)once_opgdbr_read(s)<<16;
+    return(0);
+}
+
+/* verifies data_count words from start_addr by checksums of up to CHECKSUM_WORDS words (one page) */
+/* the verification routine must be loaded (once_checksum_load) */
+/* computed on the target, only the pages with a wrong checksum are read back word by word */
+/* with readback the first page is read back as well, a checksum which disagrees with a page */
+/* that reads back correctly means the routine cannot be trusted, the rest is read back too */
+int once_flash_verify_checksum(jtag_session *s, flash_constants flash_param, int readback) {
+    unsigned int i,k,n,addr,errors=0;
+    unsigned int *data;
+    unsigned long int sum=0;
+    int check=1;
+    addr=flash_param.start_addr;
+    data=flash_param.data+(flash_param.start_addr-flash_param.flash_start);
+    for (i=0;i<flash_param.data_count;i+=n,addr+=n,data+=n) {
+        n=CHECKSUM_WORDS-(addr%CHECKSUM_WORDS);	/* up to the end of the page */
+        if (n>flash_param.data_count-i) n=flash_param.data_count-i;
+        if ((i%512)<n) printf("v");
+        if (check) {
+            if (once_flash_checksum(s,addr,n,&sum)) {
+                printf("\nVerification routine did not return at address %#x\n",addr);
+                return(1);
+            }
+            if ((sum==flash_checksum(data,n))&&(!readback)) continue;
+        }
+        once_move_data_to_r2(s,addr);			/* MOVE #<address>,R2, read the page back */
+        for (k=0;k<n;k++) {
+            if (once_flash_verify_1word(s,flash_param, data[k])) break;
+        }
+        if (k<n) errors++;
+        else if ((check)&&(sum!=flash_checksum(data,n))) {
+            printf("\nChecksum mismatch at %#x, but the words read back correctly, verifying word by word\n",addr);
+            check=0;
+        }
+        readback=0;
+    }
+    return(errors?1:0);
+}
+
+/* verifies data_count words from start_addr, word by word or by checksums */
+/* the runs skipped by once_flash_program_data are skipped here as well */
+int once_flash_verify(jtag_session *s, flash_constants flash_param) {
+    unsigned int i,n,addr,first,end;
+    unsigned int *data;
+    unsigned long int scans=s->jtag_stats.dr_scans,words=0;
+    int readback=1;
+    if (s->verify_mode) once_checksum_load(s,flash_param.program_memory);
+    end=flash_param.start_addr+flash_param.data_count;
+    for (addr=flash_param.start_addr;(n=flash_next_run(flash_param,addr,end,s->sparse_gap,&first))!=0;addr=first+n) {
+        flash_param.start_addr=first;
+        flash_param.data_count=n;
+        if (s->verify_mode) {
+            if (once_flash_verify_checksum(s,flash_param,readback)) return(1);
+            readback=0;							/* one page per block is read back */
+            continue;
+        }
+        once_move_data_to_r2(s,first);			/* MOVE #<address>,R2		 */
+        data=flash_param.data+(first-flash_param.flash_start);
+        for (i=0;i<n;i++) {
+            if (once_flash_verify_1word(s,flash_param, *(data++))) return(1);
+            if (!(i%512)) printf("v");
+        }
+        words+=n;
+    }
+    once_scan_account(s,SCAN_VERIFY,scans,words);
+    return(0);
+}
+
+/* reads count words from addr back word by word, returns 1 if any of them differs from data */
+static int once_flash_compare(jtag_session *s, flash_constants flash_param, unsigned int addr, unsigned int count, unsigned int *data) {
+    unsigned int k;
+    int differ=0;
+    once_move_data_to_r2(s,addr);				/* MOVE #<address>,R2		 */
+    for (k=0;k<count;k++) if (once_verify_read(s,flash_param)!=data[k]) differ=1;
+    return(differ);
+}
+
+/* differential programming, the requested pages whose checksum on the target matches the image */
+/* lose their erase request, only the other pages are erased, programmed and verified */
+/* the first matching page is read back word by word before any erase is skipped, if it differs */
+/* from the image the checksums cannot be trusted and all requested pages are erased */
+int once_flash_program_diff(jtag_session *s, flash_constants flash_param) {
+    unsigned int addr,next,first,last,page,requested=0,changed=0,words=0;
+    unsigned int *map=flash_param.page_erase_map;
+    unsigned int *data;
+    unsigned long int sum;
+    int checked=0,trusted=1;
+    flash_constants part=flash_param;
+    once_checksum_load(s,flash_param.program_memory);
+    for (addr=flash_param.flash_start;addr<=flash_param.flash_end;addr=next) {
+        page=(addr-flash_param.flash_start)/256;	/* pages are 256 words long */
+        next=addr+256;
+        if (next>flash_param.flash_end+1) next=flash_param.flash_end+1;
+        if ((map[page]&3)!=2) continue;			/* not requested or already erased */
+        requested++;
+        if (!trusted) {
+            changed++;
+            continue;
+        }
+        if (once_flash_checksum(s,addr,next-addr,&sum)) {
+            printf("Checksum routine did not return at address %#x\n",addr);
+            return(1);
+        }
+        data=flash_param.data+(addr-flash_param.flash_start);
+        if (sum!=flash_checksum(data,next-addr)) {
+            changed++;
+            continue;
+        }
+        if ((!checked)&&(once_flash_compare(s,flash_param,addr,next-addr,data))) {
+            printf("Flash (%#x): the page at %#x matches its checksum but not its read back, no erase is skipped.\n",flash_param.interface_address,addr);
+            trusted=0;
+            changed++;
+            continue;
+        }
+        checked=1;
+        map[page]&=~2;
+    }
+    printf("Flash (%#x): %d of %d page(s) differ from the image.\n",flash_param.interface_address,changed,requested);
+    if (!changed) return(0);
+    if (once_flash_page_erase(s,flash_param)) return(1);
+    for (addr=flash_param.flash_start;addr<=flash_param.flash_end;addr=next) {
+        page=(addr-flash_param.flash_start)/256;
+        next=addr+256;
+        if (next>flash_param.flash_end+1) next=flash_param.flash_end+1;
+        if (!(map[page]&2)) continue;
+        first=(addr>flash_param.start_addr)?addr:flash_param.start_addr;	/* without the leading and trailing 0xffff words */
+        last=(next<flash_param.start_addr+flash_param.data_count)?next:flash_param.start_addr+flash_param.data_count;
+        if (last<=first) continue;				/* erasing was enough */
+        part.start_addr=first;
+        part.data_count=last-first;
+        if (once_flash_program_data(s,part)) return(1);
+        once_flash_program_end(s);
+        if (once_flash_verify(s,part)) return(1);
+        words+=part.data_count;
+    }
+    printf("\nFlash (%#x) programming done. %#x words written.\n", flash_param.interface_address, words);
+    return(0);
+}
+
+/* erases all FIUs at the same time as planned by once_erase_plan (only in concurrent mode) */
+/* the erase is started on every FIU, then the BUSY bits are polled round-robin and the next page */
+/* of a FIU is started as soon as it is no longer BUSY, so the time is that of the slowest FIU */
+/* the blocks are programmed by once_flash_program afterwards, returns 1 on error */
+int once_flash_erase_all(jtag_session *s, flash_constants flash_param[], int flash_count) {
+    erase_job job[MAX_FLASH_UNITS];
+    int i,k,jobs=0,running=0;
+    double start,sequential=0;
+    if ((!s->erase_concurrent)||(!s->erase_plan_count)) return(0);
+    for (i=0;i<flash_count;i++) {
+        if (flash_param[i].duplicate) continue;
+        job[jobs].plan=once_find_plan(s,flash_param[i].interface_address);
+        if (job[jobs].plan->strategy==ERASE_SKIP) continue;
+        job[jobs].block=i;
+        job[jobs].addr=flash_param[i].start_addr;
+        job[jobs].pages=0;
+        job[jobs].busy=0;
+        if ((job[jobs].plan->strategy==ERASE_PAGE)&&(!erase_job_next(&(job[jobs]),flash_param,flash_count))) {
+            job[jobs].plan->done=1;				/* no page requested */
+            continue;
+        }
+        once_init_flash_iface(s,flash_param[i]);
+        jobs++;
+    }
+    start=jtag_time(s);
+    for (k=0;k<jobs;k++) {
+        if (job[k].plan->strategy==ERASE_PAGE) once_page_erase_cntl(s,job[k].plan->interface_address);
+        if (erase_job_start(s,&(job[k]),flash_param)) return(1);
+        job[k].busy=1;
+        running++;
+    }
+    while (running) {
+        for (k=0;k<jobs;k++) {
+            if ((!job[k].busy)||(once_erase_busy(s,job[k].plan->interface_address))) continue;
+            if ((job[k].plan->strategy==ERASE_PAGE)&&(erase_job_next(&(job[k]),flash_param,flash_count))) {
+                if (erase_job_start(s,&(job[k]),flash_param)) return(1);
+                continue;
+            }
+            once_erase_end(s,job[k].plan->interface_address);
+            job[k].busy=0;
+            job[k].plan->done=1;
+            job[k].plan->actual=jtag_time(s)-start;
+            running--;
+            if (job[k].plan->strategy==ERASE_MASS) printf("Flash (%#x) mass erase done.\n",job[k].plan->interface_address);
+            else printf("Flash (%#x) page erase done, %d page(s) erased.\n",job[k].plan->interface_address,job[k].pages);
+        }
+    }
+    for (k=0;k<jobs;k++) sequential+=(job[k].plan->strategy==ERASE_MASS)?job[k].plan->mass_time:job[k].plan->page_time;
+    printf("Concurrent erase of %d FIU(s) took %.1f ms, predicted one after the other %.1f ms\n",
+           jobs,(jtag_time(s)-start)/1000,sequential/1000);
+    return(0);
+}
+
+/* starts the erase of block i+1 in the background if its FIU is not the FIU of block i (only in */
+/* overlapped mode), it is serviced while block i is programmed, returns 1 on error */
+static int once_erase_ahead(jtag_session *s, flash_constants flash_param[], int flash_count, int i) {
+    erase_plan *plan;
+    if ((s->background_active)||(i+1>=flash_count)) return(0);
+    if (flash_param[i+1].interface_address==flash_param[i].interface_address) return(0);
+    plan=once_find_plan(s,flash_param[i+1].interface_address);
+    if ((plan==NULL)||(plan->done)||(plan->strategy==ERASE_SKIP)) return(0);
+    s->background.plan=plan;
+    s->background.block=i+1;
+    s->background.addr=flash_param[i+1].start_addr;
+    s->background.pages=0;
+    s->background_blocks=flash_param;
+    s->background_count=flash_count;
+    if ((plan->strategy==ERASE_PAGE)&&(!erase_job_next(&s->background,flash_param,flash_count))) {
+        plan->done=1;							/* no page requested */
+        s->background.plan=NULL;
+        return(0);
+    }
+    once_init_flash_iface(s,flash_param[i+1]);
+    s->background_start=jtag_time(s);
+    if (plan->strategy==ERASE_PAGE) once_page_erase_cntl(s,plan->interface_address);
+    if (erase_job_start(s,&s->background,flash_param)) return(1);
+    s->background_active=1;
+    printf("Flash (%#x) %s started in the background.\n",plan->interface_address,erase_names[plan->strategy]);
+    return(0);
+}
+
+/* waits for the background erase if it is the erase of the FIU, returns 1 on error */
+static int once_background_finish(jtag_session *s, unsigned int interface_address) {
+    if ((s->background.plan==NULL)||(s->background.plan->interface_address!=interface_address)) return(0);
+    while (s->background_active) once_background_service(s);
+    if (s->background_error) return(1);
+    if (s->background.plan->strategy==ERASE_MASS) printf("Flash (%#x) mass erase done in the background.\n",interface_address);
+    else printf("Flash (%#x) page erase done in the background, %d page(s) erased.\n",interface_address,s->background.pages);
+    s->background.plan=NULL;
+    return(0);
+}
+
+/* programs all blocks, in overlapped mode the erase of the next block runs in the background */
+int once_flash_program_all(jtag_session *s, flash_constants flash_param[], int flash_count) {
+    int i;
+    for (i=0;i<flash_count;i++) {
+        if (once_background_finish(s,flash_param[i].interface_address)) return(1);
+        if ((s->erase_overlap)&&(once_erase_ahead(s,flash_param,flash_count,i))) return(1);
+        if (once_flash_program(s,flash_param[i])) return(1);
+    }
+    return(0);
+}
+
+/* program flash */
+int once_flash_program(jtag_session *s, flash_constants flash_param) {
+    unsigned int j;
+    erase_plan *plan;
+    once_init_flash_iface(s,flash_param);
+    if (s->diff_mode) return(once_flash_program_diff(s,flash_param));
+    if ((plan=once_find_plan(s,flash_param.interface_address))!=NULL) {
+        j = once_flash_erase_planned(s,flash_param,plan);
+        if (j) return(j);
+    } else if (!s->page_erase) {
+        if (flash_param.duplicate) printf("Mass erase skipped.\n");
+        else {
+            j = once_flash_mass_erase(s,flash_param);
+            if (j) return(j);
+        }
+    } else {
+        j = once_flash_page_erase(s,flash_param);
+        if (j) return(j);
     }
+    if (once_flash_program_data(s,flash_param)) return(1);
+    printf("\n");
+    once_flash_program_end(s);
+    if (once_flash_verify(s,flash_param)) return(1);
     printf("\nFlash (%#x) programming done. %#x words written.\n", flash_param.interface_address, flash_param.data_count);
     return(0);
 }
 
+/* lockstep programming of the DSPs added by jtag_add_target, lane_param[k] are the blocks of the */
+/* image of DSP k (the same config file), each block is programmed over the union of the ranges */
+/* of the images, words outside the range of an image are written as 0xffff (erased) */
+/* only mass or page erase, word by word programming and verification by read back are done in */
+/* lockstep, the other modes are ignored */
+#define LANE_ERRORS_SHOWN	4			/* verification errors printed per DSP */
+
+/* MOVE #<data>,Y1 with the word of each DSP */
+void once_move_lanes_to_y1(jtag_session *s, unsigned int *data) {
+    s->shadow_valid&=~REG_Y1;
+    s->once_issued++;
+    s->once_issued_words+=2;
+    once_instruction_exec(s,0x09,0,0,0);
+    once_data_write(s,0x87c3);
+    once_instruction_exec(s,0x09,0,1,0);
+    jtag_data_write16_lanes(s,data);
+}
+
+int once_flash_program_lanes(jtag_session *s, flash_constants *lane_param[], int flash_count) {
+    unsigned int data[LANES_MAX];
+    unsigned long int errors[LANES_MAX];
+    unsigned int i,start,end,addr,page;
+    int k,b,failed=0,lanes=jtag_lanes(s);
+    flash_constants block;
+    if ((s->stub_mode)||(s->pipeline)||(s->diff_mode)||(s->verify_mode)||(s->sparse_gap)||(s->erase_planner)||(s->erase_concurrent)||(s->erase_overlap))
+        printf("Lockstep programming: -stub, -pipe, -diff, -csum, -gap, -plan, -par and -overlap are not used\n");
+    for (k=0;k<lanes;k++) errors[k]=0;
+    for (b=0;b<flash_count;b++) {
+        block=lane_param[0][b];
+        start=block.flash_end+1;
+        end=block.flash_start;
+        for (k=0;k<lanes;k++) {
+            if (!lane_param[k][b].data_count) continue;
+            if (lane_param[k][b].start_addr<start) start=lane_param[k][b].start_addr;
+            if (lane_param[k][b].start_addr+lane_param[k][b].data_count>end) end=lane_param[k][b].start_addr+lane_param[k][b].data_count;
+            if (!block.duplicate) for (page=0;page<MAX_PAGE_COUNT;page++) block.page_erase_map[page]|=lane_param[k][b].page_erase_map[page]&2;
+        }
+        if (end<start) end=start;
+        block.start_addr=start;
+        block.data_count=end-start;
+        once_init_flash_iface(s,block);
+        if (!s->page_erase) {
+            if (block.duplicate) printf("Mass erase skipped.\n");
+            else if (once_flash_mass_erase(s,block)) return(1);
+        } else if (once_flash_page_erase(s,block)) return(1);
+        if (block.data_count) {
+            once_flash_program_prepare(s,block.interface_address,start);
+            once_flash_program_pg_no(s,start);
+            for (addr=start;addr<end;addr++) {
+                if (!(addr%32)) once_flash_program_pg_no(s,addr);
+                if (!((addr-start)%512)) printf("p");
+                for (k=0;k<lanes;k++) data[k]=lane_param[k][b].data[addr-block.flash_start];
+                once_move_lanes_to_y1(s,data);	/* MOVE #<data>,Y1, a word per DSP */
+                once_flash_wait(s,POLL_WORD);
+                if (!(block.program_memory)) {
+                    once_move_y1_to_xr0_inc(s);
+                } else {
+                    once_move_y1_to_pr0_inc(s);
+                }
+                once_busy_start(s,POLL_WORD,flash_program_time(block,1));
+            }
+            printf("\n");
+            once_flash_program_end(s);
+            once_move_data_to_r2(s,start);		/* MOVE #<address>,R2		 */
+            for (addr=start;addr<end;addr++) {
+                once_verify_read(s,block);
+                for (k=0;k<lanes;k++) {
+                    i=lane_param[k][b].data[addr-block.flash_start];
+                    if (jtag_lane_value(s,k)==i) continue;
+                    if (errors[k]++<LANE_ERRORS_SHOWN) printf("DSP %d: verification error at addr: %#x, wr: %#x, rd: %#x\n",k,addr,i,jtag_lane_value(s,k));
+                }
+                if (!((addr-start)%512)) printf("v");
+            }
+        }
+        printf("\nFlash (%#x) programming done in lockstep. %#x words written.\n",block.interface_address,block.data_count);
+    }
+    for (k=0;k<lanes;k++) {
+        printf("DSP %d (IR position %d, DR position %d): %s",k,get_lane_instr_pp(s,k),get_lane_data_pp(s,k),errors[k]?"FAILED":"passed");
+        if (errors[k]) printf(", %lu verification error(s)",errors[k]);
+        printf("\n");
+        if (errors[k]) failed=1;
+    }
+    return(failed);
+}
+
 /* prepares flash reading */
 /* R2 = start address */
-void once_flash_read_prepare (unsigned int addr, flash_constants flash_param[], int flash_count) {
+void once_flash_read_prepare (jtag_session *s, unsigned int addr, flash_constants flash_param[], int flash_count) {
     int i;
-    if (info_block) {							/* set IFREN bit of all flash units */
-        once_move_data_to_y0(0x0040);			/* MOVE #0x0040,Y0		*/
+    if (s->info_block) {							/* set IFREN bit of all flash units */
+        once_move_data_to_y0(s,0x0040);			/* MOVE #0x0040,Y0		*/
         for (i=0;i<flash_count;i++) {
-            once_move_data_to_r2(flash_param[i].interface_address);	/* MOVE #<base address>,R2 */
-            once_move_y0_to_xr2_inc();			/* set IFREN in FIU_CNTL register */
+            once_move_data_to_r2(s,flash_param[i].interface_address);	/* MOVE #<base address>,R2 */
+            once_move_y0_to_xr2_inc(s);			/* set IFREN in FIU_CNTL register */
         }
     }
-    once_move_data_to_r2(addr);					/* MOVE #<address>,R2 	*/
+    once_move_data_to_r2(s,addr);					/* MOVE #<address>,R2 	*/
 }
 
 /* read one word */
 /* if program_memory!=0, program memory is read */
-unsigned int once_flash_read_1word(unsigned char program_memory) {
+unsigned int once_flash_read_1word(jtag_session *s, unsigned char program_memory) {
     if (!(program_memory)) {
-        once_move_xr2_inc_to_y0();			/* MOVE x:R2,Y0	(x:addr)	 */
+        once_move_xr2_inc_to_y0(s);			/* MOVE x:R2,Y0	(x:addr)	 */
     } else {
-        once_move_pr2_inc_to_y0();			/* MOVE p:R2,Y0 (p:addr)	 */
+        once_move_pr2_inc_to_y0(s);			/* MOVE p:R2,Y0 (p:addr)	 */
+        if (s->fused_forms) return(once_opdbr_read(s));	/* the word read passed the program data bus */
     }
-    once_move_y0_to_xmem(0xffff);			/* MOVE Y0,<OPGDBR> 		 */
-    return(once_opgdbr_read());				/* Read OPGDBR register 	 */
+    once_move_y0_to_xmem(s,0xffff);			/* MOVE Y0,<OPGDBR> 		 */
+    return(once_opgdbr_read(s));				/* Read OPGDBR register 	 */
 }
 
 /* read memory */
-void once_flash_read(unsigned char program_memory, unsigned int start_addr,
+void once_flash_read(jtag_session *s, unsigned char program_memory, unsigned int start_addr,
                      unsigned int end_addr, unsigned int *buffer, flash_constants flash_param[], int flash_count) {
     unsigned long int count=end_addr-start_addr+1;
+    unsigned long int scans=s->jtag_stats.dr_scans;
     unsigned int i;
-    once_flash_read_prepare (start_addr, flash_param, flash_count);
+    once_flash_read_prepare (s,start_addr, flash_param, flash_count);
     for(i=0;i<count;i++) {
-        *(buffer++)=once_flash_read_1word(program_memory);
+        *(buffer++)=once_flash_read_1word(s,program_memory);
         if (!(i%512)) printf("r");
     }
+    once_scan_account(s,SCAN_READ,scans,count);
     printf("\n");
     printf("\nReading memory done, %#lx word(s) read.\n", count);
 }
@@ -18,216 +18,584 @@
 #ifndef JTAG____H
 #define JTAG____H
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "flash.h"
 
+typedef struct jtag_session jtag_session;
+
+#include "mpsse.h"
+
 #define RETRY_DEBUG	10			/* how many JTAGIR polls should we try to wait for entry into DEBUG mode */
 #define JTAG_PATH_LEN_MAX 256	/* maximum JTAG DR & IR path lenght. High numbers do not matter, but the measure routine will take longer to execute */
 
+#define TRANSPORT_BITBANG	0	/* FT232H asynchronous bit-bang, one USB transfer per pin change */
+#define TRANSPORT_MPSSE		1	/* FT232H MPSSE engine, scans are queued as MPSSE commands */
+#define TRANSPORT_SYNCBB	2	/* FT232H synchronous bit-bang, TDO samples are returned with the written data */
+
+#define JTAG_BITBANG_RATE	153600.0	/* bit-bang pin updates per second (default 9600 baud * 16), used to pace idle periods */
+#define JTAG_OUT_BUFFER_SIZE 4096	/* bit-bang pin updates collected before a USB transfer is forced */
+#define JTAG_SYNC_CHUNK		256		/* synchronous bit-bang bytes written per USB transfer (receive FIFO must not overflow) */
+#define JTAG_FUTURES_MAX	64		/* TDO samples which can be pending at a time */
+#define LANES_MAX			4		/* DSPs of one chain programmed in lockstep */
+#define ADAPTER_SERIAL_MAX	32		/* length of an FT232H serial number */
+#define ADAPTER_PATH_MAX	32		/* length of a USB bus path, <bus>-<port>[.<port>...] */
+
+#define STUB_P_ADDR		0x7e00	/* flash routine location, program RAM of the 56F80x */
+#define STUB_X_BUFFER	0x0100	/* data RAM where the words of one flash row are staged */
+#define STUB_ROW		32		/* words per flash row, FIU_PE selects one row */
+#define RETRY_STUB		1000	/* JTAGIR polls waiting for the flash routine to return to DEBUG mode */
+#define SPARSE_GAP_DEFAULT	8	/* erased words skipped by -gap without a value, setting R0 costs about as much as programming 4 words */
+#define CHECKSUM_WORDS	256		/* words per on-chip checksum, one flash page */
+#define PIPE_BUSY_MAX	10000.0	/* us, longest word programming time the pipelined mode calibrates to */
+#define JTAG_USB_LATENCY	125.0	/* us per USB transfer (one high-speed microframe), used to predict the time of OnCE sequences */
+
+#define REG_R0			0x01	/* target registers, an OnCE sequence interleaved with another reports the ones it clobbers */
+#define REG_R1			0x02
+#define REG_R2			0x04
+#define REG_R3			0x08
+#define REG_Y0			0x10
+#define REG_Y1			0x20
+#define REG_OMR			0x40
+
+#define ERASE_MASS		0		/* erase planner strategies */
+#define ERASE_PAGE		1
+#define ERASE_SKIP		2
+
+typedef struct {
+	unsigned long int	usb_writes;	/* USB bulk-out transfers */
+	unsigned long int	usb_reads;	/* USB bulk-in transfers and pin reads */
+	unsigned long int	bytes_out;
+	unsigned long int	bytes_in;
+	unsigned long int	pin_writes;	/* pin updates issued by the JTAG routines */
+	unsigned long int	tck_cycles;
+	unsigned long int	dr_scans;	/* OnCE command and data scans */
+	unsigned long int	pad_cycles;	/* TCK cycles of the bypass bits of the other parts in the chain */
+	unsigned long int	queue_max;	/* most writes waiting in the USB queue or in flight (-async) */
+	unsigned long int	queue_stalls;	/* writes which found the USB queue full */
+	unsigned long int	queue_waits;	/* reads which waited for the queued writes to go out */
+	unsigned long int	queue_idle;	/* times the USB queue ran empty, the bus waited for the host */
+} jtag_statistics;
+
+typedef struct {
+	unsigned int	interface_address;	/* FIU the plan is for, covers all blocks behind it */
+	unsigned int	strategy;	/* ERASE_MASS, ERASE_PAGE or ERASE_SKIP */
+	unsigned int	pages;		/* pages requested by the S-records */
+	double			mass_time;	/* predicted time of the mass erase [us] */
+	double			page_time;	/* predicted time of the page erases [us] */
+	double			actual;		/* measured time of the erase [us] */
+	unsigned int	done;		/* 1: erased by once_flash_erase_all */
+} erase_plan;
+
+/* --------------- Session --------------- */
+/* all state of one session: the options, the adapter and the chain, the scan kernels and their */
+/* caches, the OnCE and FIU bookkeeping, the traffic counters and the image, every routine of the */
+/* JTAG, OnCE, MPSSE and S-record layers takes the session as first parameter so several sessions */
+/* can run in one process, each on its own thread, without locks */
+
+/* device the pin updates are sent to: the FT232H (jtag.c) or the target simulator (target_sim.c) */
+typedef struct {
+	int		(*open)(jtag_session *s, unsigned char bitmode);		/* returns 0 on success, bitmode is one of libftdi's BITMODE_xxx */
+	void	(*close)(jtag_session *s);
+	int		(*write)(jtag_session *s, unsigned char *buf, int size);	/* returns number of bytes written or <0 on error */
+	int		(*read)(jtag_session *s, unsigned char *buf, int size);	/* returns number of bytes read or <0 on error */
+	int		(*read_pins)(jtag_session *s, unsigned char *pins);		/* returns 0 on success */
+	void	*(*submit)(jtag_session *s, unsigned char *buf, int size);	/* starts a write, returns the transfer or NULL on error, optional */
+	int		(*complete)(jtag_session *s, void *transfer);	/* waits for a submitted write, returns <0 on error */
+} jtag_port;
+
+typedef struct {
+    int position;		/* index of the sampling byte in out_buffer, -1 when resolved */
+    int value;			/* TDO level */
+} tdo_future;
+
+#define VECTOR_MAX			(10+2*16+2*JTAG_PATH_LEN_MAX)	/* pin updates of a 16-bit scan */
+#define VECTOR_CACHE		64			/* vectors of values kept, direct mapped */
+#define PAD_VECTOR			(2*JTAG_PATH_LEN_MAX)	/* pin updates of the longest bypass run */
+#define IR_PREFIX			(6+2*JTAG_PATH_LEN_MAX)	/* pin updates of a cached IR prefix */
+
+typedef struct {
+    unsigned int	value;			/* bits shifted */
+    int				bits;			/* 8 or 16, 0: empty */
+    int				length;			/* pin updates */
+    unsigned char	pins[VECTOR_MAX];
+} jtag_vector;
+
+#define SHADOW_REGS		7			/* R0-R3, Y0, Y1, OMR */
+#define SCAN_PATHS		4			/* read, FIU init, program, verify */
+#define POLL_OPERATIONS	4			/* word program, row end, mass erase, page erase */
+#define POLL_BUCKETS	7			/* 1, 2, 3, 4-7, 8-15, 16-31, 32+ polls */
+
+typedef struct {
+    unsigned long int	count[POLL_BUCKETS];	/* waits by the number of polls */
+    unsigned long int	waits;
+    unsigned long int	polls;
+    double				busy;		/* predicted BUSY time [us] */
+    double				idle;		/* idle periods queued instead of polls [us] */
+} poll_histogram;
+
+typedef struct {
+    erase_plan		*plan;
+    int				block;		/* block of the FIU and address of the next page to be page erased */
+    unsigned int	addr;
+    unsigned int	pages;		/* pages erased */
+    int				busy;		/* 1: erase running */
+} erase_job;
+
+struct jtag_session {
+    /* options */
+    unsigned char page_erase;					/* 1: page erase, 0: mass erase */
+    unsigned char info_block;					/* 1: info block, 0: normal flash access */
+    unsigned char stub_mode;					/* 1: program with the flash routine in program RAM, 0: word by word over the OnCE */
+    unsigned int sparse_gap;					/* runs of at least this many erased words are not programmed, 0: program everything */
+    unsigned char diff_mode;					/* 1: only erase and program the pages which differ from the image */
+    unsigned char verify_mode;					/* 1: verify by checksums computed on the target, 0: read back every word */
+    unsigned char pipeline;						/* 1: stage the next word/row while the FIU is BUSY, the end of BUSY is predicted */
+    unsigned char busy_predict;					/* 1: BUSY polls which cannot see the end of BUSY yet are replaced by idle periods */
+    unsigned char register_shadow;				/* 1: OnCE loads of a value the target register already holds are dropped */
+    unsigned char fused_forms;					/* 1: the shorter instruction forms (FUSED_xx) are selected */
+    unsigned char fused_immediate;				/* 1: FIU timing written by FUSED_MOVE_DATA_XR2_OFF, experimental */
+    unsigned char fused_short_io;				/* 1: OPGDBR moves by FUSED_MOVE_Y0_PP/FUSED_MOVE_PP_Y0, experimental */
+    unsigned char erase_planner;				/* 1: mass, page or no erase is chosen for every FIU by the predicted time */
+    unsigned char erase_concurrent;				/* 1: all FIUs are erased at the same time before programming */
+    unsigned char erase_overlap;				/* 1: the FIU of the next block erases while the current block is programmed */
+    unsigned char wait_for_DSP;					/* 1: wait for DSP to come out of reset (external reset circuit or power down/up for 801 bootloader erasure) */
+    unsigned char exit_mode;					/* ==0 - reset the target, !=0 - leave in debug mode */
+    unsigned char tck_calibrate;				/* 1: TCK calibrated by init_target (MPSSE) */
+    unsigned int usb_queue_depth;				/* writes kept in flight by the drain thread, 0: blocking writes */
+
+    /* chain */
+    int data_pl;								/* lengths of JTAG paths */
+    int instr_pl;
+    int data_pp;								/* position of the part in the JTAG chain, 0=beginning */
+    int instr_pp;
+    int lane_count;								/* DSPs added by jtag_add_target, more than one are programmed in lockstep */
+    int lane_instr_pp[LANES_MAX];
+    int lane_data_pp[LANES_MAX];
+    unsigned int *lane_write;					/* words of the next DR write, one per DSP */
+    unsigned long int lane_read[LANES_MAX];		/* words of the last DR read */
+
+    /* adapter and transport */
+    jtag_port *port;							/* device the pin updates are sent to */
+    struct ftdi_context *ftdic;
+    bool ftdi_open;
+    char adapter_serial[ADAPTER_SERIAL_MAX+1];	/* serial number of the adapter to open, ""=any */
+    char adapter_path[ADAPTER_PATH_MAX+1];	/* bus path of the adapter to open, ""=any */
+    unsigned int adapter_pid;					/* PID of the adapter to open, 0=any */
+    int adapter_channel;						/* 0=A..3=D, -1: the first channel */
+    void *sim;									/* target simulator (target_sim.c), NULL on hardware */
+    void *usb_queue;							/* ring and drain thread of the writes (usb_queue.c), NULL: blocking writes */
+    double (*jtag_clock)(jtag_session *s);		/* time source of the measurements */
+    unsigned char transport;					/* how the FT232H drives the JTAG pins */
+    unsigned int tck_divisor;					/* MPSSE TCK divisor */
+    unsigned int pport_data;					/* mirror of output port to save accesses */
+    unsigned char out_buffer[JTAG_OUT_BUFFER_SIZE];	/* pin updates waiting to be sent (bit-bang) */
+    int out_count;
+    unsigned char out_buffering;				/* 1: collect pin updates until TDO is sampled, 0: one transfer per update */
+    unsigned char out_last;						/* last pin update, for the TCK cycle count */
+    unsigned char in_buffer[JTAG_SYNC_CHUNK];	/* pins sampled by the synchronous bit-bang mode */
+    tdo_future tdo_futures[JTAG_FUTURES_MAX];	/* TDO samples waiting for the next flush */
+    int tdo_future_next;
+    jtag_statistics jtag_stats;					/* traffic counters */
+
+    /* scan kernels (jtag_select_kernels) and their caches */
+    void (*scan_write)(jtag_session *s, unsigned int data, int bits);	/* kernels in use */
+    unsigned int (*scan_read16)(jtag_session *s);
+    int (*scan_ir)(jtag_session *s, int instruction);
+    char *scan_kernel_name;						/* scan kernels selected by jtag_select_kernels */
+    unsigned char pin_vectors;					/* 1: bit-bang DR writes are copied from precompiled pin vectors */
+    unsigned char park_mode;					/* 1: IR scans copy a cached prefix (path to Shift-IR and BYPASS ones) */
+    jtag_vector vector_template[2];				/* 8 and 16 bits of zero */
+    jtag_vector vector_cache[VECTOR_CACHE];
+    int vector_pp;								/* chain configuration of the vectors */
+    unsigned char vector_base;
+    unsigned char pad_vector[PAD_VECTOR];		/* TDI=1 clocks for the pin state pad_base */
+    int pad_base;
+    unsigned char ir_prefix[IR_PREFIX];
+    int ir_prefix_length;
+    int ir_prefix_base;							/* pin state and path of the prefix */
+    int ir_prefix_pad;
+
+    /* MPSSE command queue (mpsse.c) */
+    unsigned char mpsse_buffer[MPSSE_BUFFER_SIZE];	/* queued MPSSE commands */
+    int mpsse_count;							/* number of bytes in the queue */
+    mpsse_read mpsse_reads[MPSSE_READS_MAX];	/* one entry for every byte the engine will return */
+    int mpsse_read_count;
+    unsigned char mpsse_park;					/* 1: IR prefixes are copied from mpsse_prefix */
+    unsigned char mpsse_prefix[8+JTAG_PATH_LEN_MAX/8+8];
+    int mpsse_prefix_count;
+    int mpsse_prefix_pad;						/* bypass bits of the prefix */
+
+    /* OnCE register shadow and counters */
+    unsigned int shadow_value[SHADOW_REGS];
+    unsigned int shadow_valid;
+    unsigned long int once_issued;				/* OnCE instructions executed */
+    unsigned long int once_issued_words;
+    unsigned long int once_dropped;				/* loads dropped by the shadow */
+    unsigned long int once_dropped_words;
+    unsigned long int scan_count[SCAN_PATHS];	/* DR scans of the path */
+    unsigned long int scan_words[SCAN_PATHS];	/* words read, FIU registers written, words programmed or verified */
+
+    /* FIU BUSY waits and erases */
+    poll_histogram polls[POLL_OPERATIONS];
+    double busy_until;							/* jtag_queued_time when the FIU is predicted to clear BUSY */
+    int busy_operation;
+    erase_plan erase_plans[MAX_FLASH_UNITS];	/* plans made by once_erase_plan, one per FIU */
+    int erase_plan_count;
+    erase_job background;						/* erase running while another block is programmed */
+    int background_active;						/* 1: BUSY is set by the erase */
+    int background_error;
+    flash_constants *background_blocks;			/* blocks of the session, for the pages of the job */
+    int background_count;
+    double background_start;
+
+    /* image */
+    flash_constants flash_param[MAX_FLASH_UNITS];	/* constants for flash units */
+    int flash_count;							/* number of flash units */
+    flash_constants lane_param[LANES_MAX][MAX_FLASH_UNITS];	/* flash blocks of the DSPs 1.. programmed in lockstep */
+    mem_read_constants mem_read;				/* parameters for reading memory */
+    char serror;								/* 0=report all errors, 1=silent mode (do not report all S-rec errors) */
+    char checksums;								/* 1=check the S-record checksums */
+};
+
+jtag_session *jtag_session_new(void);	/* a session with the default options, NULL if out of memory */
+void jtag_session_free(jtag_session *s);
+jtag_session *jtag_session_copy(jtag_session *s);	/* same options and image, port closed (gang mode) */
+
+
 /* prototypes */
 
-int jtag_init(void);	/* returns 0 on success, -1 if command converter not found */
-int jtag_instruction_exec(int instruction);
-unsigned long int jtag_data_shift(unsigned long int data, int bit_count);
-int init_target (void);
-int once_init_flash_iface(flash_constants flash_param);
-void once_flash_program_prepare (unsigned int fiu_address, unsigned int addr);
-void once_flash_program_pg_no (unsigned int addr);
-void once_flash_program_end (void);
-void once_flash_program_1word(flash_constants flash_param, unsigned int data);
-int once_flash_verify_1word(flash_constants flash_param, unsigned int data);
-int once_flash_mass_erase(flash_constants flash_param);
-int once_flash_page_erase(flash_constants flash_param);
-int once_flash_program(flash_constants flash_param);
-void jtag_disconnect(void);
-void jtag_data_write8(unsigned int data);
-void jtag_data_write16(unsigned int data);
-unsigned int jtag_data_read16(void);
-int open_port();
-void set_info_block(unsigned int value);
+int jtag_init(jtag_session *s);	/* returns 0 on success, -1 if command converter not found */
+int jtag_instruction_exec(jtag_session *s, int instruction);
+unsigned long int jtag_data_shift(jtag_session *s, unsigned long int data, int bit_count);
+int init_target (jtag_session *s);
+int once_init_flash_iface(jtag_session *s, flash_constants flash_param);
+void once_flash_program_prepare (jtag_session *s, unsigned int fiu_address, unsigned int addr);
+void once_flash_program_pg_no (jtag_session *s, unsigned int addr);
+void once_flash_program_end (jtag_session *s);
+void once_flash_program_1word(jtag_session *s, flash_constants flash_param, unsigned int data);
+int once_flash_verify_1word(jtag_session *s, flash_constants flash_param, unsigned int data);
+int once_flash_mass_erase(jtag_session *s, flash_constants flash_param);
+int once_flash_page_erase(jtag_session *s, flash_constants flash_param);
+int once_flash_program_data(jtag_session *s, flash_constants flash_param);
+int once_flash_program(jtag_session *s, flash_constants flash_param);
+int once_flash_verify(jtag_session *s, flash_constants flash_param);
+void jtag_disconnect(jtag_session *s);
+void jtag_data_write8(jtag_session *s, unsigned int data);
+void jtag_data_write16(jtag_session *s, unsigned int data);
+unsigned int jtag_data_read16(jtag_session *s);
+int open_port(jtag_session *s);
+void set_info_block(jtag_session *s, unsigned int value);
 
 /* exit mode - leave the part in debug mode or reset it */
-void set_exit_mode(unsigned char mode);
+void set_exit_mode(jtag_session *s, unsigned char mode);
 
 /* reading memory */
-void once_flash_read_prepare (unsigned int addr, flash_constants flash_param[], int flash_count);
-unsigned int once_flash_read_1word(unsigned char program_memory);
-void once_flash_read(unsigned char program_memory, unsigned int start_addr, unsigned int end_addr, unsigned int *buffer, flash_constants flash_param[], int flash_count);
+void once_flash_read_prepare (jtag_session *s, unsigned int addr, flash_constants flash_param[], int flash_count);
+unsigned int once_flash_read_1word(jtag_session *s, unsigned char program_memory);
+void once_flash_read(jtag_session *s, unsigned char program_memory, unsigned int start_addr, unsigned int end_addr, unsigned int *buffer, flash_constants flash_param[], int flash_count);
 
 /* erase mode */
-void set_erase_mode(unsigned char mode);
+void set_erase_mode(jtag_session *s, unsigned char mode);
+
+/* erase planner, chooses mass, page or no erase for every FIU by the predicted time */
+void set_erase_planner(jtag_session *s, unsigned char mode);
+void once_erase_plan(jtag_session *s, flash_constants flash_param[], int flash_count);
+void once_erase_report(jtag_session *s);
+
+/* concurrent erase, all FIUs are erased at the same time before the blocks are programmed */
+void set_erase_concurrent(jtag_session *s, unsigned char mode);
+int once_flash_erase_all(jtag_session *s, flash_constants flash_param[], int flash_count);
+
+/* overlapped erase, the FIU of the next block erases while the current block is programmed */
+void set_erase_overlap(jtag_session *s, unsigned char mode);
+int once_flash_program_all(jtag_session *s, flash_constants flash_param[], int flash_count);
+double once_predicted_time(jtag_session *s, unsigned int words, unsigned int reads);	/* us of OnCE instruction words and register reads */
+
+/* programming by the flash routine in program RAM instead of word by word over the OnCE */
+void set_stub_mode(jtag_session *s, unsigned char mode);
+void once_stub_load(jtag_session *s, unsigned int program_memory);
+int once_flash_program_stub(jtag_session *s, flash_constants flash_param);
+
+/* verification by checksums computed on the target, the pages which do not match are read back */
+void set_verify_mode(jtag_session *s, unsigned char mode);
+void once_checksum_load(jtag_session *s, unsigned int program_memory);
+int once_flash_verify_checksum(jtag_session *s, flash_constants flash_param, int readback);	/* readback: the first page is also read back word by word */
+int once_flash_checksum(jtag_session *s, unsigned int addr, unsigned int count, unsigned long int *sum);	/* returns 1 on timeout */
+
+/* sparse programming, runs of erased words inside the data are skipped */
+void set_sparse_gap(jtag_session *s, unsigned int words);
+
+/* differential programming, only the pages which differ from the image are erased and programmed */
+void set_diff_mode(jtag_session *s, unsigned char mode);
+int once_flash_program_diff(jtag_session *s, flash_constants flash_param);
+
+/* pipelined programming, the next word or row is staged while the FIU is BUSY and the end of BUSY is predicted */
+void set_pipeline(jtag_session *s, unsigned char mode);
+void set_busy_predict(jtag_session *s, unsigned char mode);	/* BUSY polls replaced by idle periods of the predicted BUSY time */
+void once_poll_report(jtag_session *s);	/* histogram of the BUSY polls per operation */
+int once_flash_program_pipelined(jtag_session *s, flash_constants flash_param);
+void jtag_idle(jtag_session *s, double us);	/* queues an idle period, the TAP stays in (or returns to) Select-DR-Scan */
+double jtag_queued_time(jtag_session *s);	/* us of JTAG activity queued so far, a lower bound of the time spent */
+
+/* bit-bang, synchronous bit-bang or MPSSE transport, must be selected before open_port() */
+void set_transport(jtag_session *s, unsigned char mode);
+void set_tck_divisor(jtag_session *s, unsigned int divisor);
+void set_tck_calibrate(jtag_session *s, unsigned char mode);	/* 1: init_target searches the fastest clean TCK */
+int jtag_calibrate_tck(jtag_session *s);	/* returns the divisor, -1 on failure or without MPSSE */
+void set_adapter_serial(jtag_session *s, char *serial);	/* FT232H to open, "" opens the first one */
+
+/* bit-bang output buffering, pin updates are sent when TDO is sampled or the buffer is full */
+void set_output_buffer(jtag_session *s, unsigned char mode);
+void set_pin_vectors(jtag_session *s, unsigned char mode);	/* 1: bit-bang DR writes from precompiled pin vectors (default) */
+void set_park_mode(jtag_session *s, unsigned char mode);	/* 1: IR scans from a cached prefix for the parts parked in BYPASS */
+void jtag_flush(jtag_session *s);
+
+/* time source of the measurements (default wall clock), us */
+void set_jtag_clock(jtag_session *s, double (*clock)(jtag_session *s));
+double jtag_time(jtag_session *s);		/* sends the queued traffic first */
+
+/* traffic counters */
+void jtag_get_stats(jtag_session *s, jtag_statistics *stats);
+void jtag_reset_stats(jtag_session *s);
+void jtag_print_stats(jtag_session *s);
+void jtag_scan_bench(jtag_session *s);		/* host CPU time per scan of the scan kernels */
 
 /* routines for handling multiple devices in the JTAG chain */
-int jtag_measure_paths(void);
-int get_data_pl(void);		/* returns data path lenght measured by the measure routine */
-int get_instr_pl(void);		/* returns instruction path lenght measured by the measure routine */
-int get_data_pp(void);
-int get_instr_pp(void);
-void set_data_pp(int length);
-void set_instr_pp(int length);
+int jtag_measure_paths(jtag_session *s);
+void jtag_select_kernels(jtag_session *s);	/* scan kernels for the transport and the chain position, after jtag_measure_paths */
+int get_data_pl(jtag_session *s);		/* returns data path lenght measured by the measure routine */
+int get_instr_pl(jtag_session *s);		/* returns instruction path lenght measured by the measure routine */
+int get_data_pp(jtag_session *s);
+int get_instr_pp(jtag_session *s);
+void set_data_pp(jtag_session *s, int length);
+void set_instr_pp(jtag_session *s, int length);
+
+/* several DSPs of the chain programmed in lockstep, one lane per DSP */
+int jtag_add_target(jtag_session *s, int instr_position, int data_position);	/* each -mI,D adds a DSP */
+int jtag_lanes(jtag_session *s);
+int get_lane_instr_pp(jtag_session *s, int lane);
+int get_lane_data_pp(jtag_session *s, int lane);
+unsigned int jtag_lane_value(jtag_session *s, int lane);	/* word of the DSP in the last read, the reads return the OR of all DSPs */
+void jtag_data_write16_lanes(jtag_session *s, unsigned int *data);	/* data[k] to the DSP of lane k */
+void once_move_lanes_to_y1(jtag_session *s, unsigned int *data);
+int once_flash_program_lanes(jtag_session *s, flash_constants *lane_param[], int flash_count);
 
 /* wait for DSP to come out of reset */
-void set_DSP_wait(char wait);
+void set_DSP_wait(jtag_session *s, char wait);
+
+/* the OnCE macros take the session as their first parameter */
 
 /* Executes OnCE command */
-#define once_instruction_exec(instruction, rw, go, ex) jtag_data_write8(instruction|(ex<<5)|(go<<6)|(rw<<7))
+#define once_instruction_exec(s, instruction, rw, go, ex) jtag_data_write8(s,instruction|(ex<<5)|(go<<6)|(rw<<7))
 
 /* Transfers 16-bit data into the OnCE through DR-shift of Jtag */
-#define once_data_write(data) jtag_data_write16(data)
+#define once_data_write(s,data) jtag_data_write16(s,data)
 
 /* Reads 16-bit data from the OnCE through DR-shift of Jtag */
-#define once_data_read() jtag_data_read16()
+#define once_data_read(s) jtag_data_read16(s)
 
 /* Executes one word DSP instruction */
-#define once_execute_instruction1(opcode) once_instruction_exec(0x09,0,1,0);\
-once_data_write(opcode)
+#define once_execute_instruction1(s,opcode) once_execute1(s,opcode)
 
 /* Executes two word DSP instruction */
-#define once_execute_instruction2(opcode1, opcode2) once_instruction_exec(0x09,0,0,0);\
-    once_data_write(opcode1);\
-    once_instruction_exec(0x09,0,1,0);\
-    once_data_write(opcode2)
+#define once_execute_instruction2(s, opcode1, opcode2) once_execute2(s,opcode1,opcode2)
 
 /* Executes two word DSP instruction and exits the debug mode */
-#define once_execute_instruction1_run(opcode) once_instruction_exec(0x09,0,1,1);\
-    once_data_write(opcode);
+#define once_execute_instruction1_run(s,opcode) once_execute1_run(s,opcode)
+
+/* the instructions go through a host side shadow of R0-R3, Y0, Y1 and OMR (see jtag.c) */
+void once_execute1(jtag_session *s, unsigned int opcode);
+void once_execute2(jtag_session *s, unsigned int opcode1, unsigned int opcode2);
+void once_execute1_run(jtag_session *s, unsigned int opcode);
+void once_shadow_invalidate(jtag_session *s);	/* the target registers are no longer known (reset, code run) */
+void set_register_shadow(jtag_session *s, unsigned char mode);	/* 1: loads of a value the register holds are dropped */
+void set_fused_forms(jtag_session *s, unsigned char mode);	/* 1: the shorter instruction forms below are selected */
+void set_fused_immediate(jtag_session *s, unsigned char mode);	/* 1: FUSED_MOVE_DATA_XR2_OFF for the FIU timing, experimental */
+void set_fused_short_io(jtag_session *s, unsigned char mode);	/* 1: FUSED_MOVE_Y0_PP/FUSED_MOVE_PP_Y0 for OPGDBR, experimental */
+void once_scan_report(jtag_session *s);		/* DR scans per word of the read, init, program and verify paths */
+void once_shadow_report(jtag_session *s);		/* OnCE instructions issued and dropped */
 
 /* Reads contents of the OPGDBR register */
-#define once_opgdbr_read()	(once_instruction_exec(0x08,1,1,0), once_data_read())
+#define once_opgdbr_read(s)	(once_instruction_exec(s,0x08,1,1,0), once_data_read(s))
 
 /* Reads contents of the OPDBR register */
-#define once_opdbr_read()	(once_instruction_exec(0x09,1,1,0), once_data_read())
+#define once_opdbr_read(s)	(once_instruction_exec(s,0x09,1,1,0), once_data_read(s))
 
 
 /* --------------- Instructions --------------- */
 
 /* MOVE <data>,Y0 */
-#define once_move_data_to_y0(data) once_execute_instruction2(0x87c1,data)
+#define once_move_data_to_y0(s,data) once_execute_instruction2(s,0x87c1,data)
 
 /* MOVE <data>,Y1 */
-#define once_move_data_to_y1(data) once_execute_instruction2(0x87c3,data)
+#define once_move_data_to_y1(s,data) once_execute_instruction2(s,0x87c3,data)
 
 /* MOVE Y0,x:address */
-#define once_move_y0_to_xmem(address) once_execute_instruction2(0xd154,address)
+#define once_move_y0_to_xmem(s,address) once_execute_instruction2(s,0xd154,address)
 
 /* MOVE x:address,Y0 */
-#define once_move_xmem_to_y0(address) once_execute_instruction2(0xf154,address)
+#define once_move_xmem_to_y0(s,address) once_execute_instruction2(s,0xf154,address)
 
 /* NOP */
-#define once_nop() once_execute_instruction1(0xe040)
+#define once_nop(s) once_execute_instruction1(s,0xe040)
 
 /* MOVE <data>,R0 */
-#define once_move_data_to_r0(data) once_execute_instruction2(0x87d0,data)
+#define once_move_data_to_r0(s,data) once_execute_instruction2(s,0x87d0,data)
 
 /* MOVE <data>,R1 */
-#define once_move_data_to_r1(data) once_execute_instruction2(0x87d1,data)
+#define once_move_data_to_r1(s,data) once_execute_instruction2(s,0x87d1,data)
 
 /* MOVE <data>,R2 */
-#define once_move_data_to_r2(data) once_execute_instruction2(0x87d2,data)
+#define once_move_data_to_r2(s,data) once_execute_instruction2(s,0x87d2,data)
 
 /* MOVE <data>,R3 */
-#define once_move_data_to_r3(data) once_execute_instruction2(0x87d3,data)
+#define once_move_data_to_r3(s,data) once_execute_instruction2(s,0x87d3,data)
 
 /* MOVE <data>,x:(R2+<offset>) */ /* caution, the offset only 6 bits plus sign ! */
-// does not work, do not ask me why... #define once_move_data_to_xr2_off(data,offset) once_execute_instruction2(0xA680|(offset&0x007f),data)
+/* reported not to work on the target by the original author, the encoding is kept as */
+/* FUSED_MOVE_DATA_XR2_OFF and only used with the experimental -fuseimm option */
+// #define once_move_data_to_xr2_off(s,data,offset) once_execute_instruction2(s,0xA680|(offset&0x007f),data)
 
 /* MOVE x:(R0),Y0 */
-#define once_move_xr0_to_y0() once_execute_instruction1(0xf114)
+#define once_move_xr0_to_y0(s) once_execute_instruction1(s,0xf114)
 
 /* MOVE x:(R1),Y0 */
-#define once_move_xr1_to_y0() once_execute_instruction1(0xf115)
+#define once_move_xr1_to_y0(s) once_execute_instruction1(s,0xf115)
 
 /* MOVE x:(R2),Y0 */
-#define once_move_xr2_to_y0() once_execute_instruction1(0xf116)
+#define once_move_xr2_to_y0(s) once_execute_instruction1(s,0xf116)
 
 /* MOVE x:(R3),Y0 */
-#define once_move_xr3_to_y0() once_execute_instruction1(0xf117)
+#define once_move_xr3_to_y0(s) once_execute_instruction1(s,0xf117)
 
 /* MOVE Y0,x:(R1) */
-#define once_move_y0_to_xr1() once_execute_instruction1(0xd115)
+#define once_move_y0_to_xr1(s) once_execute_instruction1(s,0xd115)
 
 /* MOVE x:(R0)+,Y0 */
-#define once_move_xr0_inc_to_y0() once_execute_instruction1(0xf100)
+#define once_move_xr0_inc_to_y0(s) once_execute_instruction1(s,0xf100)
 
 /* MOVE x:(R1)+,Y0 */
-#define once_move_xr1_inc_to_y0() once_execute_instruction1(0xf101)
+#define once_move_xr1_inc_to_y0(s) once_execute_instruction1(s,0xf101)
 
 /* MOVE x:(R2)+,Y0 */
-#define once_move_xr2_inc_to_y0() once_execute_instruction1(0xf102)
+#define once_move_xr2_inc_to_y0(s) once_execute_instruction1(s,0xf102)
 
 /* MOVE x:(R3)+,Y0 */
-#define once_move_xr3_inc_to_y0() once_execute_instruction1(0xf103)
+#define once_move_xr3_inc_to_y0(s) once_execute_instruction1(s,0xf103)
 
 /* MOVE Y0,x:(R0)+ */
-#define once_move_y0_to_xr0_inc() once_execute_instruction1(0xd100)
+#define once_move_y0_to_xr0_inc(s) once_execute_instruction1(s,0xd100)
 
 /* MOVE Y0,x:(R1)+ */
-#define once_move_y0_to_xr1_inc() once_execute_instruction1(0xd101)
+#define once_move_y0_to_xr1_inc(s) once_execute_instruction1(s,0xd101)
 
 /* MOVE Y0,x:(R2)+ */
-#define once_move_y0_to_xr2_inc() once_execute_instruction1(0xd102)
+#define once_move_y0_to_xr2_inc(s) once_execute_instruction1(s,0xd102)
 
 /* MOVE Y0,x:(R3)+ */
-#define once_move_y0_to_xr3_inc() once_execute_instruction1(0xd103)
+#define once_move_y0_to_xr3_inc(s) once_execute_instruction1(s,0xd103)
 
 /* MOVE Y1,x:(R0)+ */
-#define once_move_y1_to_xr0_inc() once_execute_instruction1(0xd300)
+#define once_move_y1_to_xr0_inc(s) once_execute_instruction1(s,0xd300)
 
 /* MOVE R0,Y0 */
-#define once_move_r0_to_y0() once_execute_instruction1(0x8110)
+#define once_move_r0_to_y0(s) once_execute_instruction1(s,0x8110)
 
 /* MOVE R1,Y0 */
-#define once_move_r1_to_y0() once_execute_instruction1(0x8111)
+#define once_move_r1_to_y0(s) once_execute_instruction1(s,0x8111)
 
 /* MOVE R2,Y0 */
-#define once_move_r2_to_y0() once_execute_instruction1(0x8112)
+#define once_move_r2_to_y0(s) once_execute_instruction1(s,0x8112)
 
 /* MOVE R3,Y0 */
-#define once_move_r3_to_y0() once_execute_instruction1(0x8113)
+#define once_move_r3_to_y0(s) once_execute_instruction1(s,0x8113)
 
 /* MOVE OMR,Y0 */
-#define once_move_omr_to_y0() once_execute_instruction1(0x8118)
+#define once_move_omr_to_y0(s) once_execute_instruction1(s,0x8118)
 
 /* MOVE Y0,OMR */
-#define once_move_y0_to_omr() once_execute_instruction1(0x8881)
+#define once_move_y0_to_omr(s) once_execute_instruction1(s,0x8881)
 
 /* MOVE Y0,p:(R0)+ */
-#define once_move_y0_to_pr0_inc() once_execute_instruction1(0xe100)
+#define once_move_y0_to_pr0_inc(s) once_execute_instruction1(s,0xe100)
 
 /* MOVE Y0,p:(R1)+ */
-#define once_move_y0_to_pr1_inc() once_execute_instruction1(0xe101)
+#define once_move_y0_to_pr1_inc(s) once_execute_instruction1(s,0xe101)
 
 /* MOVE Y0,p:(R2)+ */
-#define once_move_y0_to_pr2_inc() once_execute_instruction1(0xe102)
+#define once_move_y0_to_pr2_inc(s) once_execute_instruction1(s,0xe102)
 
 /* MOVE Y0,p:(R3)+ */
-#define once_move_y0_to_pr3_inc() once_execute_instruction1(0xe103)
+#define once_move_y0_to_pr3_inc(s) once_execute_instruction1(s,0xe103)
 
 /* MOVE Y1,p:(R0)+ */
-#define once_move_y1_to_pr0_inc() once_execute_instruction1(0xe300)
+#define once_move_y1_to_pr0_inc(s) once_execute_instruction1(s,0xe300)
 
 /* MOVE p:(R0)+,Y0 */
-#define once_move_pr0_inc_to_y0() once_execute_instruction1(0xe120)
+#define once_move_pr0_inc_to_y0(s) once_execute_instruction1(s,0xe120)
 
 /* MOVE p:(R1)+,Y0 */
-#define once_move_pr1_inc_to_y0() once_execute_instruction1(0xe121)
+#define once_move_pr1_inc_to_y0(s) once_execute_instruction1(s,0xe121)
 
 /* MOVE p:(R2)+,Y0 */
-#define once_move_pr2_inc_to_y0() once_execute_instruction1(0xe122)
+#define once_move_pr2_inc_to_y0(s) once_execute_instruction1(s,0xe122)
 
 /* MOVE p:(R3)+,Y0 */
-#define once_move_pr3_inc_to_y0() once_execute_instruction1(0xe123)
+#define once_move_pr3_inc_to_y0(s) once_execute_instruction1(s,0xe123)
 
 /* MOVE sp,y0 */
-#define once_move_sr_to_y0() once_execute_instruction1(0x811d)
+#define once_move_sr_to_y0(s) once_execute_instruction1(s,0x811d)
 
 /* MOVE y0,sr */
-#define once_move_y0_to_sr() once_execute_instruction1(0x8d81)
+#define once_move_y0_to_sr(s) once_execute_instruction1(s,0x8d81)
 
 /* JMP addr */
-#define once_jmp(addr) once_execute_instruction2(0xE984,addr)
+#define once_jmp(s,addr) once_execute_instruction2(s,0xE984,addr)
 
 /* JMP addr + exit debug mode: execute JMP addr and NOP with exit from debug mode */
-#define once_jmp_run(addr) 	once_execute_instruction2(0xE984,addr);\
-once_execute_instruction1_run(0xe040)
+#define once_jmp_run(s,addr) 	(once_execute_instruction2(s,0xE984,addr),\
+once_execute_instruction1_run(s,0xe040))
+
+/* --------------- Fused instruction forms --------------- */
+/* selected by jtag.c instead of the longer sequences above in fused mode (-fuse) */
+/* the encodings were checked against the target simulator only (target_sim.c) */
+
+/* MOVE Y0,X:<<pp and MOVE X:<<pp,Y0 (one word, pp = address-FUSED_PP_BASE in bits 0-5), */
+/* short I/O addressing of the top 64 words of X memory, OPGDBR included */
+/* not selected by -fuse: every OnCE read goes through these moves, so they stay behind the */
+/* experimental -fusepp until the encodings are checked on hardware */
+#define FUSED_MOVE_Y0_PP	0xd1c0
+#define FUSED_MOVE_PP_Y0	0xf1c0
+#define FUSED_PP_BASE		0xffc0
+
+/* MOVE #<data>,X:(R2+xx) (two words, offset 0-127 in bits 0-6), immediate to memory without Y0 */
+/* not selected by -fuse: the original author found this form failing on silicon (see above), it */
+/* writes the FIU timing registers, so it stays behind -fuseimm until it is verified on hardware */
+#define FUSED_MOVE_DATA_XR2_OFF	0xa680
+
+/* --------------- Flash routine instructions --------------- */
+/* these are only executed from program RAM by the flash routine, never through the OnCE */
+/* the encodings were checked against the target simulator only (target_sim.c) */
+
+/* DEBUG - enter debug mode */
+#define STUB_DEBUG		0xe704
+
+/* DO Y0,<last address of loop> (two words) */
+#define STUB_DO_Y0		0xec41
+
+/* BRSET #<mask>,x:(Rn),* (two words, 2nd word is the mask) - loop while all mask bits are set */
+#define STUB_BRSET_XRN	0x1e80
+
+/* CLR A, CLR B */
+#define STUB_CLR_A		0x7d30
+#define STUB_CLR_B		0x7f30
+
+/* ADD Y1,A and ADD A,B */
+#define STUB_ADD_Y1_A	0x7a10
+#define STUB_ADD_A_B	0x7e70
+
+/* MOVE A1,x:(Rn)+ and MOVE B1,x:(Rn)+ (Rn in bits 0-1) */
+#define STUB_MOVE_A1_XRN	0xd500
+#define STUB_MOVE_B1_XRN	0xd700
 #endif
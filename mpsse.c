@@ -0,0 +1,300 @@
+/*****************************************************************************
+*
+* File Name:         mpsse.c
+*
+* Description:       JTAG scans driven by the FT232H MPSSE engine
+*
+* Modules Included:
+*	int mpsse_init(jtag_session *s, unsigned int divisor);
+*	void mpsse_set_divisor(jtag_session *s, unsigned int divisor);
+*	void mpsse_set_pins(jtag_session *s, unsigned int pins);
+*	int mpsse_get_tdo(jtag_session *s);
+*	void mpsse_tms(jtag_session *s, unsigned int tms, int count);
+*	void mpsse_shift(jtag_session *s, unsigned long int tdi, int bit_count, unsigned long int *tdo, int exit);
+*	void mpsse_pad(jtag_session *s, int bit_count, int exit);
+*	void mpsse_set_park(jtag_session *s, unsigned char mode);
+*	void mpsse_idle(jtag_session *s, unsigned long int cycles, int instruction, int instr_pl, int instr_pp);
+*	void mpsse_flush(jtag_session *s);
+*	int mpsse_instruction_exec(jtag_session *s, int instruction, int instr_pl, int instr_pp);
+*	unsigned long int mpsse_data_shift(jtag_session *s, unsigned long int data, int bit_count, int data_pl, int data_pp);
+*	void mpsse_data_write(jtag_session *s, unsigned int data, int bit_count, int data_pp);
+*	unsigned int mpsse_data_read16(jtag_session *s, int data_pl, int data_pp);
+*
+* Comments: Commands are queued and sent in one USB transfer. The queue is only
+*           flushed when it is full or when a result has to be returned to the caller.
+*           TDI/TMS change on the falling edge of TCK, TDO is sampled on the rising edge.
+*
+****************************************************************************/
+
+#include <ftdi.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hw_access.h"
+#include "mpsse.h"
+
+#define MPSSE_SHIFT_OUT		(MPSSE_DO_WRITE|MPSSE_LSB|MPSSE_WRITE_NEG)
+#define MPSSE_TMS_OUT		(MPSSE_WRITE_TMS|MPSSE_LSB|MPSSE_BITMODE|MPSSE_WRITE_NEG)
+
+/* makes sure the queue can take another command */
+static void mpsse_reserve(jtag_session *s, int bytes, int reads) {
+    if ((s->mpsse_count+bytes+1>MPSSE_BUFFER_SIZE)||(s->mpsse_read_count+reads>MPSSE_READS_MAX)) mpsse_flush(s);
+}
+
+static void mpsse_expect(jtag_session *s, unsigned long int *dest, int offset, int shift, int nbits) {
+    s->mpsse_reads[s->mpsse_read_count].dest=dest;
+    s->mpsse_reads[s->mpsse_read_count].offset=offset;
+    s->mpsse_reads[s->mpsse_read_count].shift=shift;
+    s->mpsse_reads[s->mpsse_read_count].nbits=nbits;
+    s->mpsse_read_count++;
+}
+
+/* sends the queue and distributes the returned bytes */
+void mpsse_flush(jtag_session *s) {
+    unsigned char result[MPSSE_READS_MAX];
+    int i,rc,got=0,retry=100;
+    if (s->mpsse_read_count) s->mpsse_buffer[s->mpsse_count++]=SEND_IMMEDIATE;
+    if (s->mpsse_count) jtag_usb_write(s,s->mpsse_buffer,s->mpsse_count);
+    s->mpsse_count=0;
+    while ((got<s->mpsse_read_count)&&(retry--)) {
+        rc=jtag_usb_read(s,result+got,s->mpsse_read_count-got);
+        if (rc<0) break;
+        got+=rc;
+    }
+    if (got<s->mpsse_read_count) printf("MPSSE read failed, %d of %d bytes received\n",got,s->mpsse_read_count);
+    for (i=0;i<got;i++) {
+        *(s->mpsse_reads[i].dest)|=((unsigned long int)((result[i]>>s->mpsse_reads[i].shift)&((1<<s->mpsse_reads[i].nbits)-1)))<<s->mpsse_reads[i].offset;
+    }
+    s->mpsse_read_count=0;
+}
+
+/* sets up the engine, returns 0 on success, -1 if the engine does not respond */
+int mpsse_init(jtag_session *s, unsigned int divisor) {
+    unsigned char sync[2];
+    int got=0,retry=100;
+    s->mpsse_count=0;
+    s->mpsse_read_count=0;
+    s->mpsse_buffer[s->mpsse_count++]=0xaa;			/* bogus command, the engine answers 0xfa 0xaa */
+    jtag_usb_write(s,s->mpsse_buffer,s->mpsse_count);
+    s->mpsse_count=0;
+    while ((got<2)&&(retry--)) {
+        int rc=jtag_usb_read(s,sync+got,2-got);
+        if (rc<0) break;
+        got+=rc;
+    }
+    if ((got<2)||(sync[0]!=0xfa)||(sync[1]!=0xaa)) {
+        printf("MPSSE engine not responding\n");
+        return(-1);
+    }
+    s->mpsse_buffer[s->mpsse_count++]=LOOPBACK_END;
+    s->mpsse_buffer[s->mpsse_count++]=DIS_DIV_5;		/* 60MHz master clock */
+    s->mpsse_buffer[s->mpsse_count++]=DIS_ADAPTIVE;
+    s->mpsse_buffer[s->mpsse_count++]=DIS_3_PHASE;
+    s->mpsse_buffer[s->mpsse_count++]=TCK_DIVISOR;	/* TCK = 60MHz/(2*(divisor+1)) */
+    s->mpsse_buffer[s->mpsse_count++]=divisor&0xff;
+    s->mpsse_buffer[s->mpsse_count++]=(divisor>>8)&0xff;
+    mpsse_set_pins(s,JTAG_TMS_MASK|JTAG_RESET_MASK|JTAG_TRST_MASK);
+    mpsse_flush(s);
+    printf("MPSSE engine running, TCK %.3f MHz\n",30.0/(divisor+1));
+    return(0);
+}
+
+/* queues a new TCK divisor, the scans queued before still run at the old rate */
+void mpsse_set_divisor(jtag_session *s, unsigned int divisor) {
+    mpsse_reserve(s,3,0);
+    s->mpsse_buffer[s->mpsse_count++]=TCK_DIVISOR;
+    s->mpsse_buffer[s->mpsse_count++]=divisor&0xff;
+    s->mpsse_buffer[s->mpsse_count++]=(divisor>>8)&0xff;
+    s->tck_divisor=divisor;
+}
+
+/* drives the pins from the bit-bang pin mirror (see hw_access.h) */
+void mpsse_set_pins(jtag_session *s, unsigned int pins) {
+    unsigned char value=0;
+    if (pins&JTAG_TCK_MASK) value|=MPSSE_TCK_PIN;
+    if (pins&JTAG_TDI_MASK) value|=MPSSE_TDI_PIN;
+    if (pins&JTAG_TMS_MASK) value|=MPSSE_TMS_PIN;
+    if (pins&JTAG_RESET_MASK) value|=MPSSE_RESET_PIN;
+    if (pins&JTAG_TRST_MASK) value|=MPSSE_TRST_PIN;
+    mpsse_reserve(s,3,0);
+    s->mpsse_buffer[s->mpsse_count++]=SET_BITS_LOW;
+    s->mpsse_buffer[s->mpsse_count++]=value;
+    s->mpsse_buffer[s->mpsse_count++]=MPSSE_OUTPUTS;
+}
+
+/* reads the current level of TDO */
+int mpsse_get_tdo(jtag_session *s) {
+    unsigned long int pins=0;
+    mpsse_reserve(s,1,1);
+    s->mpsse_buffer[s->mpsse_count++]=GET_BITS_LOW;
+    mpsse_expect(s,&pins,0,0,8);
+    mpsse_flush(s);
+    return((pins&MPSSE_TDO_PIN)?1:0);
+}
+
+/* clocks up to 7 TMS bits (LSB first), TDI is held high */
+void mpsse_tms(jtag_session *s, unsigned int tms, int count) {
+    mpsse_reserve(s,3,0);
+    s->jtag_stats.tck_cycles+=count;
+    s->mpsse_buffer[s->mpsse_count++]=MPSSE_TMS_OUT;
+    s->mpsse_buffer[s->mpsse_count++]=count-1;
+    s->mpsse_buffer[s->mpsse_count++]=0x80|(tms&0x7f);
+}
+
+/* shifts up to 32 bits LSB first in the Shift-IR/DR state */
+/* if tdo!=NULL the TDO bits are stored there once the queue is flushed (*tdo must be 0) */
+/* if exit!=0 the last bit is clocked with TMS=1 and the TAP continues through Update to Select-DR-Scan */
+void mpsse_shift(jtag_session *s, unsigned long int tdi, int bit_count, unsigned long int *tdo, int exit) {
+    int i,bytes,bits,n;
+    unsigned char cmd=MPSSE_SHIFT_OUT|(tdo?MPSSE_DO_READ:0);
+    if (bit_count<=0) return;
+    n=exit?bit_count-1:bit_count;
+    bytes=n/8;
+    bits=n%8;
+    mpsse_reserve(s,bytes+8,bytes+2);
+    s->jtag_stats.tck_cycles+=exit?bit_count+2:bit_count;
+    if (bytes) {
+        s->mpsse_buffer[s->mpsse_count++]=cmd;
+        s->mpsse_buffer[s->mpsse_count++]=bytes-1;
+        s->mpsse_buffer[s->mpsse_count++]=0;
+        for (i=0;i<bytes;i++) {
+            s->mpsse_buffer[s->mpsse_count++]=(tdi>>(8*i))&0xff;
+            if (tdo) mpsse_expect(s,tdo,8*i,0,8);
+        }
+    }
+    if (bits) {
+        s->mpsse_buffer[s->mpsse_count++]=cmd|MPSSE_BITMODE;
+        s->mpsse_buffer[s->mpsse_count++]=bits-1;
+        s->mpsse_buffer[s->mpsse_count++]=(tdi>>(8*bytes))&0xff;
+        if (tdo) mpsse_expect(s,tdo,8*bytes,8-bits,bits);	/* bits are shifted in from the top */
+    }
+    if (exit) {
+        s->mpsse_buffer[s->mpsse_count++]=MPSSE_TMS_OUT|(tdo?MPSSE_DO_READ:0);
+        s->mpsse_buffer[s->mpsse_count++]=2;			/* Exit1, Update, Select-DR-Scan */
+        s->mpsse_buffer[s->mpsse_count++]=(((tdi>>n)&1)<<7)|0x07;
+        if (tdo) mpsse_expect(s,tdo,n,5,1);		/* only the first of three samples is valid */
+    }
+}
+
+/* shifts bit_count ones, used for the devices in BYPASS */
+/* the whole bytes are clocked by one command, the rest and the exit by mpsse_shift */
+void mpsse_pad(jtag_session *s, int bit_count, int exit) {
+    int i,n,bytes;
+    if (bit_count<=0) return;
+    s->jtag_stats.pad_cycles+=bit_count;
+    bytes=(exit?bit_count-1:bit_count)/8;
+    while (bytes) {
+        n=(bytes>MPSSE_BUFFER_SIZE/2)?MPSSE_BUFFER_SIZE/2:bytes;
+        mpsse_reserve(s,n+3,0);
+        s->jtag_stats.tck_cycles+=8*n;
+        s->mpsse_buffer[s->mpsse_count++]=MPSSE_SHIFT_OUT;
+        s->mpsse_buffer[s->mpsse_count++]=(n-1)&0xff;
+        s->mpsse_buffer[s->mpsse_count++]=((n-1)>>8)&0xff;
+        for (i=0;i<n;i++) s->mpsse_buffer[s->mpsse_count++]=0xff;
+        bit_count-=8*n;
+        bytes-=n;
+    }
+    mpsse_shift(s,0xffffffff,bit_count,NULL,exit);
+}
+
+/* with -park the commands from Select-DR-Scan to Shift-IR and the BYPASS ones of the parts in front */
+/* of the DSP are built once per chain configuration and copied into the queue */
+void mpsse_set_park(jtag_session *s, unsigned char mode) {
+    s->mpsse_park=mode;
+}
+
+static void mpsse_ir_prefix(jtag_session *s, int pad) {
+    int start;
+    if (!s->mpsse_park) {
+        mpsse_tms(s,0x01,3);						/* Select-IR-Scan, Capture-IR, Shift-IR */
+        mpsse_pad(s,pad,0);
+        return;
+    }
+    if (s->mpsse_prefix_pad!=pad) {
+        mpsse_reserve(s,sizeof(s->mpsse_prefix),0);		/* built in one piece, the queue is not flushed on the way */
+        start=s->mpsse_count;
+        mpsse_tms(s,0x01,3);
+        mpsse_pad(s,pad,0);
+        s->mpsse_prefix_count=s->mpsse_count-start;
+        memcpy(s->mpsse_prefix,s->mpsse_buffer+start,s->mpsse_prefix_count);
+        s->mpsse_prefix_pad=pad;
+        return;
+    }
+    mpsse_reserve(s,s->mpsse_prefix_count,0);
+    memcpy(s->mpsse_buffer+s->mpsse_count,s->mpsse_prefix,s->mpsse_prefix_count);
+    s->mpsse_count+=s->mpsse_prefix_count;
+    s->jtag_stats.tck_cycles+=3+((pad>0)?pad:0);
+    if (pad>0) s->jtag_stats.pad_cycles+=pad;
+}
+
+/* clocks at least cycles TCK cycles in Run-Test/Idle, the TAP returns to Select-DR-Scan */
+/* the instruction is loaded again on the way (the other devices get BYPASS), so no DR is updated */
+void mpsse_idle(jtag_session *s, unsigned long int cycles, int instruction, int instr_pl, int instr_pp) {
+    unsigned long int n;
+    int last;									/* the bit shifted on the way to Exit1-IR */
+    mpsse_ir_prefix(s,instr_pl-instr_pp-4);		/* Select-IR-Scan, Capture-IR, Shift-IR */
+    if (instr_pp) {
+        mpsse_shift(s,instruction,4,NULL,0);
+        mpsse_pad(s,instr_pp-1,0);
+        last=1;
+    } else {
+        mpsse_shift(s,instruction,3,NULL,0);
+        last=(instruction>>3)&1;
+    }
+    mpsse_reserve(s,3,0);
+    s->jtag_stats.tck_cycles+=3;
+    s->mpsse_buffer[s->mpsse_count++]=MPSSE_TMS_OUT;
+    s->mpsse_buffer[s->mpsse_count++]=2;				/* last IR bit, Exit1-IR, Update-IR, Run-Test/Idle */
+    s->mpsse_buffer[s->mpsse_count++]=(last<<7)|0x03;
+    while (cycles) {
+        n=(cycles+7)/8;							/* the engine clocks whole bytes, up to 65536 of them */
+        if (n>65536) n=65536;
+        mpsse_reserve(s,3,0);
+        s->mpsse_buffer[s->mpsse_count++]=CLK_BYTES;
+        s->mpsse_buffer[s->mpsse_count++]=(n-1)&0xff;
+        s->mpsse_buffer[s->mpsse_count++]=((n-1)>>8)&0xff;
+        s->jtag_stats.tck_cycles+=8*n;
+        cycles-=(cycles<8*n)?cycles:8*n;
+    }
+    mpsse_tms(s,0x01,1);							/* Select-DR-Scan */
+}
+
+/* Executes Jtag command */
+/* expects Select-DR-Scan state of the Jtag state machine state upon entry */
+/* and leaves the Jtag in Select-DR-Scan on exit */
+int mpsse_instruction_exec(jtag_session *s, int instruction, int instr_pl, int instr_pp) {
+    unsigned long int status=0;
+    mpsse_ir_prefix(s,instr_pl-instr_pp-4);		/* Select-IR-Scan, Capture-IR, Shift-IR */
+    mpsse_shift(s,instruction,4,&status,instr_pp==0);
+    mpsse_pad(s,instr_pp,1);
+    mpsse_flush(s);
+    return((int)status);
+}
+
+/* shifts up to 32 bits in and out of the jtag DR path */
+unsigned long int mpsse_data_shift(jtag_session *s, unsigned long int data, int bit_count, int data_pl, int data_pp) {
+    unsigned long int result=0;
+    mpsse_tms(s,0x00,2);							/* Capture-DR, Shift-DR */
+    mpsse_pad(s,data_pl-1-data_pp,0);
+    mpsse_shift(s,data,bit_count,&result,data_pp==0);
+    mpsse_pad(s,data_pp,1);
+    mpsse_flush(s);
+    return(result);
+}
+
+/* writes bit_count bits to the jtag DR path, the scan is only queued */
+void mpsse_data_write(jtag_session *s, unsigned int data, int bit_count, int data_pp) {
+    mpsse_tms(s,0x00,2);							/* Capture-DR, Shift-DR */
+    mpsse_shift(s,data,bit_count,NULL,data_pp==0);
+    mpsse_pad(s,data_pp,1);
+}
+
+/* reads 16 bits from the jtag DR path */
+unsigned int mpsse_data_read16(jtag_session *s, int data_pl, int data_pp) {
+    unsigned long int result=0;
+    mpsse_tms(s,0x00,2);							/* Capture-DR, Shift-DR */
+    mpsse_pad(s,data_pl-1-data_pp,0);
+    mpsse_shift(s,0xffff,16,&result,1);			/* leave Shift-DR right after the data, as the bit-bang version does */
+    mpsse_flush(s);
+    return((unsigned int)result);
+}
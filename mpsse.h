@@ -0,0 +1,52 @@
+/*****************************************************************************
+*
+* File Name:         mpsse.h
+*
+* Description:       FT232H MPSSE JTAG engine prototypes and pin assignment
+*
+* Modules Included:  None
+*
+****************************************************************************/
+
+#ifndef MPSSE____H
+#define MPSSE____H
+
+/* MPSSE pinout of the FT232H (ADBUS), TCK/TDI/TDO/TMS are fixed by the MPSSE engine */
+#define MPSSE_TCK_PIN		0x01	/* ADBUS0 */
+#define MPSSE_TDI_PIN		0x02	/* ADBUS1 */
+#define MPSSE_TDO_PIN		0x04	/* ADBUS2 */
+#define MPSSE_TMS_PIN		0x08	/* ADBUS3 */
+#define MPSSE_RESET_PIN		0x10	/* ADBUS4 (GPIOL0) */
+#define MPSSE_TRST_PIN		0x20	/* ADBUS5 (GPIOL1) */
+#define MPSSE_OUTPUTS		(MPSSE_TCK_PIN|MPSSE_TDI_PIN|MPSSE_TMS_PIN|MPSSE_RESET_PIN|MPSSE_TRST_PIN)
+
+#define MPSSE_DEFAULT_DIVISOR	14		/* TCK = 30MHz/(divisor+1) = 2MHz */
+#define MPSSE_DIVISOR_MAX	0xffff	/* 458Hz */
+#define MPSSE_BUFFER_SIZE	4096	/* command queue size, flushed when full or when data must be read */
+#define MPSSE_READS_MAX		512		/* max. number of bytes the engine returns per flush */
+
+typedef struct {
+    unsigned long int *dest;	/* where to put the bits */
+    int offset;					/* bit position of the result in *dest */
+    int shift;					/* position of the first valid bit in the returned byte */
+    int nbits;					/* number of valid bits in the returned byte */
+} mpsse_read;
+
+int mpsse_init(jtag_session *s, unsigned int divisor);
+void mpsse_set_divisor(jtag_session *s, unsigned int divisor);	/* TCK = 30MHz/(divisor+1) from the next command on */
+void mpsse_set_pins(jtag_session *s, unsigned int pins);
+int mpsse_get_tdo(jtag_session *s);
+void mpsse_tms(jtag_session *s, unsigned int tms, int count);
+void mpsse_shift(jtag_session *s, unsigned long int tdi, int bit_count, unsigned long int *tdo, int exit);
+void mpsse_pad(jtag_session *s, int bit_count, int exit);
+void mpsse_set_park(jtag_session *s, unsigned char mode);	/* 1: IR prefixes built once and copied */
+void mpsse_idle(jtag_session *s, unsigned long int cycles, int instruction, int instr_pl, int instr_pp);
+void mpsse_flush(jtag_session *s);
+
+/* scan level operations, the same contract as the bit-bang versions in jtag.c */
+int mpsse_instruction_exec(jtag_session *s, int instruction, int instr_pl, int instr_pp);
+unsigned long int mpsse_data_shift(jtag_session *s, unsigned long int data, int bit_count, int data_pl, int data_pp);
+void mpsse_data_write(jtag_session *s, unsigned int data, int bit_count, int data_pp);
+unsigned int mpsse_data_read16(jtag_session *s, int data_pl, int data_pp);
+
+#endif
@@ -12,10 +12,10 @@
 *
 * Modules Included:
 *	unsigned int hex2dec(char *bcd);
-*	int s_line_process(char *line, unsigned long int *addr, unsigned int *data);
+*	int s_line_process(jtag_session *s, char *line, unsigned long int *addr, unsigned int *data);
 *	int find_flash(unsigned long int addr, flash_constants flash_param[], int flash_count);
 *	int place_data(unsigned long int addr, unsigned int data, flash_constants flash_param[], int flash_count);
-*	int read_s_record(char *path, flash_constants flash_param[], int flash_count);
+*	int read_s_record(jtag_session *s, char *path, flash_constants flash_param[], int flash_count);
 *	int write_s_record(char *path, mem_read_constants mem_read);
 *	void s_line_write(FILE *output, int type, int length, long int addr, void *data);
 *
@@ -28,14 +28,13 @@
 #include <time.h>
 #include <string.h>
 #include "flash.h"
+#include "jtag.h"
 #include "flash_over_jtag.h"
 #include "srec.h"
 
-char checksums=1;	/* check checksums by default */
-
 /* 1= perfor checks, 0= ignore checksums */
-void srec_check_checksums(char i) {
-    checksums=i;
+void srec_check_checksums(jtag_session *s, char i) {
+    s->checksums=i;
 }
 
 /* converts 2 consecutive BCD numbers to unsigned integer value */
@@ -61,7 +60,7 @@ unsigned int hex2dec(char *bcd) {
 /* Processes line of the S-record file */
 /* returns: -1: format error, -2: line does not contain data, >0: number of converted data words */
 /* checksum is ignored !!! */
-int s_line_process(char *line, unsigned long int *addr, unsigned int *data) {
+int s_line_process(jtag_session *s, char *line, unsigned long int *addr, unsigned int *data) {
     int i,length,sum;
     if (line[0]!='S') {
         printf("S-record file line does not start with \"S\"\n");
@@ -86,7 +85,7 @@ int s_line_process(char *line, unsigned long int *addr, unsigned int *data) {
         sum%=256;
         if (sum) {
             printf("S-record checksum error\n");
-            if (checksums) return (-1);
+            if (s->checksums) return (-1);
             printf("Error ignored\n");
         }
         return((length-5)/2);
@@ -105,7 +104,7 @@ int s_line_process(char *line, unsigned long int *addr, unsigned int *data) {
         sum%=256;
         if (sum) {
             printf("S-record checksum error\n");
-            if (checksums) return (-1);
+            if (s->checksums) return (-1);
             printf("Error ignored\n");
         }
         return(-2);
@@ -141,7 +140,7 @@ int place_data(unsigned long int addr, unsigned int data, flash_constants flash_
 
 /* Reads s-record file */
 /* returns 0 on success, -1 on file error */
-int read_s_record(char *path, flash_constants flash_param[], int flash_count, char *serror) {
+int read_s_record(jtag_session *s, char *path, flash_constants flash_param[], int flash_count) {
     FILE *input;
     char line[MAX_LINE_LENGTH+1];
     unsigned int line_data[MAX_WORDS_PER_LINE];
@@ -155,12 +154,12 @@ int read_s_record(char *path, flash_constants flash_param[], int flash_count, ch
     }
     while (!feof(input)) {
         fgets(line,MAX_LINE_LENGTH,input);
-        j=s_line_process(line,&addr,line_data);
+        j=s_line_process(s,line,&addr,line_data);
         if (j>0) for (i=0;i<j;i++) if (place_data(addr+i,line_data[i], flash_param, flash_count)) {
-                    if ((*serror)==1) {
+                    if (s->serror==1) {
                         printf("Some data ignored, details not reported (silent mode)\n");
-                        (*serror)++;
-                    } else if (*serror==0) printf("Data @ 0x%X ignored\n",addr%65536);
+                        s->serror++;
+                    } else if (s->serror==0) printf("Data @ 0x%X ignored\n",addr%65536);
                 }
     }
     for (j=0;j<flash_count;j++) {
@@ -20,6 +20,7 @@
 #define SREC_H__
 
 #include "flash.h"
+#include "jtag.h"
 #include "flash_over_jtag.h"
 
 #define MAX_LINE_LENGTH		300					/* max line length in input S files */
@@ -27,12 +28,12 @@
 #define OUTPUT_S_REC_DATA_PER_LINE 16
 
 unsigned int hex2dec(char *bcd);
-int s_line_process(char *line, unsigned long int *addr, unsigned int *data);
+int s_line_process(jtag_session *s, char *line, unsigned long int *addr, unsigned int *data);
 int find_flash(unsigned long int addr, flash_constants flash_param[], int flash_count);
 int place_data(unsigned long int addr, unsigned int data, flash_constants flash_param[], int flash_count);
-int read_s_record(char *path, flash_constants flash_param[], int flash_count, char *serror);
+int read_s_record(jtag_session *s, char *path, flash_constants flash_param[], int flash_count);	/* s->serror selects the error reports */
 int write_s_record(char *path, mem_read_constants mem_read);
 void s_line_write(FILE *output, int type, int length, long int addr, void *data);
-void srec_check_checksums(char i);
+void srec_check_checksums(jtag_session *s, char i);
 
 #endif
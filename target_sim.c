@@ -0,0 +1,861 @@
+/*****************************************************************************
+*
+* File Name:         target_sim.c
+*
+* Description:       Software model of a JTAG chain with DSP56F80x targets,
+*                    used in place of the FT232H for benchmarking without hardware
+*
+* Modules Included:
+*	int sim_configure(jtag_session *s, char *chain);
+*	void sim_free(jtag_session *s);
+*	int sim_copy(jtag_session *dst, jtag_session *src);
+*	void sim_set_latency(jtag_session *s, double latency_us);
+*	void sim_set_tck_limit(jtag_session *s, double mhz);
+*	void sim_attach_flash(jtag_session *s, flash_constants flash_param[], int flash_count);
+*	double sim_time(jtag_session *s);
+*
+* Comments: The model covers
+*           - the FT232H bit-bang, synchronous bit-bang and MPSSE command streams
+*           - the TAP state machine of every device in the chain, other devices only implement BYPASS
+*           - IDCODE, DEBUG_REQUEST and ENABLE_ONCE of the DSP, OnCE command, OPDBR and OPGDBR registers
+*           - the 56800 instructions emitted by the macros in jtag.h and used by the flash routine
+*             in program RAM (jtag.c), running code is executed at SIM_INSTR_TIME_US per word
+*           - the flash interface units with BUSY timing derived from the config file
+*           /RESET is active low on the pin (bit cleared = target in reset), as wired in README.md.
+*           Time is simulated: every USB transfer costs SIM_USB_LATENCY_US, every pin update
+*           1/SIM_BITBANG_RATE and every MPSSE clock one TCK period. Above the frequency set by
+*           sim_set_tck_limit TDO is read wrong now and then, to exercise the TCK calibration.
+*
+****************************************************************************/
+
+#include <ftdi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hw_access.h"
+#include "mpsse.h"
+#include "target_sim.h"
+
+/* TAP states */
+enum { TLR, RTI, SELDR, CAPDR, SHDR, EX1DR, PADR, EX2DR, UPDR, SELIR, CAPIR, SHIR, EX1IR, PAIR, EX2IR, UPIR };
+
+static const unsigned char tap_next[16][2] = {
+    {RTI,TLR},{RTI,SELDR},{CAPDR,SELIR},{SHDR,EX1DR},{SHDR,EX1DR},{PADR,UPDR},{PADR,EX2DR},{SHDR,UPDR},
+    {RTI,SELDR},{CAPIR,TLR},{SHIR,EX1IR},{SHIR,EX1IR},{PAIR,UPIR},{PAIR,EX2IR},{SHIR,UPIR},{RTI,SELDR}
+};
+
+/* DSP JTAG instructions */
+#define SIM_IR_IDCODE		0x2
+#define SIM_IR_ENABLE_ONCE	0x6
+#define SIM_IR_DEBUG_REQ	0x7
+
+/* core modes, the values are the OS bits reported in the JTAG IR capture */
+#define SIM_RUNNING		0
+#define SIM_RESET		2
+#define SIM_DEBUG		3
+
+/* OnCE phases */
+#define ONCE_COMMAND	0
+#define ONCE_WRITE		1
+#define ONCE_READ		2
+
+#define SIM_FIU_MAX		8
+#define SIM_REGIONS_MAX	MAX_FLASH_UNITS
+
+typedef struct {
+    unsigned int	address;		/* interface_address */
+    unsigned int	regs[17];		/* CNTL, PE, EE, ADDR, DATA, IE, IS, IP, CKDIVISOR, TERASEL, TMEL, TNVSL, TPGSL, TPROGL, TNVHL, TNVHL1, TRCVL */
+    double			busy_until;		/* simulated time at which BUSY clears */
+} sim_fiu;
+
+typedef struct {
+    unsigned int	start, end;		/* flash block */
+    unsigned int	program_memory;
+    int				fiu;			/* index of the interface unit */
+} sim_region;
+
+typedef struct {
+    int				mode;			/* SIM_RUNNING, SIM_RESET, SIM_DEBUG */
+    int				debug_request;	/* DEBUG_REQUEST seen while in reset */
+    int				once_phase;
+    unsigned int	once_cmd;
+    unsigned int	once_read;		/* value returned by the data phase of a read command */
+    unsigned int	opdbr, opgdbr;
+    int				opdbr_pending;	/* first word of a two-word instruction received */
+    unsigned int	r[4], y0, y1, omr, sr, pc;
+    unsigned int	a1, b1;			/* integer part of the accumulators, the extension bits are not modelled */
+    unsigned int	la, lc, ls;		/* DO loop: last address, count, first address */
+    int				loop;			/* DO loop active */
+    int				stalled;		/* running code hit an instruction the model does not know */
+    double			clock;			/* simulated time up to which the core has executed */
+    unsigned short	x[0x10000];		/* data memory */
+    unsigned short	p[0x10000];		/* program memory */
+    sim_fiu			fiu[SIM_FIU_MAX];
+    int				fiu_count;
+    sim_region		region[SIM_REGIONS_MAX];
+    int				region_count;
+} sim_core;
+
+typedef struct {
+    int				ir_len;			/* 4 for the DSP */
+    sim_core		*core;			/* NULL for devices which only implement BYPASS */
+    int				state;
+    unsigned int	ir, ir_shift;
+    unsigned long int dr_shift;
+    int				dr_len;
+    int				tdo;			/* output latched on the falling edge of TCK */
+} sim_device;
+
+/* state of one simulated chain, every session has its own (jtag_session.sim) */
+typedef struct {
+    sim_device		chain[SIM_DEVICES_MAX];	/* index 0 is connected to TDI */
+    int				devices;
+    double			now;			/* simulated time in microseconds */
+    double			event;			/* time of the access being modelled: now or the clock of a running core */
+    double			latency;
+    double			tck_period;		/* MPSSE TCK period in microseconds */
+    double			tck_min;		/* shortest period the board carries cleanly, 0=no limit */
+    unsigned int	noise;			/* state of the TDO error generator */
+    unsigned char	bitmode;
+    unsigned char	pins;			/* bit-bang pin state, JTAG_xxx_MASK bits */
+    unsigned char	rx[0x10000];	/* bytes waiting to be read by the host */
+    unsigned int	rx_head, rx_tail;
+    unsigned char	cmd[0x10000+8];	/* incomplete MPSSE command carried over to the next write */
+    int				cmd_count;
+} sim_state;
+
+static void sim_rx_put(sim_state *sim, unsigned char c) {
+    sim->rx[sim->rx_head]=c;
+    sim->rx_head=(sim->rx_head+1)&0xffff;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* flash interface units */
+
+static double fiu_ticks(sim_fiu *fiu, unsigned int ticks) {
+    return(ticks*2.0*(fiu->regs[8]+1)*1e6/SIM_IPBUS_CLOCK);
+}
+
+static sim_region *sim_find_region(sim_core *core, unsigned int addr, int program_memory) {
+    int i;
+    for (i=0;i<core->region_count;i++) {
+        if ((core->region[i].program_memory==(unsigned int)program_memory)&&(addr>=core->region[i].start)&&(addr<=core->region[i].end))
+            return(&(core->region[i]));
+    }
+    return(NULL);
+}
+
+static sim_fiu *sim_find_fiu(sim_core *core, unsigned int addr) {
+    int i;
+    for (i=0;i<core->fiu_count;i++) {
+        if ((addr>=core->fiu[i].address)&&(addr<core->fiu[i].address+17)) return(&(core->fiu[i]));
+    }
+    return(NULL);
+}
+
+static void sim_erase(sim_core *core, sim_region *region, unsigned int start, unsigned int end) {
+    unsigned short *mem=region->program_memory?core->p:core->x;
+    unsigned int a;
+    if (start<region->start) start=region->start;
+    if (end>region->end) end=region->end;
+    for (a=start;a<=end;a++) mem[a]=0xffff;
+}
+
+/* write into a flash block, starts program or erase depending on the FIU registers */
+static void sim_flash_write(sim_state *sim, sim_core *core, sim_region *region, unsigned int addr, unsigned int data) {
+    sim_fiu *fiu=&(core->fiu[region->fiu]);
+    unsigned short *mem=region->program_memory?core->p:core->x;
+    unsigned int *t=fiu->regs;
+    int i;
+    if (sim->event<fiu->busy_until) {
+        printf("SIM: flash write at %#x while FIU %#x is busy, ignored\n",addr,fiu->address);
+        return;
+    }
+    if (t[2]&0x4000) {							/* FIU_EE: erase */
+        if (t[0]&0x0002) {						/* mass erase of all blocks behind this FIU */
+            for (i=0;i<core->region_count;i++) {
+                if (core->region[i].fiu==region->fiu) sim_erase(core,&(core->region[i]),core->region[i].start,core->region[i].end);
+            }
+            fiu->busy_until=sim->event+fiu_ticks(fiu,t[11]+t[10]+t[15]+t[16]);
+        } else {								/* page erase */
+            sim_erase(core,region,addr&0xff00,addr|0x00ff);
+            fiu->busy_until=sim->event+fiu_ticks(fiu,t[11]+t[9]+t[14]+t[16]);
+        }
+        return;
+    }
+    if (t[1]&0x4000) {							/* FIU_PE: program */
+        if ((t[1]&0x03ff)!=((addr>>5)&0x03ff)) {
+            printf("SIM: program at %#x outside the enabled row %#x, ignored\n",addr,t[1]&0x03ff);
+            return;
+        }
+        mem[addr]&=data;						/* programming can only clear bits */
+        fiu->busy_until=sim->event+fiu_ticks(fiu,t[11]+t[12]+t[13]+t[14]+t[16]);
+        return;
+    }
+    printf("SIM: write to flash at %#x without program or erase enabled, ignored\n",addr);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* memory */
+
+static unsigned int sim_xread(sim_state *sim, sim_core *core, unsigned int addr) {
+    sim_fiu *fiu=sim_find_fiu(core,addr);
+    if (fiu) {
+        if (addr==fiu->address) return((fiu->regs[0]&0x7fff)|((sim->event<fiu->busy_until)?0x8000:0));
+        return(fiu->regs[addr-fiu->address]);
+    }
+    return(core->x[addr]);
+}
+
+static void sim_xwrite(sim_state *sim, sim_core *core, unsigned int addr, unsigned int data) {
+    sim_fiu *fiu;
+    sim_region *region;
+    data&=0xffff;
+    if (addr==0xffff) {							/* OPGDBR */
+        core->opgdbr=data;
+        return;
+    }
+    if ((fiu=sim_find_fiu(core,addr))!=NULL) {
+        fiu->regs[addr-fiu->address]=data&((addr==fiu->address)?0x7fff:0xffff);
+        return;
+    }
+    if ((region=sim_find_region(core,addr,0))!=NULL) {
+        sim_flash_write(sim,core,region,addr,data);
+        return;
+    }
+    core->x[addr]=data;
+}
+
+static unsigned int sim_pread(sim_core *core, unsigned int addr) {
+    return(core->p[addr]);
+}
+
+static void sim_pwrite(sim_state *sim, sim_core *core, unsigned int addr, unsigned int data) {
+    sim_region *region;
+    if ((region=sim_find_region(core,addr,1))!=NULL) {
+        sim_flash_write(sim,core,region,addr,data&0xffff);
+        return;
+    }
+    core->p[addr]=data&0xffff;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* 56800 core, the subset of instructions used by jtag.h */
+
+/* number of words of an instruction */
+static int sim_insn_words(unsigned int op) {
+    if ((op&0xfffc)==0x87d0) return(2);		/* MOVE #xxxx,Rn */
+    if ((op&0xfffc)==STUB_BRSET_XRN) return(2);	/* BRSET #mask,X:(Rn),* */
+    if ((op&0xff80)==FUSED_MOVE_DATA_XR2_OFF) return(2);	/* MOVE #xxxx,X:(R2+xx) */
+    switch (op) {
+    case STUB_DO_Y0:							/* DO Y0,xxxx */
+    case 0x87c1:								/* MOVE #xxxx,Y0 */
+    case 0x87c3:								/* MOVE #xxxx,Y1 */
+    case 0xd154:								/* MOVE Y0,x:xxxx */
+    case 0xf154:								/* MOVE x:xxxx,Y0 */
+    case 0xe984:								/* JMP xxxx */
+        return(2);
+    }
+    return(1);
+}
+
+/* effective address of the (Rn) / (Rn)+ addressing modes */
+static unsigned int sim_ea(sim_core *core, unsigned int op) {
+    unsigned int n=op&3, addr=core->r[n];
+    if ((op&0x14)!=0x14) core->r[n]=(core->r[n]+1)&0xffff;	/* post-increment */
+    return(addr);
+}
+
+/* executes one instruction, returns 0 on success, -1 on unknown instruction */
+/* instructions fed through the OnCE do not advance PC, sim_core_step() does it for code run from memory */
+static int sim_execute(sim_state *sim, sim_core *core, unsigned int op, unsigned int op2) {
+    if ((op&0xfffc)==0x87d0) {					/* MOVE #xxxx,Rn */
+        core->r[op&3]=op2;
+        return(0);
+    }
+    switch (op) {
+    case 0x87c1: core->y0=op2; return(0);
+    case 0x87c3: core->y1=op2; return(0);
+    case 0xd154: sim_xwrite(sim,core,op2,core->y0); return(0);
+    case 0xf154: core->y0=sim_xread(sim,core,op2); return(0);
+    case 0xe984: core->pc=op2; return(0);
+    case 0xe040: return(0);						/* NOP */
+    case 0x8118: core->y0=core->omr; return(0);
+    case 0x8881: core->omr=core->y0; return(0);
+    case 0x811d: core->y0=core->sr; return(0);
+    case 0x8d81: core->sr=core->y0; return(0);
+    case STUB_DEBUG:							/* DEBUG */
+        core->mode=SIM_DEBUG;
+        return(0);
+    case STUB_CLR_A: core->a1=0; return(0);
+    case STUB_CLR_B: core->b1=0; return(0);
+    case STUB_ADD_Y1_A: core->a1=(core->a1+core->y1)&0xffff; return(0);
+    case STUB_ADD_A_B: core->b1=(core->b1+core->a1)&0xffff; return(0);
+    case STUB_DO_Y0:							/* DO Y0,<last address> */
+        core->ls=core->pc;
+        core->la=op2;
+        core->lc=core->y0;
+        core->loop=1;
+        return(0);
+    }
+    if ((op&0xffc0)==FUSED_MOVE_Y0_PP) {		/* MOVE Y0,X:<<pp */
+        sim_xwrite(sim,core,FUSED_PP_BASE|(op&0x3f),core->y0);
+        return(0);
+    }
+    if ((op&0xffc0)==FUSED_MOVE_PP_Y0) {		/* MOVE X:<<pp,Y0 */
+        core->y0=sim_xread(sim,core,FUSED_PP_BASE|(op&0x3f));
+        return(0);
+    }
+    if ((op&0xff80)==FUSED_MOVE_DATA_XR2_OFF) {	/* MOVE #xxxx,X:(R2+xx) */
+        sim_xwrite(sim,core,(core->r[2]+(op&0x7f))&0xffff,op2);
+        return(0);
+    }
+    if ((op&0xfffc)==0x8110) {					/* MOVE Rn,Y0 */
+        core->y0=core->r[op&3];
+        return(0);
+    }
+    if ((op&0xfffc)==STUB_MOVE_A1_XRN) {		/* MOVE A1,x:(Rn)+ */
+        sim_xwrite(sim,core,sim_ea(core,op),core->a1);
+        return(0);
+    }
+    if ((op&0xfffc)==STUB_MOVE_B1_XRN) {		/* MOVE B1,x:(Rn)+ */
+        sim_xwrite(sim,core,sim_ea(core,op),core->b1);
+        return(0);
+    }
+    if ((op&0xfffc)==STUB_BRSET_XRN) {			/* BRSET #mask,X:(Rn),* */
+        if ((sim_xread(sim,core,core->r[op&3])&op2)==op2) core->pc=(core->pc-2)&0xffff;
+        return(0);
+    }
+    switch (op&0xffe0) {
+    case 0xf100: core->y0=sim_xread(sim,core,sim_ea(core,op)); return(0);	/* MOVE x:(Rn)[+],Y0 */
+    case 0xf300: core->y1=sim_xread(sim,core,sim_ea(core,op)); return(0);	/* MOVE x:(Rn)[+],Y1 */
+    case 0xd100: sim_xwrite(sim,core,sim_ea(core,op),core->y0); return(0);	/* MOVE Y0,x:(Rn)[+] */
+    case 0xd300: sim_xwrite(sim,core,sim_ea(core,op),core->y1); return(0);	/* MOVE Y1,x:(Rn)[+] */
+    case 0xe100: sim_pwrite(sim,core,sim_ea(core,op),core->y0); return(0);	/* MOVE Y0,p:(Rn)+ */
+    case 0xe300: sim_pwrite(sim,core,sim_ea(core,op),core->y1); return(0);	/* MOVE Y1,p:(Rn)+ */
+    case 0xe120: core->opdbr=core->y0=sim_pread(core,sim_ea(core,op)); return(0);	/* MOVE p:(Rn)+,Y0, the word passes the PDB */
+    case 0xe320: core->opdbr=core->y1=sim_pread(core,sim_ea(core,op)); return(0);	/* MOVE p:(Rn)+,Y1 */
+    }
+    return(-1);
+}
+
+/* executes the instruction at PC of a running core */
+static void sim_core_step(sim_state *sim, sim_core *core) {
+    unsigned int op=core->p[core->pc], op2=core->p[(core->pc+1)&0xffff];
+    int words=sim_insn_words(op);
+    core->pc=(core->pc+words)&0xffff;
+    if (sim_execute(sim,core,op,op2)) {
+        core->stalled=1;						/* e.g. application code, the model stops here silently */
+        return;
+    }
+    core->clock+=words*SIM_INSTR_TIME_US;
+    if ((core->loop)&&(core->pc==((core->la+1)&0xffff))) {	/* end of the DO loop body */
+        if (--core->lc) core->pc=core->ls; else core->loop=0;
+    }
+}
+
+/* lets the running cores catch up with the host */
+static void sim_run_cores(sim_state *sim) {
+    int i;
+    sim_core *core;
+    for (i=0;i<sim->devices;i++) {
+        if ((core=sim->chain[i].core)==NULL) continue;
+        if ((core->mode!=SIM_RUNNING)||(core->stalled)) {
+            core->clock=sim->now;
+            continue;
+        }
+        while ((core->mode==SIM_RUNNING)&&(!core->stalled)&&(core->clock<sim->now)) {
+            sim->event=core->clock;
+            sim_core_step(sim,core);
+        }
+    }
+    sim->event=sim->now;
+}
+
+static void sim_core_reset(sim_core *core) {
+    int i;
+    for (i=0;i<4;i++) core->r[i]=0;
+    core->y0=core->y1=0;
+    core->a1=core->b1=0;
+    core->omr=0;
+    core->sr=0x0300;
+    core->pc=0;
+    core->loop=0;
+    core->stalled=0;
+    core->opdbr_pending=0;
+    core->once_phase=ONCE_COMMAND;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* OnCE */
+
+static void sim_once_update(sim_state *sim, sim_core *core, unsigned int value) {
+    unsigned int reg=core->once_cmd&0x1f, op;
+    switch (core->once_phase) {
+    case ONCE_COMMAND:
+        core->once_cmd=value&0xff;
+        reg=core->once_cmd&0x1f;
+        if (core->once_cmd&0x80) {
+            core->once_phase=ONCE_READ;
+            core->once_read=(reg==0x08)?core->opgdbr:((reg==0x09)?core->opdbr:0);
+        } else core->once_phase=ONCE_WRITE;
+        break;
+    case ONCE_WRITE:
+        core->once_phase=ONCE_COMMAND;
+        if (reg!=0x09) break;					/* only OPDBR is modelled */
+        if (core->mode!=SIM_DEBUG) {
+            printf("SIM: OnCE instruction %#06x while not in debug mode, ignored\n",value);
+            break;
+        }
+        if (!(core->once_cmd&0x40)) {			/* no GO: first word of a two-word instruction */
+            core->opdbr=value;
+            core->opdbr_pending=1;
+            break;
+        }
+        op=core->opdbr;
+        core->opdbr=value;						/* a program memory read replaces it by the word read */
+        if (core->opdbr_pending) {
+            if (sim_execute(sim,core,op,value)) printf("SIM: unsupported instruction %#06x\n",op);
+        } else {
+            if (sim_execute(sim,core,value,0)) printf("SIM: unsupported instruction %#06x\n",value);
+        }
+        core->opdbr_pending=0;
+        if (core->once_cmd&0x20) {				/* EX: leave debug mode */
+            core->mode=SIM_RUNNING;
+            core->stalled=0;
+            core->clock=sim->now;
+        }
+        break;
+    case ONCE_READ:
+        core->once_phase=ONCE_COMMAND;
+        break;
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* JTAG chain */
+
+static void sim_tap_reset(sim_device *dev) {
+    dev->state=TLR;
+    dev->ir=dev->core?SIM_IR_IDCODE:((1u<<dev->ir_len)-1);
+}
+
+static void sim_capture_dr(sim_device *dev) {
+    sim_core *core=dev->core;
+    dev->dr_len=1;
+    dev->dr_shift=0;
+    if (!core) return;
+    switch (dev->ir) {
+    case SIM_IR_IDCODE:
+        dev->dr_len=32;
+        dev->dr_shift=SIM_IDCODE;
+        break;
+    case SIM_IR_ENABLE_ONCE:
+        if (core->once_phase==ONCE_COMMAND) {
+            dev->dr_len=8;
+        } else {
+            dev->dr_len=16;
+            if (core->once_phase==ONCE_READ) dev->dr_shift=core->once_read;
+        }
+        break;
+    }
+}
+
+static void sim_update_ir(sim_device *dev) {
+    sim_core *core=dev->core;
+    dev->ir=dev->ir_shift&((1u<<dev->ir_len)-1);
+    if (!core) return;
+    if (dev->ir==SIM_IR_DEBUG_REQ) {
+        if (core->mode==SIM_RUNNING) core->mode=SIM_DEBUG;
+        if (core->mode==SIM_RESET) core->debug_request=1;
+    }
+    if (dev->ir==SIM_IR_ENABLE_ONCE) core->once_phase=ONCE_COMMAND;
+}
+
+static void sim_tck_rise(sim_state *sim, int tms, int tdi) {
+    int i,in;
+    sim_device *dev;
+    for (i=sim->devices-1;i>=0;i--) {			/* from the TDO end, inputs are the latched outputs of the previous device */
+        dev=&(sim->chain[i]);
+        in=i?sim->chain[i-1].tdo:tdi;
+        switch (dev->state) {
+        case CAPDR: sim_capture_dr(dev); break;
+        case SHDR: dev->dr_shift=(dev->dr_shift>>1)|((unsigned long int)in<<(dev->dr_len-1)); break;
+        case CAPIR: dev->ir_shift=dev->core?(0x1|(dev->core->mode<<2)):0x1; break;
+        case SHIR: dev->ir_shift=(dev->ir_shift>>1)|(in<<(dev->ir_len-1)); break;
+        }
+        dev->state=tap_next[dev->state][tms?1:0];
+        switch (dev->state) {
+        case TLR: sim_tap_reset(dev); break;
+        case UPIR: sim_update_ir(dev); break;
+        case UPDR:
+            if (dev->core&&(dev->ir==SIM_IR_ENABLE_ONCE)) sim_once_update(sim,dev->core,dev->dr_shift&((1ul<<dev->dr_len)-1));
+            break;
+        }
+    }
+}
+
+static void sim_tck_fall(sim_state *sim) {
+    int i;
+    sim_device *dev;
+    for (i=0;i<sim->devices;i++) {
+        dev=&(sim->chain[i]);
+        if (dev->state==SHDR) dev->tdo=dev->dr_shift&1;
+        if (dev->state==SHIR) dev->tdo=dev->ir_shift&1;
+    }
+}
+
+static int sim_tdo(sim_state *sim) {
+    return(sim->devices?sim->chain[sim->devices-1].tdo:1);
+}
+
+/* applies new pin levels (JTAG_xxx_MASK bits) */
+static void sim_set_pins(sim_state *sim, unsigned char pins) {
+    unsigned char old=sim->pins;
+    int i;
+    sim_run_cores(sim);
+    sim->pins=pins;
+    for (i=0;i<sim->devices;i++) {
+        sim_core *core=sim->chain[i].core;
+        if (!(pins&JTAG_TRST_MASK)) sim_tap_reset(&(sim->chain[i]));
+        if (!core) continue;
+        if (!(pins&JTAG_RESET_MASK)) {
+            if (core->mode!=SIM_RESET) sim_core_reset(core);
+            core->mode=SIM_RESET;
+        } else if (core->mode==SIM_RESET) {
+            core->mode=core->debug_request?SIM_DEBUG:SIM_RUNNING;
+            core->debug_request=0;
+            core->clock=sim->now;
+        }
+    }
+    if ((pins&JTAG_TCK_MASK)&&(!(old&JTAG_TCK_MASK))) sim_tck_rise(sim,pins&JTAG_TMS_MASK,(pins&JTAG_TDI_MASK)?1:0);
+    if ((!(pins&JTAG_TCK_MASK))&&(old&JTAG_TCK_MASK)) sim_tck_fall(sim);
+}
+
+static unsigned char sim_pin_sample(sim_state *sim) {
+    return((sim->pins&~JTAG_TDO_MASK)|(sim_tdo(sim)?JTAG_TDO_MASK:0));
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* MPSSE */
+
+/* one TCK cycle, returns TDO sampled on the rising edge */
+static int sim_mpsse_clock(sim_state *sim, int tms, int tdi) {
+    int tdo=sim_tdo(sim);
+    unsigned char pins=sim->pins&~(JTAG_TMS_MASK|JTAG_TDI_MASK|JTAG_TCK_MASK);
+    if (tms) pins|=JTAG_TMS_MASK;
+    if (tdi) pins|=JTAG_TDI_MASK;
+    sim_set_pins(sim,pins);
+    sim_set_pins(sim,pins|JTAG_TCK_MASK);
+    sim_set_pins(sim,pins);
+    sim->now+=sim->tck_period;
+    if (sim->tck_period<sim->tck_min) {		/* clocked too fast: one TDO bit in 8 is read wrong */
+        sim->noise=sim->noise*1103515245+12345;
+        if (((sim->noise>>16)&7)==0) tdo=!tdo;
+    }
+    return(tdo);
+}
+
+/* length of the MPSSE command at buf, 0 if not complete yet */
+static int sim_mpsse_length(unsigned char *buf, int count) {
+    unsigned char op=buf[0];
+    if (op&0x80) {
+        switch (op) {
+        case SET_BITS_LOW: case SET_BITS_HIGH: case TCK_DIVISOR: case CLK_BYTES:
+            return((count>=3)?3:0);
+        case CLK_BITS:
+            return((count>=2)?2:0);
+        }
+        return(1);
+    }
+    if (op&(MPSSE_BITMODE|MPSSE_WRITE_TMS)) {
+        if (op&(MPSSE_DO_WRITE|MPSSE_WRITE_TMS)) return((count>=3)?3:0);
+        return((count>=2)?2:0);
+    }
+    if (count<3) return(0);
+    if (op&MPSSE_DO_WRITE) {
+        int n=3+buf[1]+256*buf[2]+1;
+        return((count>=n)?n:0);
+    }
+    return(3);
+}
+
+static void sim_mpsse_command(sim_state *sim, unsigned char *buf) {
+    unsigned char op=buf[0], value, pins;
+    int i,j,n,tdo;
+    if (op&0x80) {
+        switch (op) {
+        case SET_BITS_LOW:
+            value=buf[1];
+            pins=sim->pins&JTAG_TDO_MASK;
+            if (value&MPSSE_TCK_PIN) pins|=JTAG_TCK_MASK;
+            if (value&MPSSE_TDI_PIN) pins|=JTAG_TDI_MASK;
+            if (value&MPSSE_TMS_PIN) pins|=JTAG_TMS_MASK;
+            if (value&MPSSE_RESET_PIN) pins|=JTAG_RESET_MASK;
+            if (value&MPSSE_TRST_PIN) pins|=JTAG_TRST_MASK;
+            sim_set_pins(sim,pins);
+            break;
+        case GET_BITS_LOW:
+            pins=sim->pins;
+            value=sim_tdo(sim)?MPSSE_TDO_PIN:0;
+            if (pins&JTAG_TCK_MASK) value|=MPSSE_TCK_PIN;
+            if (pins&JTAG_TDI_MASK) value|=MPSSE_TDI_PIN;
+            if (pins&JTAG_TMS_MASK) value|=MPSSE_TMS_PIN;
+            if (pins&JTAG_RESET_MASK) value|=MPSSE_RESET_PIN;
+            if (pins&JTAG_TRST_MASK) value|=MPSSE_TRST_PIN;
+            sim_rx_put(sim,value);
+            break;
+        case GET_BITS_HIGH:
+            sim_rx_put(sim,0);
+            break;
+        case TCK_DIVISOR:
+            sim->tck_period=(buf[1]+256*buf[2]+1)/30.0;
+            break;
+        case CLK_BITS:							/* clock only, TMS and TDI keep their levels */
+            n=buf[1]+1;
+            for (i=0;i<n;i++) sim_mpsse_clock(sim,sim->pins&JTAG_TMS_MASK,sim->pins&JTAG_TDI_MASK);
+            break;
+        case CLK_BYTES:
+            n=8*(buf[1]+256*buf[2]+1);
+            for (i=0;i<n;i++) sim_mpsse_clock(sim,sim->pins&JTAG_TMS_MASK,sim->pins&JTAG_TDI_MASK);
+            break;
+        case SET_BITS_HIGH: case SEND_IMMEDIATE: case LOOPBACK_END: case DIS_DIV_5:
+        case DIS_ADAPTIVE: case DIS_3_PHASE:
+            break;
+        default:								/* bad command */
+            sim_rx_put(sim,0xfa);
+            sim_rx_put(sim,op);
+        }
+        return;
+    }
+    if (op&MPSSE_WRITE_TMS) {
+        n=buf[1]+1;
+        value=0;
+        for (i=0;i<n;i++) {
+            tdo=sim_mpsse_clock(sim,(buf[2]>>i)&1,buf[2]>>7);
+            value=(value>>1)|(tdo<<7);
+        }
+        if (op&MPSSE_DO_READ) sim_rx_put(sim,value);
+        return;
+    }
+    if (op&MPSSE_BITMODE) {
+        n=buf[1]+1;
+        value=0;
+        for (i=0;i<n;i++) {
+            tdo=sim_mpsse_clock(sim,0,(op&MPSSE_DO_WRITE)?((buf[2]>>i)&1):0);
+            value=(value>>1)|(tdo<<7);
+        }
+        if (op&MPSSE_DO_READ) sim_rx_put(sim,value);
+        return;
+    }
+    n=buf[1]+256*buf[2]+1;
+    for (j=0;j<n;j++) {
+        value=0;
+        for (i=0;i<8;i++) {
+            tdo=sim_mpsse_clock(sim,0,(op&MPSSE_DO_WRITE)?((buf[3+j]>>i)&1):0);
+            value|=tdo<<i;
+        }
+        if (op&MPSSE_DO_READ) sim_rx_put(sim,value);
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+/* port interface */
+
+static int sim_open(jtag_session *s, unsigned char bitmode) {
+    sim_state *sim;
+    int i;
+    if ((s->sim==NULL)&&(sim_configure(s,"d")!=0)) return(-1);
+    sim=(sim_state*)s->sim;
+    sim->bitmode=bitmode;
+    sim->now=0;
+    sim->event=0;
+    sim->rx_head=sim->rx_tail=0;
+    sim->cmd_count=0;
+    sim->pins=0;
+    for (i=0;i<sim->devices;i++) sim_tap_reset(&(sim->chain[i]));
+    sim_set_pins(sim,0);
+    return(0);
+}
+
+static void sim_close(jtag_session *s) {
+    (void)s;								/* the simulated chain lives until sim_free */
+}
+
+static int sim_write(jtag_session *s, unsigned char *buf, int size) {
+    sim_state *sim=(sim_state*)s->sim;
+    int i,n;
+    sim->now+=sim->latency;
+    if (sim->bitmode==BITMODE_MPSSE) {
+        for (i=0;i<size;i++) {
+            if (sim->cmd_count<(int)sizeof(sim->cmd)) sim->cmd[sim->cmd_count++]=buf[i];
+            while ((sim->cmd_count)&&((n=sim_mpsse_length(sim->cmd,sim->cmd_count))!=0)) {
+                sim_mpsse_command(sim,sim->cmd);
+                sim->cmd_count-=n;
+                memmove(sim->cmd,sim->cmd+n,sim->cmd_count);
+            }
+        }
+        return(size);
+    }
+    for (i=0;i<size;i++) {
+        if (sim->bitmode==BITMODE_SYNCBB) sim_rx_put(sim,sim_pin_sample(sim));	/* pins are sampled before the update */
+        sim_set_pins(sim,buf[i]);
+        sim->now+=1e6/SIM_BITBANG_RATE;
+    }
+    return(size);
+}
+
+static int sim_read(jtag_session *s, unsigned char *buf, int size) {
+    sim_state *sim=(sim_state*)s->sim;
+    int n=0;
+    sim->now+=sim->latency;
+    sim_run_cores(sim);
+    while ((n<size)&&(sim->rx_tail!=sim->rx_head)) {
+        buf[n++]=sim->rx[sim->rx_tail];
+        sim->rx_tail=(sim->rx_tail+1)&0xffff;
+    }
+    return(n);
+}
+
+static int sim_read_pins(jtag_session *s, unsigned char *pins) {
+    sim_state *sim=(sim_state*)s->sim;
+    sim->now+=sim->latency;
+    sim_run_cores(sim);
+    *pins=sim_pin_sample(sim);
+    return(0);
+}
+
+/* the transfer is done when it is submitted, the latency is charged as for sim_write */
+static void *sim_submit(jtag_session *s, unsigned char *buf, int size) {
+    sim_write(s,buf,size);
+    return(s->sim);
+}
+
+static int sim_complete(jtag_session *s, void *transfer) {
+    (void)s;
+    (void)transfer;								/* the data went out in sim_submit */
+    return(0);
+}
+
+jtag_port sim_port={sim_open, sim_close, sim_write, sim_read, sim_read_pins, sim_submit, sim_complete};
+
+/* ---------------------------------------------------------------------------------------------- */
+/* set-up */
+
+static void sim_free_cores(sim_state *sim) {
+    int i;
+    for (i=0;i<sim->devices;i++) if (sim->chain[i].core) free(sim->chain[i].core);
+    sim->devices=0;
+}
+
+/* chain description from TDI to TDO: 'd' is a DSP56F80x, a digit is another device with that IR length */
+/* the simulator state is allocated for the session on the first call */
+/* returns 0 on success, -1 on bad chain description */
+int sim_configure(jtag_session *s, char *chain) {
+    sim_state *sim;
+    int i;
+    if (s->sim==NULL) {
+        if ((s->sim=calloc(1,sizeof(sim_state)))==NULL) return(-1);
+        sim=(sim_state*)s->sim;
+        sim->latency=SIM_USB_LATENCY_US;
+        sim->tck_period=1.0;
+        sim->bitmode=BITMODE_RESET;
+    }
+    sim=(sim_state*)s->sim;
+    sim_free_cores(sim);
+    if (!*chain) chain="d";
+    for (;*chain;chain++) {
+        if (sim->devices==SIM_DEVICES_MAX) return(-1);
+        sim->chain[sim->devices].core=NULL;
+        if ((*chain=='d')||(*chain=='D')) {
+            sim->chain[sim->devices].ir_len=4;
+            sim->chain[sim->devices].core=(sim_core*)calloc(1,sizeof(sim_core));
+            if (sim->chain[sim->devices].core==NULL) return(-1);
+            for (i=0;i<0x10000;i++) sim->chain[sim->devices].core->x[i]=sim->chain[sim->devices].core->p[i]=0xffff;
+            sim->chain[sim->devices].core->mode=SIM_RESET;
+            sim_core_reset(sim->chain[sim->devices].core);
+        } else if ((*chain>='1')&&(*chain<='9')) {
+            sim->chain[sim->devices].ir_len=*chain-'0';
+        } else return(-1);
+        sim_tap_reset(&(sim->chain[sim->devices]));
+        sim->chain[sim->devices].tdo=1;
+        sim->devices++;
+    }
+    return(0);
+}
+
+/* releases the simulated chain of the session */
+void sim_free(jtag_session *s) {
+    if (s->sim==NULL) return;
+    sim_free_cores((sim_state*)s->sim);
+    free(s->sim);
+    s->sim=NULL;
+}
+
+/* gives dst its own copy of the simulated chain of src, for a session copied by jtag_session_copy */
+/* returns 0 on success (also when src has no simulator), -1 out of memory */
+int sim_copy(jtag_session *dst, jtag_session *src) {
+    sim_state *sim;
+    int i;
+    dst->sim=NULL;
+    if (src->sim==NULL) return(0);
+    sim=(sim_state*)malloc(sizeof(sim_state));
+    if (sim==NULL) return(-1);
+    memcpy(sim,src->sim,sizeof(sim_state));
+    for (i=0;i<sim->devices;i++) {
+        if (sim->chain[i].core==NULL) continue;
+        sim->chain[i].core=(sim_core*)malloc(sizeof(sim_core));
+        if (sim->chain[i].core==NULL) {
+            sim->devices=i;
+            sim_free_cores(sim);
+            free(sim);
+            return(-1);
+        }
+        memcpy(sim->chain[i].core,((sim_state*)src->sim)->chain[i].core,sizeof(sim_core));
+    }
+    dst->sim=sim;
+    return(0);
+}
+
+void sim_set_latency(jtag_session *s, double latency_us) {
+    if ((s->sim==NULL)&&(sim_configure(s,"d")!=0)) return;
+    ((sim_state*)s->sim)->latency=latency_us;
+}
+
+/* TCK frequency above which TDO is read with errors, models a long cable or a weak board */
+void sim_set_tck_limit(jtag_session *s, double mhz) {
+    if ((s->sim==NULL)&&(sim_configure(s,"d")!=0)) return;
+    ((sim_state*)s->sim)->tck_min=(mhz>0)?1.0/mhz:0;
+}
+
+/* maps the flash blocks and interface units of the config file into every simulated DSP */
+void sim_attach_flash(jtag_session *s, flash_constants flash_param[], int flash_count) {
+    sim_state *sim=(sim_state*)s->sim;
+    int i,j,k;
+    sim_core *core;
+    if (sim==NULL) return;
+    for (i=0;i<sim->devices;i++) {
+        if ((core=sim->chain[i].core)==NULL) continue;
+        core->fiu_count=0;
+        core->region_count=0;
+        for (j=0;(j<flash_count)&&(core->region_count<SIM_REGIONS_MAX);j++) {
+            for (k=0;k<core->fiu_count;k++) if (core->fiu[k].address==flash_param[j].interface_address) break;
+            if (k==core->fiu_count) {
+                if (k==SIM_FIU_MAX) continue;
+                memset(&(core->fiu[k]),0,sizeof(sim_fiu));
+                core->fiu[k].address=flash_param[j].interface_address;
+                core->fiu_count++;
+            }
+            core->region[core->region_count].start=flash_param[j].flash_start;
+            core->region[core->region_count].end=flash_param[j].flash_end;
+            core->region[core->region_count].program_memory=flash_param[j].program_memory;
+            core->region[core->region_count].fiu=k;
+            core->region_count++;
+        }
+    }
+}
+
+double sim_time(jtag_session *s) {
+    return(s->sim?((sim_state*)s->sim)->now:0);
+}
@@ -0,0 +1,35 @@
+/*****************************************************************************
+*
+* File Name:         target_sim.h
+*
+* Description:       Software model of a JTAG chain with DSP56F80x targets
+*
+* Modules Included:  None
+*
+****************************************************************************/
+
+#ifndef TARGET_SIM____H
+#define TARGET_SIM____H
+
+#include "flash.h"
+#include "hw_access.h"
+#include "jtag.h"
+
+#define SIM_DEVICES_MAX		8			/* devices in the simulated JTAG chain */
+#define SIM_IDCODE			0x01F2401DUL	/* IDCODE returned by the simulated DSP (Motorola manufacturer code) */
+#define SIM_USB_LATENCY_US	125.0		/* time of one USB transfer (one high-speed microframe) */
+#define SIM_BITBANG_RATE	153600.0	/* bit-bang pin updates per second (default 9600 baud * 16) */
+#define SIM_IPBUS_CLOCK		36000000.0	/* peripheral clock the FIU timing registers are derived from */
+#define SIM_INSTR_TIME_US	0.025		/* execution time of one instruction word (40 MIPS) */
+
+extern jtag_port sim_port;
+
+int sim_configure(jtag_session *s, char *chain);	/* returns 0 on success, -1 on bad chain description */
+void sim_free(jtag_session *s);
+int sim_copy(jtag_session *dst, jtag_session *src);	/* own simulated chain for a copied session */
+void sim_set_latency(jtag_session *s, double latency_us);
+void sim_set_tck_limit(jtag_session *s, double mhz);	/* TDO errors above mhz, 0=no limit */
+void sim_attach_flash(jtag_session *s, flash_constants flash_param[], int flash_count);
+double sim_time(jtag_session *s);		/* simulated time since open, in microseconds */
+
+#endif
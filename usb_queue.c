@@ -0,0 +1,193 @@
+/*****************************************************************************
+*
+* File Name:         usb_queue.c
+*
+* Description:       Pipelined USB writes through a ring drained by a second thread
+*
+* Modules Included:
+*	void set_usb_queue(jtag_session *s, unsigned int depth);
+*	int usb_queue_start(jtag_session *s);
+*	void usb_queue_stop(jtag_session *s);
+*	int usb_queue_write(jtag_session *s, unsigned char *buf, int size);
+*	int usb_queue_sync(jtag_session *s);
+*
+* Comments: The JTAG routines (producer) copy every write into a single producer single
+*           consumer ring and go on generating the next scans. The drain thread (consumer)
+*           submits the slots to the port and keeps up to the queue depth of transfers in
+*           flight, so the bus does not wait for the host between the writes. The two
+*           threads only share the head and tail indexes, no locks are taken.
+*           A read has to see the effect of all writes before it: usb_queue_sync waits for
+*           the ring to drain and the port is then used by the JTAG thread alone.
+*           Ports without submit/complete (jtag_port) are written with blocking writes from
+*           the drain thread, one transfer at a time.
+*           The thread needs pthreads and C11 atomics, it is only built with USB_QUEUE_THREAD
+*           (the .pro file defines it on unix), elsewhere usb_queue_start fails and the writes
+*           stay blocking.
+*
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "usb_queue.h"
+
+/* transfers kept in flight, 0: blocking writes, must be called before open_port() */
+void set_usb_queue(jtag_session *s, unsigned int depth) {
+    if (depth>USB_QUEUE_DEPTH_MAX) depth=USB_QUEUE_DEPTH_MAX;
+    s->usb_queue_depth=depth;
+}
+
+#ifdef USB_QUEUE_THREAD
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+typedef struct {
+    int				length;
+    void			*handle;		/* transfer in flight, NULL for a blocking write */
+    unsigned char	data[USB_QUEUE_SLOT_SIZE];
+} usb_slot;
+
+typedef struct {
+    usb_slot		slot[USB_QUEUE_SLOTS];
+    atomic_uint		head;			/* slots filled by the JTAG thread */
+    atomic_uint		tail;			/* slots whose transfer is done, free again */
+    atomic_int		stop;			/* 1: end the thread once the ring is empty */
+    atomic_int		error;			/* first write error of the drain thread, 0: none */
+    atomic_ulong	idle;			/* times the ring ran empty with nothing in flight */
+    int				depth;
+    pthread_t		thread;
+} usb_queue;
+
+static void usb_queue_error(usb_queue *q, int rc) {
+    int none=0;
+    atomic_compare_exchange_strong(&q->error,&none,rc);
+}
+
+/* consumer: submits the filled slots and releases them in order when their transfer is done */
+static void *usb_queue_drain(void *arg) {
+    jtag_session *s=(jtag_session*)arg;
+    usb_queue *q=(usb_queue*)s->usb_queue;
+    unsigned int next,done,head;
+    int in_flight=0,rc;
+    usb_slot *slot;
+    next=done=atomic_load(&q->tail);
+    for (;;) {
+        head=atomic_load_explicit(&q->head,memory_order_acquire);
+        if ((next!=head)&&(in_flight<q->depth)) {
+            slot=&(q->slot[next%USB_QUEUE_SLOTS]);
+            next++;
+            if (s->port->submit!=NULL) {
+                if ((slot->handle=s->port->submit(s,slot->data,slot->length))==NULL) usb_queue_error(q,-1);
+                in_flight++;
+                continue;
+            }
+            if ((rc=s->port->write(s,slot->data,slot->length))<0) usb_queue_error(q,rc);
+            done++;
+        } else if (in_flight) {				/* nothing more to submit: wait for the oldest transfer */
+            slot=&(q->slot[done%USB_QUEUE_SLOTS]);
+            if ((slot->handle!=NULL)&&((rc=s->port->complete(s,slot->handle))<0)) usb_queue_error(q,rc);
+            in_flight--;
+            done++;
+        } else {
+            if (atomic_load(&q->stop)) break;
+            sched_yield();
+            continue;
+        }
+        atomic_store_explicit(&q->tail,done,memory_order_release);
+        if ((!in_flight)&&(next==atomic_load_explicit(&q->head,memory_order_acquire))) atomic_fetch_add(&q->idle,1);
+    }
+    return(NULL);
+}
+
+/* starts the drain thread of an open port, returns -1 when it cannot run (writes stay blocking) */
+int usb_queue_start(jtag_session *s) {
+    usb_queue *q;
+    if ((q=(usb_queue*)calloc(1,sizeof(usb_queue)))==NULL) return(-1);
+    q->depth=s->usb_queue_depth;
+    s->usb_queue=q;
+    if (pthread_create(&(q->thread),NULL,usb_queue_drain,s)!=0) {
+        free(q);
+        s->usb_queue=NULL;
+        return(-1);
+    }
+    return(0);
+}
+
+/* sends the rest of the ring and ends the thread, must be called before the port is closed */
+void usb_queue_stop(jtag_session *s) {
+    usb_queue *q=(usb_queue*)s->usb_queue;
+    if (q==NULL) return;
+    usb_queue_sync(s);
+    atomic_store(&q->stop,1);
+    pthread_join(q->thread,NULL);
+    free(q);
+    s->usb_queue=NULL;
+}
+
+/* producer: copies the data to the ring, waits only when the ring is full */
+int usb_queue_write(jtag_session *s, unsigned char *buf, int size) {
+    usb_queue *q=(usb_queue*)s->usb_queue;
+    unsigned int head=atomic_load_explicit(&q->head,memory_order_relaxed);
+    unsigned long int queued;
+    int i,chunk;
+    usb_slot *slot;
+    if ((i=atomic_exchange(&q->error,0))!=0) return(i);	/* reported by jtag_usb_write */
+    for (i=0;i<size;i+=chunk) {
+        chunk=(size-i>USB_QUEUE_SLOT_SIZE)?USB_QUEUE_SLOT_SIZE:(size-i);
+        if (head-atomic_load_explicit(&q->tail,memory_order_acquire)==USB_QUEUE_SLOTS) {
+            s->jtag_stats.queue_stalls++;		/* the bus is slower than the scans are generated */
+            while (head-atomic_load_explicit(&q->tail,memory_order_acquire)==USB_QUEUE_SLOTS) sched_yield();
+        }
+        slot=&(q->slot[head%USB_QUEUE_SLOTS]);
+        memcpy(slot->data,buf+i,chunk);
+        slot->length=chunk;
+        slot->handle=NULL;
+        head++;
+        atomic_store_explicit(&q->head,head,memory_order_release);
+        queued=head-atomic_load_explicit(&q->tail,memory_order_acquire);
+        if (queued>s->jtag_stats.queue_max) s->jtag_stats.queue_max=queued;
+    }
+    return(size);
+}
+
+/* waits until all writes are done and collects the counters of the drain thread */
+/* returns the first write error since the last call, 0 when all writes went out */
+int usb_queue_sync(jtag_session *s) {
+    usb_queue *q=(usb_queue*)s->usb_queue;
+    unsigned int head;
+    int rc;
+    if (q==NULL) return(0);
+    head=atomic_load_explicit(&q->head,memory_order_relaxed);
+    if (atomic_load_explicit(&q->tail,memory_order_acquire)!=head) {
+        s->jtag_stats.queue_waits++;
+        while (atomic_load_explicit(&q->tail,memory_order_acquire)!=head) sched_yield();
+    }
+    s->jtag_stats.queue_idle+=atomic_exchange(&q->idle,0);
+    if ((rc=atomic_exchange(&q->error,0))!=0) printf("USB write failed with: %d\n",rc);
+    return(rc);
+}
+#else
+/* no drain thread in this build, the session keeps its blocking writes */
+int usb_queue_start(jtag_session *s) {
+    (void)s;
+    return(-1);
+}
+
+void usb_queue_stop(jtag_session *s) {
+    (void)s;
+}
+
+int usb_queue_write(jtag_session *s, unsigned char *buf, int size) {
+    (void)s;
+    (void)buf;
+    (void)size;
+    return(-1);
+}
+
+int usb_queue_sync(jtag_session *s) {
+    (void)s;
+    return(0);
+}
+#endif
@@ -0,0 +1,27 @@
+/*****************************************************************************
+*
+* File Name:         usb_queue.h
+*
+* Description:       Pipelined USB writes through a ring drained by a second thread
+*
+* Modules Included:  None
+*
+****************************************************************************/
+
+#ifndef USB_QUEUE____H
+#define USB_QUEUE____H
+
+#include "jtag.h"
+
+#define USB_QUEUE_SLOTS		64		/* writes the ring holds, power of two */
+#define USB_QUEUE_SLOT_SIZE	4096	/* bytes per slot, longer writes take several slots */
+#define USB_QUEUE_DEPTH		4		/* transfers in flight without a value to -async */
+#define USB_QUEUE_DEPTH_MAX	16
+
+void set_usb_queue(jtag_session *s, unsigned int depth);	/* transfers kept in flight, 0: blocking writes, must be called before open_port() */
+int usb_queue_start(jtag_session *s);			/* starts the drain thread, returns -1 when it cannot run */
+void usb_queue_stop(jtag_session *s);			/* sends the rest of the ring and ends the thread */
+int usb_queue_write(jtag_session *s, unsigned char *buf, int size);	/* copies the data to the ring, returns size or <0 on an earlier error */
+int usb_queue_sync(jtag_session *s);			/* waits until all writes are done, returns <0 on a write error */
+
+#endif